@@ -3,6 +3,22 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <span>
+#include <bit>
+#include <string_view>
+#include <cstddef>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
@@ -26,6 +42,241 @@ namespace srd::core
 
             bool isCursorLocked = false;
             void lockCursor(bool lock);
+
+            /** Set while a render thread owns the GL context, 'show' then leaves swapping to it. */
+            bool renderThreaded = false;
+        };
+    }
+
+    /**
+     * Lock-free single producer, single consumer queue of reusable slots.
+     * The producer fills 'back()' and publishes it with 'push()', the consumer
+     * reads 'front()' and releases it with 'pop()'. Both block while there is nothing to do.
+     */
+    template<typename T>
+    struct frame_queue
+    {
+        std::vector<T> slots;
+        std::atomic<size_t> head = 0; // Next slot to read.
+        std::atomic<size_t> tail = 0; // Next slot to write.
+
+        frame_queue(size_t capacity) : slots(capacity) {}
+
+        T &back()
+        {
+            auto t = tail.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                auto h = head.load(std::memory_order_acquire);
+                if(t - h < slots.size()) break;
+                head.wait(h, std::memory_order_acquire);
+            }
+            return slots[t % slots.size()];
+        }
+
+        void push()
+        {
+            tail.fetch_add(1, std::memory_order_release);
+            tail.notify_one();
+        }
+
+        T &front()
+        {
+            auto h = head.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                auto t = tail.load(std::memory_order_acquire);
+                if(t != h) break;
+                tail.wait(t, std::memory_order_acquire);
+            }
+            return slots[h % slots.size()];
+        }
+
+        void pop()
+        {
+            head.fetch_add(1, std::memory_order_release);
+            head.notify_one();
+        }
+    };
+
+    /**
+     * Work-stealing job system: a fixed pool of workers, each with its own deque.
+     * The thread that calls 'init' is the main thread, it executes jobs while it waits.
+     */
+    namespace jobs
+    {
+        /** A unit of work. Owned by whoever creates it, it must outlive its execution. */
+        struct job
+        {
+            std::function<void()> work;
+            /** Jobs whose completion this one is part of, 'wait'ing on it waits on its children too. */
+            job *parent = nullptr;
+            /** Jobs which depend on this one, see 'depend'. */
+            std::vector<job*> successors;
+
+            /** Itself and its unfinished children. */
+            std::atomic<int> unfinished = 0;
+            /** Unfinished predecessors, plus one until the job is 'run'. */
+            std::atomic<int> dependencies = 1;
+            std::atomic<bool> finished = false;
+            int predecessors = 0;
+            /** Only executed by the main thread, e.g. because it polls the window. */
+            bool mainThread = false;
+
+            job() = default;
+            job(std::function<void()> work, job *parent = nullptr) : work(std::move(work)), parent(parent) {}
+
+            /** Allows the job (and its dependencies) to be run again, e.g. every frame. */
+            void reset();
+        };
+
+        /** Starts 'workers' threads, one less than the core count if 0. */
+        void init(unsigned int workers = 0);
+        void shutdown();
+
+        /** Number of threads executing jobs, including the main thread. */
+        unsigned int threadCount();
+
+        /** Index of the calling thread, 0 for the main thread and -1 if it does not belong to the system. */
+        int threadIndex();
+
+        /** Makes 'successor' wait for 'predecessor' to finish, neither may be running yet. */
+        void depend(job &successor, job &predecessor);
+
+        /** Schedules a job, it is executed once all of its predecessors have finished. */
+        void run(job &j);
+
+        bool done(const job &j);
+
+        /** Executes other jobs until 'j' is done (only sleeps on threads not owned by the system). */
+        void wait(const job &j);
+
+        /**
+         * Calls 'f(first, last)' on subranges of [begin, end) in parallel and waits for all of them.
+         * Ranges are split in halves on demand, idle threads steal the largest remaining halves.
+         */
+        template<typename F>
+        void parallel_for(size_t begin, size_t end, F &&f, size_t minChunk = 1)
+        {
+            if(begin >= end) return;
+            size_t grain = std::max<size_t>(std::max<size_t>(minChunk, 1), (end - begin) / (threadCount() * 8));
+            if(end - begin <= grain)
+            {
+                f(begin, end);
+                return;
+            }
+
+            // Halving stops at ranges of at most 'grain', each split spawns one job.
+            std::vector<job> children(2 * (end - begin) / grain + 2);
+            std::atomic<size_t> next = 0;
+            job root;
+
+            std::function<void(size_t, size_t)> split = [&](size_t first, size_t last)
+            {
+                while(last - first > grain)
+                {
+                    size_t middle = first + (last - first) / 2;
+                    auto &child = children[next.fetch_add(1, std::memory_order_relaxed)];
+                    child.work = [&split, middle, last]() { split(middle, last); };
+                    child.parent = &root;
+                    run(child);
+                    last = middle;
+                }
+                f(first, last);
+            };
+
+            root.work = [&]() { split(begin, end); };
+            run(root);
+            wait(root);
+        }
+
+        /** Data accessed by a task, as bitmasks of user-defined data sets. */
+        struct access
+        {
+            uint64_t reads = 0, writes = 0;
+
+            bool conflicts(const access &other) const
+            {
+                return (writes & (other.reads | other.writes)) || (reads & other.writes);
+            }
+        };
+
+        /**
+         * Tasks with declared data accesses. 'compile' orders conflicting tasks in the
+         * order they were added, the resulting DAG is reused by every 'execute'.
+         */
+        struct graph
+        {
+            struct node
+            {
+                std::string name;
+                access data;
+                std::function<void()> work;
+                bool mainThread = false;
+                /** Direct predecessors (implied ones are left out), filled by 'compile'. */
+                std::vector<size_t> predecessors;
+
+                /** Timings of the last execution, in seconds since it started. */
+                float start = 0, duration = 0;
+                int thread = -1;
+            };
+
+            std::vector<node> nodes;
+            std::vector<std::unique_ptr<job>> jobs;
+            job root;
+            std::chrono::steady_clock::time_point started;
+            /** Duration of the last execution in seconds. */
+            float duration = 0;
+
+            size_t add(std::string name, access data, std::function<void()> work, bool mainThread = false);
+
+            /** Builds the dependencies, must be called after the last 'add'. */
+            void compile();
+
+            /** Runs every node and waits for them, helping on the calling thread. */
+            void execute();
+
+            /** Graphviz description of the graph, with the last timings. */
+            std::string dot() const;
+        };
+    }
+
+    namespace file
+    {
+        /** How a file is going to be read, passed on to the kernel as a hint. */
+        enum class access { normal, sequential, random };
+
+        /**
+         * A read-only view of a whole file, unmapped when destroyed. Files smaller than
+         * 'smallFile' are read into a buffer instead, since mapping them costs more than the copy.
+         */
+        struct mapped_file
+        {
+            static constexpr size_t smallFile = 16 * 1024;
+
+            const unsigned char *data = nullptr;
+            size_t size = 0;
+
+            mapped_file() = default;
+            explicit mapped_file(const std::string &path, access hint = access::normal);
+            mapped_file(const mapped_file&) = delete;
+            mapped_file &operator=(const mapped_file&) = delete;
+            mapped_file(mapped_file &&other) noexcept { *this = std::move(other); }
+            ~mapped_file();
+
+            /** Swaps, so that 'other' releases the previous mapping. */
+            mapped_file &operator=(mapped_file &&other) noexcept;
+
+            /** Hints how 'length' bytes at 'offset' are about to be read, e.g. one entry of a pack. */
+            void advise(size_t offset, size_t length, access hint) const;
+
+            std::span<const std::byte> bytes() const { return { (const std::byte*)data, size }; }
+            std::string_view text() const { return { (const char*)data, size }; }
+            explicit operator bool() const { return data != nullptr; }
+
+        private:
+            bool mapped_ = false;
+            std::vector<unsigned char> buffer_;
         };
     }
 
@@ -39,6 +290,245 @@ namespace srd::core
             glm::mat4 matrix;
             void update();
         };
+
+        /** Axis-aligned bounding box, empty by default. */
+        struct aabb
+        {
+            glm::vec3 min = glm::vec3( std::numeric_limits<float>::max());
+            glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+            void extend(const glm::vec3 &point);
+            void extend(const aabb &box);
+            glm::vec3 center() const;
+            /** Returns the box that encloses this one after being transformed by 'matrix'. */
+            aabb transformed(const glm::mat4 &matrix) const;
+            bool contains(const aabb &box) const;
+            bool intersects(const aabb &box) const;
+            float area() const;
+        };
+
+        /** View frustum, extracted from a view-projection matrix. */
+        struct frustum
+        {
+            glm::vec4 planes[6];
+
+            frustum() = default;
+            frustum(const glm::mat4 &viewProjection);
+
+            /** Conservative test, may report boxes near the corners as intersecting. */
+            bool intersects(const aabb &box) const;
+        };
+
+        struct sphere
+        {
+            glm::vec3 center;
+            float radius;
+
+            bool intersects(const aabb &box) const;
+        };
+
+        /** The segment from 'origin' to 'origin + direction * length', 'direction' does not have to be normalized. */
+        struct ray
+        {
+            glm::vec3 origin, direction;
+            float length = std::numeric_limits<float>::max();
+
+            /** Returns where the ray enters 'box' (0 if it starts inside) or infinity if it misses it within 'length'. */
+            float intersects(const aabb &box) const;
+        };
+
+        /**
+         * Dynamic AABB tree (after Box2D's b2DynamicTree). Leaves keep their box fattened by 'margin' and
+         * stretched along their last displacement, so objects that move a little are not reinserted.
+         * Leaves are inserted next to the sibling that grows the tree's surface area the least and nodes
+         * are rotated on the way up to keep it balanced. Nodes live in one array and are reused.
+         *
+         * Queries take a batch of volumes and visit each node once for all of them that still overlap it,
+         * calling 'f(query, data)' for every leaf a volume overlaps. Not thread safe while modified.
+         */
+        struct aabb_tree
+        {
+            static constexpr uint32_t null_node = UINT32_MAX;
+
+            struct node
+            {
+                aabb box;
+                uint32_t parent = null_node, left = null_node, right = null_node;
+                /** 0 for leaves, -1 for free nodes, which link through 'parent'. */
+                int32_t height = -1;
+                uint32_t data = 0;
+
+                bool leaf() const { return left == null_node; }
+            };
+
+            std::vector<node> nodes;
+            uint32_t root = null_node, freeList = null_node;
+            size_t leafCount = 0;
+            float margin = 0.1f;
+            /** How far ahead of its last displacement a moved leaf's box reaches. */
+            float predict = 2.f;
+
+            /** Returns the leaf, which stays valid until it is removed. */
+            uint32_t insert(const aabb &box, uint32_t data);
+            void remove(uint32_t leaf);
+            /** Returns true if the leaf had to be reinserted, false while 'box' still fits its fattened box. */
+            bool move(uint32_t leaf, const aabb &box, const glm::vec3 &displacement = glm::vec3(0.f));
+            void clear();
+
+            const aabb &bounds(uint32_t leaf) const { return nodes[leaf].box; }
+            uint32_t data(uint32_t leaf) const { return nodes[leaf].data; }
+            int height() const { return root == null_node ? 0 : nodes[root].height; }
+            size_t size() const { return leafCount; }
+
+            /** Visits the leaves overlapping any of 'queries' (boxes, spheres or frustums). */
+            template<typename Q, typename F>
+            void query(std::span<const Q> queries, F &&f) const
+            {
+                for(size_t base = 0; base < queries.size(); base += 64)
+                {
+                    auto batch = queries.subspan(base, std::min<size_t>(64, queries.size() - base));
+                    traverse_(batch.size(), [&](size_t q, const aabb &box) { return batch[q].intersects(box); },
+                        [&](size_t q, uint32_t data) { f(base + q, data); });
+                }
+            }
+
+            template<typename Q, typename F>
+            void query(const Q &query, F &&f) const
+            {
+                this->query(std::span<const Q>(&query, 1), [&](size_t, uint32_t data) { f(data); });
+            }
+
+            /**
+             * Visits the leaves 'rays' pass through, 'f(ray, data, length)' returns the ray's new length:
+             * where it hit the object to only look for closer ones, 0 to stop it or 'length' to go on.
+             */
+            template<typename F>
+            void raycast(std::span<const ray> rays, F &&f) const
+            {
+                for(size_t base = 0; base < rays.size(); base += 64)
+                {
+                    ray batch[64];
+                    size_t count = std::min<size_t>(64, rays.size() - base);
+                    std::copy_n(rays.begin() + base, count, batch);
+                    traverse_(count, [&](size_t r, const aabb &box) { return batch[r].intersects(box) <= batch[r].length; },
+                        [&](size_t r, uint32_t data) { batch[r].length = f(base + r, data, batch[r].length); });
+                }
+            }
+
+        private:
+            /** Depth first, the stack is enough for any tree balanced by height. */
+            template<typename Test, typename Visit>
+            void traverse_(size_t count, Test &&test, Visit &&visit) const
+            {
+                if(root == null_node || count == 0) return;
+                struct entry { uint32_t node; uint64_t mask; };
+                entry stack[256];
+                int top = 0;
+                stack[top++] = { root, count == 64 ? ~0ull : (1ull << count) - 1 };
+                while(top > 0)
+                {
+                    auto [index, mask] = stack[--top];
+                    const auto &n = nodes[index];
+                    uint64_t hits = 0;
+                    for(uint64_t m = mask; m; m &= m - 1)
+                    {
+                        auto q = std::countr_zero(m);
+                        if(test(q, n.box)) hits |= 1ull << q;
+                    }
+                    if(!hits) continue;
+                    if(n.leaf())
+                    {
+                        for(; hits; hits &= hits - 1) visit(std::countr_zero(hits), n.data);
+                        continue;
+                    }
+                    stack[top++] = { n.right, hits };
+                    stack[top++] = { n.left, hits };
+                }
+            }
+
+            uint32_t allocate_();
+            void free_(uint32_t index);
+            void insertLeaf_(uint32_t leaf);
+            void removeLeaf_(uint32_t leaf);
+            uint32_t balance_(uint32_t index);
+        };
+
+        /**
+         * Static bounding volume hierarchy over a mesh's triangles, built top down with the surface area
+         * heuristic over binned centroids. Large subtrees are built in parallel on the job system.
+         * Siblings are stored next to each other, so nodes only keep their first child and fit in 32 bytes.
+         *
+         * Rays can be cast one at a time or in packets of 4, which traverse the tree together with SSE
+         * where available. Queries are const and may run on any number of threads at once.
+         */
+        struct triangle_bvh
+        {
+            static constexpr uint32_t null_triangle = UINT32_MAX;
+
+            struct node
+            {
+                glm::vec3 min;
+                /** The left child of inner nodes (the right one follows it), the first triangle of leaves. */
+                uint32_t first;
+                glm::vec3 max;
+                /** 0 for inner nodes. */
+                uint32_t count;
+
+                bool leaf() const { return count != 0; }
+            };
+            static_assert(sizeof(node) == 32);
+
+            /** A corner and the two edges from it, as the intersection test wants them. */
+            struct triangle
+            {
+                glm::vec3 corner, edge1, edge2;
+            };
+
+            struct hit
+            {
+                float distance = std::numeric_limits<float>::infinity();
+                /** Barycentric coordinates of the second and third corner. */
+                float u = 0, v = 0;
+                /** The triangle's index in the mesh, its indices start at 'triangle * 3'. */
+                uint32_t triangle = null_triangle;
+
+                explicit operator bool() const { return triangle != null_triangle; }
+            };
+
+            std::vector<node> nodes;
+            /** In the order the leaves reference them, 'ids' maps them back to the mesh's triangles. */
+            std::vector<triangle> triangles;
+            std::vector<uint32_t> ids;
+
+            triangle_bvh() = default;
+            /** 'indices' has three per triangle, e.g. a mesh's welded 'positionIndices'. */
+            triangle_bvh(const glm::vec3 *positions, const unsigned int *indices, size_t indexCount);
+
+            aabb bounds() const;
+            size_t bytes() const;
+
+            /**
+             * Replaces 'h' with the closest triangle along 'r' that is nearer than it, returns whether there was one.
+             * Distances are in units of the ray's direction, so a ray transformed into another mesh's object space
+             * can carry its hit over to it.
+             */
+            bool intersect(const ray &r, hit &h) const;
+            /** Whether any triangle is within the ray's length, stops at the first one found. */
+            bool occluded(const ray &r) const;
+            /** Like the single ray 'intersect' for each ray, 'hits' has one per ray. */
+            void intersect(std::span<const ray> rays, std::span<hit> hits) const;
+            /** Like 'intersect', but each ray stops at the first triangle nearer than its hit, not the closest. */
+            void occluded(std::span<const ray> rays, std::span<hit> hits) const;
+
+        private:
+            /** Deeper ranges become leaves, which bounds the traversal stacks. */
+            static constexpr uint32_t maxDepth_ = 48;
+
+            template<bool any>
+            void trace_(const ray &r, hit &h) const;
+            template<bool any>
+            void trace4_(const ray *rays, size_t count, hit *hits) const;
+        };
     };
 
     namespace gfx
@@ -47,9 +537,27 @@ namespace srd::core
         {
             unsigned int id;
 
+            /** Directory linked program binaries are kept in, keyed by the sources and the driver. Disabled if empty. */
+            static inline std::string binaryCache = "";
+            static inline struct { int hits, misses; float saved; } binaryCacheStats {};
+
+            /** Only submits the sources, the program is finished by 'resolve'. */
             shader(const std::string &vertex, const std::string &fragment);
-            ~shader();
-            void use() const;
+            virtual ~shader();
+
+            /** Whether 'resolve' would not block, always true without KHR_parallel_shader_compile. */
+            bool ready() const;
+
+            /** Waits for the program, reports errors and looks up the uniforms. Called by 'use' when needed. */
+            void resolve();
+
+            /**
+             * Takes over the program of 'other', a recompiled shader of the same type, once it has linked.
+             * Objects referring to this shader see the new program. Keeps the current one if linking failed.
+             */
+            bool adopt(shader &other);
+
+            void use();
             int getUniform(const std::string &name) const;
             void setUniform(int location, int value) const;
             void setUniform(int location, bool value) const;
@@ -60,6 +568,19 @@ namespace srd::core
             void setUniform(int location, const glm::vec2 &value) const;
             void setUniform(int location, const glm::mat4 &value) const;
             void setUniform(int location, const glm::mat3 &value) const;
+
+            /** Called once the program is linked, looks up uniform locations and sets their defaults. */
+            virtual void locateUniforms() {}
+
+            unsigned int vertexShader = 0, fragmentShader = 0;
+            bool resolved = false;
+            /** Set by 'resolve' if the program linked. */
+            bool linked = false;
+            /** Linked from the binary cache, there is nothing to check. */
+            bool fromBinary = false;
+            uint64_t binaryKey = 0;
+            /** Time spent submitting and resolving, what a binary cache hit saves. */
+            float compileTime = 0;
         };
 
         namespace shaders
@@ -82,6 +603,7 @@ namespace srd::core
                 } uniforms;
 
                 geometry_shader(const std::string &vertex, const std::string &fragment);
+                void locateUniforms() override;
             };
 
             struct geometry_shader_instance
@@ -108,6 +630,7 @@ namespace srd::core
                 } uniforms;
 
                 shadow_shader(const std::string &vertex, const std::string &fragment);
+                void locateUniforms() override;
             };
 
             /** Shader which is used by the deferred renderer. */
@@ -137,6 +660,7 @@ namespace srd::core
                 } uniforms;
 
                 screen_shader(const std::string &vertex, const std::string &fragment);
+                void locateUniforms() override;
             };
 
             struct screen_shader_instance
@@ -175,6 +699,7 @@ namespace srd::core
                 } uniforms;
 
                 skybox_shader(const std::string &vertex, const std::string &fragment);
+                void locateUniforms() override;
             };
 
             /** Shader used for the sky pass. */
@@ -201,13 +726,142 @@ namespace srd::core
             bool operator==(const vertex &other) const;
         };
 
+        /** First-fit allocator of element ranges, used by 'mesh_arena'. */
+        struct free_list
+        {
+            struct range
+            {
+                unsigned int offset, count;
+            };
+
+            /** Usage and fragmentation statistics. */
+            struct stats
+            {
+                unsigned int capacity;
+                unsigned int used;
+                unsigned int largestFree;
+                unsigned int freeBlocks;
+
+                /** 0 when all of the free space is contiguous, approaches 1 the more it is split up. */
+                float fragmentation() const;
+            };
+
+            unsigned int capacity = 0;
+            std::vector<range> blocks; // Free blocks, sorted by offset.
+
+            /** Returns false if there is no free block large enough. */
+            bool allocate(unsigned int count, range &result);
+            /** Returns a range to the list, merging it with its neighbours. */
+            void free(const range &r);
+            /** Appends free space to the end. */
+            void grow(unsigned int newCapacity);
+            stats statistics() const;
+        };
+
+        /**
+         * Large vertex and index buffers that all of the meshes suballocate from,
+         * one pair with a single VAO per vertex format. Meshes are drawn with a base vertex,
+         * so switching between them does not require rebinding anything.
+         */
+        struct mesh_arena
+        {
+            using range = free_list::range;
+
+            /** Buffers of a single vertex format. */
+            struct pool
+            {
+                enum format { Full, Position };
+
+                format type;
+                unsigned int vbo, ebo, vao;
+                free_list vertices, indices;
+
+                pool(format type, unsigned int vertexCapacity, unsigned int indexCapacity);
+                ~pool();
+
+                /** Size of a single vertex of this format in bytes. */
+                size_t stride() const;
+
+                /** Reserves space for a mesh, growing the buffers if needed. */
+                void allocate(unsigned int vertexCount, unsigned int indexCount, range &vertexRange, range &indexRange);
+                void free(const range &vertexRange, const range &indexRange);
+                void upload(const range &vertexRange, const void *data);
+                void upload(const range &indexRange, const unsigned int *data);
+                void bind() const;
+
+            private:
+                void grow(unsigned int vertexCapacity, unsigned int indexCapacity);
+                void setupAttributes();
+            };
+
+            /** Interleaved 'vertex' data for the geometry pass. */
+            pool geometry;
+            /** Welded positions for the shadow pass and any other depth-only pass. */
+            pool positions;
+
+            mesh_arena(unsigned int vertexCapacity, unsigned int indexCapacity);
+        };
+
+        /** A range of a mesh's indices drawn with one material. */
+        struct submesh
+        {
+            unsigned int indexOffset, indexCount;
+            /** Index into whatever material table the mesh's user keeps, e.g. per-material textures. */
+            unsigned int material;
+            /** Object space bounds of the range. */
+            math::aabb bounds;
+        };
+
+        /** Handle to ranges of vertices and indices inside of a 'mesh_arena'. */
         struct mesh
         {
-            unsigned int vbo, ebo, vao;
+            mesh_arena &arena;
+            mesh_arena::range vertices, indices;
+            mesh_arena::range positions, positionIndices;
             unsigned int elementCount;
-            mesh(const std::vector<vertex> &vertices, const std::vector<unsigned int> &indices);
+            /** Object space bounds. */
+            math::aabb bounds;
+            /** Never empty, a mesh without a table has one submesh covering all of it. */
+            std::vector<submesh> submeshes;
+            /** Its triangles on the CPU for raycasts, only kept for meshes whose loader built one. */
+            std::shared_ptr<const math::triangle_bvh> bvh;
+            mesh(mesh_arena &arena, const std::vector<vertex> &vertices, const std::vector<unsigned int> &indices,
+                 const std::vector<submesh> &submeshes = {});
+            /**
+             * Uploads data which is already welded (see 'weld'), e.g. straight from a memory mapped file.
+             * 'positionIndices' has 'indexCount' elements.
+             */
+            mesh(mesh_arena &arena,
+                 const vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount,
+                 const glm::vec3 *positions, size_t positionCount, const unsigned int *positionIndices,
+                 const math::aabb &bounds, const std::vector<submesh> &submeshes = {});
+            mesh(const mesh&) = delete;
+            mesh &operator=(const mesh&) = delete;
             ~mesh();
+
+            /** Vertices split on UV or normal seams share a position, the depth passes only need one copy of it. */
+            static void weld(const std::vector<vertex> &vertices, const std::vector<unsigned int> &indices,
+                             std::vector<glm::vec3> &positions, std::vector<unsigned int> &positionIndices);
+            /** The same for a position stream on its own, e.g. one read from a glTF file. */
+            static void weld(const glm::vec3 *positions, size_t positionCount, const unsigned int *indices, size_t indexCount,
+                             std::vector<glm::vec3> &welded, std::vector<unsigned int> &weldedIndices);
+            /** Binds the arena's geometry VAO. */
             void bind() const;
+            /** Draws the mesh, expects the geometry VAO to be bound. */
+            void draw() const;
+            /** Draws one of the mesh's submeshes. */
+            void draw(const submesh &range) const;
+            /** Binds the arena's position-only VAO. */
+            void bindDepth() const;
+            /** Draws the welded positions, expects the position-only VAO to be bound. */
+            void drawDepth() const;
+            void drawDepth(const submesh &range) const;
+            /** Reads the mesh's data back from the arena. */
+            void read(std::vector<vertex> &vertices, std::vector<unsigned int> &indices) const;
+            /** Bytes the mesh takes up in the arena's buffers. */
+            size_t bytes() const;
+            /** Exchanges the data of two meshes from the same arena, e.g. to replace a mesh in place. */
+            void swap(mesh &other);
         };
 
         struct texture
@@ -219,9 +873,16 @@ namespace srd::core
             };
 
             unsigned int id;
+            /** Estimated video memory, mipmaps included. */
+            size_t bytes = 0;
 
             texture(const data &data, bool sRGB = true);
+            texture(const texture&) = delete;
+            texture &operator=(const texture&) = delete;
+            ~texture();
             void bind(int unit);
+            /** Exchanges the GL textures, e.g. to replace a texture in place. */
+            void swap(texture &other);
         };
 
         struct camera
@@ -229,7 +890,10 @@ namespace srd::core
             math::transform transform;
             glm::mat4 projMatrix;
             glm::mat4 viewMatrix;
+            /** The clip planes of 'projMatrix', kept for 'resize' and the draws' depth sort. */
+            float nearPlane = 0.05f, farPlane = 100.f;
 
+            camera() = default;
             camera(int width, int height, float near, float far);
             void update();
             void resize(int width, int height);
@@ -249,6 +913,8 @@ namespace srd::core
         struct cubemap
         {
             unsigned int id;
+            /** Estimated video memory of the six faces. */
+            size_t bytes = 0;
 
             cubemap(const texture::data &xPos,
                     const texture::data &xNeg,
@@ -260,6 +926,55 @@ namespace srd::core
             ~cubemap();
 
             void bind(int unit);
+            void swap(cubemap &other);
+        };
+
+        /**
+         * A hidden context sharing objects with a window, owned by a thread which runs uploads.
+         * A fence follows every upload, 'poll' hands the uploaded objects over once it has signaled.
+         */
+        struct upload_context
+        {
+            struct task
+            {
+                std::function<void()> upload;
+                std::function<void()> ready;
+                std::function<void()> cancel;
+                void *fence = nullptr;
+            };
+
+            void *win;
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable condition;
+            std::deque<task> queued, uploaded;
+            bool stopping = false;
+
+            /** Pixel unpack buffer which images are streamed through, see 'stage'. */
+            unsigned int pbo = 0;
+            size_t pboCapacity = 0;
+
+            /**
+             * Must be created on the thread which created 'shared'. Destroying it cancels the uploads
+             * which have not started yet and hands the others over once they have finished.
+             */
+            upload_context(window::window &shared);
+            ~upload_context();
+
+            /**
+             * Runs 'upload' on the upload thread, 'ready' is called by 'poll' once the GPU has finished it.
+             * 'cancel' is called instead of both if the context is destroyed first, e.g. to free the data.
+             */
+            void submit(std::function<void()> upload, std::function<void()> ready, std::function<void()> cancel = {});
+
+            /** Calls 'ready' for every finished upload, returns the number of unfinished ones. */
+            size_t poll();
+
+            /**
+             * Copies the images into the pixel unpack buffer and leaves it bound, the returned
+             * images point into it and may be passed to 'texture' or 'cubemap'. Upload thread only.
+             */
+            std::vector<texture::data> stage(const std::vector<texture::data> &images);
         };
 
         /** Shadow Framebuffer. */
@@ -308,6 +1023,54 @@ namespace srd::core
             const glm::mat4 &lightSpaceMatrix;
         };
 
+        /** A single draw of a mesh in the shadow and geometry passes. */
+        struct draw_command
+        {
+            enum : unsigned char { Shadow = 1, Geometry = 2 };
+
+            const mesh *mesh_;
+            /** Draws only this range of 'mesh_' if set. */
+            const submesh *submesh_ = nullptr;
+            texture *texture_;
+            shaders::geometry_shader *shader;
+            /** The GL names of 'texture_' and 'shader', the sort key is built from them without touching either. */
+            unsigned int textureId, shaderId;
+            glm::vec2 tiling;
+            glm::mat4 model;
+
+            /** Passes the draw is visible in, filled by 'frame_packet::prepare'. */
+            unsigned char passes;
+            /** Shader, then texture, then front to back. */
+            uint64_t key;
+        };
+
+        /**
+         * Everything needed to render the scene part of a frame. Filled by the
+         * simulation, it only references resources which do not change after loading.
+         */
+        struct frame_packet
+        {
+            camera view;
+            glm::mat4 lightSpaceMatrix;
+            math::frustum viewFrustum, lightFrustum;
+            /** Sorted by 'draw_command::key'. */
+            std::vector<draw_command> draws;
+            /** When the packet was submitted, in seconds (see 'glfwGetTime'). */
+            double timestamp;
+
+            /** Sets up the frusta from 'view' and 'lightSpaceMatrix'. */
+            void setup();
+
+            /**
+             * Culls a draw and fills in its passes and sort key, returns false if it is not visible at all.
+             * Does not touch GL or the packet, so it can be called from any thread.
+             */
+            bool prepare(draw_command &draw) const;
+
+            /** Merges per-thread buffers, each already sorted by key, into 'draws'. */
+            void merge(const std::vector<std::vector<draw_command>> &buffers);
+        };
+
         struct deferred_renderer
         {
             gbuffer buffer;
@@ -324,6 +1087,9 @@ namespace srd::core
             /** Renders data */
             void render(camera &camera, const render_data &data);
 
+            /** Renders all of the draws of a packet, the shadow pass first. */
+            void render(const frame_packet &packet, shaders::shadow_shader &shadowShader);
+
             /** Renders a skybox. */
             void sky(camera &camera, skybox &sky, shaders::skybox_shader_instance &shader);
 
@@ -350,6 +1116,21 @@ namespace std
 #include <GLFW/glfw3.h>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SRD_CORE_MMAP
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#define SRD_CORE_SSE
+#endif
 
 namespace srd::core
 {
@@ -358,65 +1139,511 @@ namespace srd::core
         std::cerr << "\033[0;31mError: " << message << "\033[0;0m" << std::endl;
     }
 
-    char const* errorToString_(GLenum const err) noexcept
+    namespace jobs
     {
-        switch (err)
+#pragma region Jobs
+        /**
+         * Chase-Lev work-stealing deque (Le et al. 2013). The owner pushes and pops
+         * at the bottom, other threads steal from the top.
+         */
+        struct deque
         {
-        // opengl 2 errors (8)
-        case GL_NO_ERROR:
-        return "GL_NO_ERROR";
+            static constexpr int64_t capacity = 4096;
 
-        case GL_INVALID_ENUM:
-        return "GL_INVALID_ENUM";
+            std::atomic<int64_t> top = 0, bottom = 0;
+            std::atomic<job*> buffer[capacity];
 
-        case GL_INVALID_VALUE:
-        return "GL_INVALID_VALUE";
+            /** Returns false when full. */
+            bool push(job *j)
+            {
+                auto b = bottom.load(std::memory_order_relaxed);
+                auto t = top.load(std::memory_order_acquire);
+                if(b - t >= capacity) return false;
+                buffer[b & (capacity - 1)].store(j, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_release);
+                return true;
+            }
 
-        case GL_INVALID_OPERATION:
-        return "GL_INVALID_OPERATION";
+            job *pop()
+            {
+                auto b = bottom.load(std::memory_order_relaxed) - 1;
+                bottom.store(b, std::memory_order_seq_cst);
+                auto t = top.load(std::memory_order_seq_cst);
 
-        case GL_STACK_OVERFLOW:
-        return "GL_STACK_OVERFLOW";
+                if(t > b)
+                {
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
 
-        case GL_STACK_UNDERFLOW:
-        return "GL_STACK_UNDERFLOW";
+                job *j = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+                if(t == b)
+                {
+                    // The last job, race the thieves for it.
+                    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        j = nullptr;
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return j;
+            }
 
-        case GL_OUT_OF_MEMORY:
-        return "GL_OUT_OF_MEMORY";
+            job *steal()
+            {
+                auto t = top.load(std::memory_order_seq_cst);
+                auto b = bottom.load(std::memory_order_seq_cst);
+                if(t >= b) return nullptr;
+
+                job *j = buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+                if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return nullptr;
+                return j;
+            }
+        };
 
-        // opengl 3 errors (1)
-        case GL_INVALID_FRAMEBUFFER_OPERATION:
-        return "GL_INVALID_FRAMEBUFFER_OPERATION";
+        struct scheduler
+        {
+            std::vector<std::unique_ptr<deque>> deques; // [0] belongs to the main thread.
+            std::vector<std::thread> workers;
+            std::atomic<bool> running = false;
+            /** Bumped whenever a job is queued, sleeping workers wait on it. */
+            std::atomic<unsigned int> epoch = 0;
+            /** Bumped whenever a job finishes, threads outside of the system wait on it instead of the job. */
+            std::atomic<unsigned int> completions = 0;
+
+            /** Jobs queued from threads which are not part of the system. */
+            std::mutex foreignMutex;
+            std::vector<job*> foreign;
+            std::atomic<size_t> foreignCount = 0;
+
+            /** Jobs which may only be executed by the main thread. */
+            std::mutex mainMutex;
+            std::vector<job*> main;
+            std::atomic<size_t> mainCount = 0;
+        };
 
-        // gles 2, 3 and gl 4 error are handled by the switch above
-        default:
-        assert(!"unknown error");
-        return nullptr;
-        }
-    }
+        scheduler scheduler_;
+        thread_local int threadIndex_ = -1;
 
-    /** Checks for OpenGL errors. */
-    void checkErrors_(const char *msg = 0)
-    {
-        auto e = glGetError();
-        if(e != GL_NO_ERROR)
+        void execute_(job *j);
+
+        void enqueue_(job *j)
         {
-            logError(std::string("OpenGL Error ") + "[" + msg + "]: " + errorToString_(e));
+            if(j->mainThread && scheduler_.running.load(std::memory_order_acquire))
+            {
+                // The main thread polls this queue while it waits, workers never take from it.
+                std::lock_guard lock(scheduler_.mainMutex);
+                scheduler_.main.push_back(j);
+                scheduler_.mainCount.fetch_add(1, std::memory_order_release);
+            }
+            else if(threadIndex_ >= 0 && scheduler_.deques[threadIndex_]->push(j))
+            {
+                scheduler_.epoch.fetch_add(1, std::memory_order_release);
+                scheduler_.epoch.notify_one();
+            }
+            else if(threadIndex_ >= 0 || !scheduler_.running.load(std::memory_order_acquire))
+            {
+                // The deque is full or there are no workers.
+                execute_(j);
+            }
+            else
+            {
+                {
+                    std::lock_guard lock(scheduler_.foreignMutex);
+                    scheduler_.foreign.push_back(j);
+                    scheduler_.foreignCount.fetch_add(1, std::memory_order_release);
+                }
+                scheduler_.epoch.fetch_add(1, std::memory_order_release);
+                scheduler_.epoch.notify_one();
+            }
         }
-    }
 
-    namespace window
-    {
-#pragma region Window
-        
+        void finish_(job *j)
+        {
+            if(j->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+            for(auto successor : j->successors)
+                if(successor->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    enqueue_(successor);
+
+            // Once 'finished' is set the job may be destroyed by whoever waits on it, so it is not touched again.
+            auto parent = j->parent;
+            j->finished.store(true, std::memory_order_release);
+            scheduler_.completions.fetch_add(1, std::memory_order_release);
+            scheduler_.completions.notify_all();
+            if(parent) finish_(parent);
+        }
 
-        void log(const char *message)
+        void execute_(job *j)
         {
-            std::cout << message << std::endl;
+            if(j->work) j->work();
+            finish_(j);
         }
 
-        
-        void window::lockCursor(bool lock)
+        job *find_(int index)
+        {
+            if(index == 0 && scheduler_.mainCount.load(std::memory_order_acquire))
+            {
+                std::lock_guard lock(scheduler_.mainMutex);
+                if(!scheduler_.main.empty())
+                {
+                    auto j = scheduler_.main.front();
+                    scheduler_.main.erase(scheduler_.main.begin());
+                    scheduler_.mainCount.fetch_sub(1, std::memory_order_relaxed);
+                    return j;
+                }
+            }
+
+            if(auto j = scheduler_.deques[index]->pop()) return j;
+
+            if(scheduler_.foreignCount.load(std::memory_order_acquire))
+            {
+                std::lock_guard lock(scheduler_.foreignMutex);
+                if(!scheduler_.foreign.empty())
+                {
+                    auto j = scheduler_.foreign.back();
+                    scheduler_.foreign.pop_back();
+                    scheduler_.foreignCount.fetch_sub(1, std::memory_order_relaxed);
+                    return j;
+                }
+            }
+
+            // Start stealing from the next thread so that victims are spread out.
+            auto count = scheduler_.deques.size();
+            for(size_t i = 1; i < count; ++i)
+                if(auto j = scheduler_.deques[(index + i) % count]->steal()) return j;
+            return nullptr;
+        }
+
+        void job::reset()
+        {
+            unfinished.store(0, std::memory_order_relaxed);
+            dependencies.store(1 + predecessors, std::memory_order_relaxed);
+            finished.store(false, std::memory_order_relaxed);
+        }
+
+        void init(unsigned int workers)
+        {
+            if(workers == 0) workers = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+            threadIndex_ = 0;
+            for(unsigned int i = 0; i <= workers; ++i)
+                scheduler_.deques.emplace_back(new deque);
+
+            scheduler_.running.store(true, std::memory_order_release);
+            for(unsigned int i = 1; i <= workers; ++i)
+            {
+                scheduler_.workers.emplace_back([i]()
+                {
+                    threadIndex_ = i;
+                    while(scheduler_.running.load(std::memory_order_acquire))
+                    {
+                        if(auto j = find_(i)) { execute_(j); continue; }
+
+                        // Check again after reading the epoch, a job queued in between bumps it.
+                        auto epoch = scheduler_.epoch.load(std::memory_order_acquire);
+                        if(auto j = find_(i)) { execute_(j); continue; }
+                        if(!scheduler_.running.load(std::memory_order_acquire)) break;
+                        scheduler_.epoch.wait(epoch, std::memory_order_acquire);
+                    }
+                });
+            }
+        }
+
+        void shutdown()
+        {
+            scheduler_.running.store(false, std::memory_order_release);
+            scheduler_.epoch.fetch_add(1, std::memory_order_release);
+            scheduler_.epoch.notify_all();
+            for(auto &w : scheduler_.workers) w.join();
+            scheduler_.workers.clear();
+
+            // Whatever is still queued runs here, so that nobody waits on it forever.
+            while(auto j = find_(0)) execute_(j);
+            scheduler_.deques.clear();
+            threadIndex_ = -1;
+        }
+
+        unsigned int threadCount()
+        {
+            return std::max<unsigned int>(scheduler_.deques.size(), 1);
+        }
+
+        int threadIndex()
+        {
+            return threadIndex_;
+        }
+
+        void depend(job &successor, job &predecessor)
+        {
+            predecessor.successors.push_back(&successor);
+            ++successor.predecessors;
+            successor.dependencies.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void run(job &j)
+        {
+            j.unfinished.store(1, std::memory_order_relaxed);
+            if(j.parent) j.parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+            if(j.dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                enqueue_(&j);
+        }
+
+        bool done(const job &j)
+        {
+            return j.finished.load(std::memory_order_acquire);
+        }
+
+        void wait(const job &j)
+        {
+            if(threadIndex_ < 0)
+            {
+                // Reading the count first, a job finishing after the check bumps it and wakes us.
+                while(true)
+                {
+                    auto completions = scheduler_.completions.load(std::memory_order_acquire);
+                    if(done(j)) return;
+                    scheduler_.completions.wait(completions, std::memory_order_acquire);
+                }
+            }
+
+            while(!done(j))
+            {
+                if(auto other = find_(threadIndex_)) execute_(other);
+                else std::this_thread::yield();
+            }
+        }
+
+        size_t graph::add(std::string name, access data, std::function<void()> work, bool mainThread)
+        {
+            nodes.push_back(node { .name = std::move(name), .data = data, .work = std::move(work), .mainThread = mainThread });
+            return nodes.size() - 1;
+        }
+
+        void graph::compile()
+        {
+            jobs.clear();
+            for(size_t i = 0; i < nodes.size(); ++i)
+            {
+                auto &j = jobs.emplace_back(new job);
+                j->parent = &root;
+                j->mainThread = nodes[i].mainThread;
+                j->work = [this, i]()
+                {
+                    auto &n = nodes[i];
+                    auto begin = std::chrono::steady_clock::now();
+                    n.work();
+                    auto end = std::chrono::steady_clock::now();
+                    n.start = std::chrono::duration<float>(begin - started).count();
+                    n.duration = std::chrono::duration<float>(end - begin).count();
+                    n.thread = threadIndex_;
+                };
+            }
+
+            // reachable[j][i]: node i always finishes before node j starts.
+            std::vector<std::vector<bool>> reachable(nodes.size(), std::vector<bool>(nodes.size()));
+            for(size_t j = 0; j < nodes.size(); ++j)
+            {
+                nodes[j].predecessors.clear();
+                // Closest nodes first, so that edges implied by others are skipped.
+                for(size_t i = j; i-- > 0;)
+                {
+                    if(reachable[j][i] || !nodes[i].data.conflicts(nodes[j].data)) continue;
+                    nodes[j].predecessors.push_back(i);
+                    depend(*jobs[j], *jobs[i]);
+                    reachable[j][i] = true;
+                    for(size_t k = 0; k < i; ++k)
+                        if(reachable[i][k]) reachable[j][k] = true;
+                }
+            }
+
+            root.work = [this]() { for(auto &j : jobs) run(*j); };
+        }
+
+        void graph::execute()
+        {
+            started = std::chrono::steady_clock::now();
+            for(auto &j : jobs) j->reset();
+            root.reset();
+            run(root);
+            wait(root);
+            duration = std::chrono::duration<float>(std::chrono::steady_clock::now() - started).count();
+        }
+
+        std::string graph::dot() const
+        {
+            std::ostringstream out;
+            out << "digraph frame {\n    rankdir=LR;\n    node [shape=box];\n";
+            for(size_t i = 0; i < nodes.size(); ++i)
+            {
+                out << "    n" << i << " [label=\"" << nodes[i].name << "\\n"
+                    << nodes[i].duration * 1000.f << " ms, thread " << nodes[i].thread << "\"";
+                if(nodes[i].mainThread) out << " style=filled fillcolor=lightblue";
+                out << "];\n";
+                for(auto p : nodes[i].predecessors)
+                    out << "    n" << p << " -> n" << i << ";\n";
+            }
+            out << "}\n";
+            return out.str();
+        }
+#pragma endregion
+    }
+
+    namespace file
+    {
+#pragma region File
+#ifdef SRD_CORE_MMAP
+        /** Advises the pages around 'length' bytes at 'address', which need not be page aligned. */
+        void advise_(const unsigned char *address, size_t length, access hint)
+        {
+            static const uintptr_t pageSize = ::sysconf(_SC_PAGESIZE);
+            auto begin = uintptr_t(address) & ~(pageSize - 1);
+            length += uintptr_t(address) - begin;
+            switch(hint)
+            {
+            case access::normal: ::madvise((void*)begin, length, MADV_NORMAL); break;
+            case access::random: ::madvise((void*)begin, length, MADV_RANDOM); break;
+            case access::sequential:
+                // Starts reading ahead right away, a cold cache is the slow case.
+                ::madvise((void*)begin, length, MADV_SEQUENTIAL);
+                ::madvise((void*)begin, length, MADV_WILLNEED);
+                break;
+            }
+        }
+#endif
+
+        mapped_file::mapped_file(const std::string &path, access hint)
+        {
+#ifdef SRD_CORE_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) return;
+            struct stat info;
+            if(::fstat(fd, &info) != 0)
+            {
+                ::close(fd);
+                return;
+            }
+            if(info.st_size > 0 && size_t(info.st_size) < smallFile)
+            {
+                buffer_.resize(info.st_size);
+                size_t done = 0;
+                while(done < buffer_.size())
+                {
+                    ssize_t n = ::read(fd, buffer_.data() + done, buffer_.size() - done);
+                    if(n <= 0) break;
+                    done += n;
+                }
+                if(done == buffer_.size())
+                {
+                    data = buffer_.data();
+                    size = done;
+                }
+            }
+            else if(info.st_size > 0)
+            {
+                void *mapped = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapped != MAP_FAILED)
+                {
+                    data = (const unsigned char*)mapped;
+                    size = info.st_size;
+                    mapped_ = true;
+                    if(hint != access::normal) advise_(data, size, hint);
+                }
+            }
+            ::close(fd);
+#else
+            std::ifstream ifs(path, std::ios::binary);
+            buffer_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+            if(!buffer_.empty())
+            {
+                data = buffer_.data();
+                size = buffer_.size();
+            }
+#endif
+        }
+
+        mapped_file::~mapped_file()
+        {
+#ifdef SRD_CORE_MMAP
+            if(mapped_) ::munmap((void*)data, size);
+#endif
+        }
+
+        mapped_file &mapped_file::operator=(mapped_file &&other) noexcept
+        {
+            std::swap(data, other.data);
+            std::swap(size, other.size);
+            std::swap(mapped_, other.mapped_);
+            buffer_.swap(other.buffer_);
+            return *this;
+        }
+
+        void mapped_file::advise(size_t offset, size_t length, access hint) const
+        {
+#ifdef SRD_CORE_MMAP
+            if(mapped_ && offset < size) advise_(data + offset, std::min(length, size - offset), hint);
+#endif
+        }
+#pragma endregion
+    }
+
+    char const* errorToString_(GLenum const err) noexcept
+    {
+        switch (err)
+        {
+        // opengl 2 errors (8)
+        case GL_NO_ERROR:
+        return "GL_NO_ERROR";
+
+        case GL_INVALID_ENUM:
+        return "GL_INVALID_ENUM";
+
+        case GL_INVALID_VALUE:
+        return "GL_INVALID_VALUE";
+
+        case GL_INVALID_OPERATION:
+        return "GL_INVALID_OPERATION";
+
+        case GL_STACK_OVERFLOW:
+        return "GL_STACK_OVERFLOW";
+
+        case GL_STACK_UNDERFLOW:
+        return "GL_STACK_UNDERFLOW";
+
+        case GL_OUT_OF_MEMORY:
+        return "GL_OUT_OF_MEMORY";
+
+        // opengl 3 errors (1)
+        case GL_INVALID_FRAMEBUFFER_OPERATION:
+        return "GL_INVALID_FRAMEBUFFER_OPERATION";
+
+        // gles 2, 3 and gl 4 error are handled by the switch above
+        default:
+        assert(!"unknown error");
+        return nullptr;
+        }
+    }
+
+    /** Checks for OpenGL errors. */
+    void checkErrors_(const char *msg = 0)
+    {
+        auto e = glGetError();
+        if(e != GL_NO_ERROR)
+        {
+            logError(std::string("OpenGL Error ") + "[" + msg + "]: " + errorToString_(e));
+        }
+    }
+
+    namespace window
+    {
+#pragma region Window
+        
+
+        void log(const char *message)
+        {
+            std::cout << message << std::endl;
+        }
+
+        
+        void window::lockCursor(bool lock)
         {
             if(isCursorLocked == lock) return;
             isCursorLocked = lock;
@@ -481,99 +1708,904 @@ namespace srd::core
             auto translate = glm::translate(glm::mat4(1.f), position);
             matrix = translate * rotate * scale;
         }
-    };
 
-    namespace gfx
-    {
-        bool vertex::operator==(const vertex &other) const
+        void aabb::extend(const glm::vec3 &point)
         {
-            return position == other.position
-                && normal   == other.normal
-                && texcoord == other.texcoord;
+            min = glm::min(min, point);
+            max = glm::max(max, point);
         }
-#pragma region Shader
-        shader::shader(const std::string &vertexSource, const std::string &fragmentSource)
+
+        void aabb::extend(const aabb &box)
         {
-            // std::cout << "shader ctor" << std::endl;
-            // std::cout << "-------------  vertex shader  -------------" << std::endl;
-            // std::cout << vertexSource << std::endl;
-            // std::cout << "------------- fragment shader -------------" << std::endl;
-            // std::cout << fragmentSource << std::endl;
-            // std::cout << "-------------       end       -------------" << std::endl;
+            min = glm::min(min, box.min);
+            max = glm::max(max, box.max);
+        }
 
-            auto checkShader = [](unsigned int shader, int type)
-            {
-                int  success;
-                char infoLog[512];
+        glm::vec3 aabb::center() const
+        {
+            return (min + max) * 0.5f;
+        }
 
-                if(type < 2) glGetShaderiv (shader, GL_COMPILE_STATUS, &success);
-                else         glGetProgramiv(shader,    GL_LINK_STATUS, &success);
+        bool aabb::contains(const aabb &box) const
+        {
+            return glm::all(glm::lessThanEqual(min, box.min)) && glm::all(glm::lessThanEqual(box.max, max));
+        }
 
-                if(!success)
-                {
-                    if(type < 2) glGetShaderInfoLog(shader, 512, NULL, infoLog);
-                    else         glGetProgramInfoLog(shader, 512, NULL, infoLog);
-                    std::cerr << "\033[0;31m" << (type==0?"Vertex Shader":type==1?"Fragment Shader":"Program")
-                        << " Compilation Failed!\033[0;0m\n" << infoLog << std::endl;
-                }
-            };
+        bool aabb::intersects(const aabb &box) const
+        {
+            return glm::all(glm::lessThanEqual(min, box.max)) && glm::all(glm::lessThanEqual(box.min, max));
+        }
 
-            auto vertexSourceC = vertexSource.c_str();
-            auto fragmentSourceC = fragmentSource.c_str();
+        float aabb::area() const
+        {
+            auto size = max - min;
+            return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
 
-            auto vertexShader = glCreateShader(GL_VERTEX_SHADER);
-            glShaderSource(vertexShader, 1, &vertexSourceC, NULL);
-            glCompileShader(vertexShader);
-            checkShader(vertexShader, 0);
+        aabb aabb::transformed(const glm::mat4 &matrix) const
+        {
+            if(min.x > max.x) return {};
+            auto center = glm::vec3(matrix * glm::vec4(this->center(), 1.f));
+            auto extents = glm::mat3(
+                glm::abs(glm::vec3(matrix[0])),
+                glm::abs(glm::vec3(matrix[1])),
+                glm::abs(glm::vec3(matrix[2]))) * ((max - min) * 0.5f);
+            return { .min = center - extents, .max = center + extents };
+        }
 
-            auto fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-            glShaderSource(fragmentShader, 1, &fragmentSourceC, NULL);
-            glCompileShader(fragmentShader);
-            checkShader(fragmentShader, 1);
+        frustum::frustum(const glm::mat4 &m)
+        {
+            // Gribb & Hartmann, the planes point inwards.
+            auto row = [&](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+            planes[0] = row(3) + row(0);
+            planes[1] = row(3) - row(0);
+            planes[2] = row(3) + row(1);
+            planes[3] = row(3) - row(1);
+            planes[4] = row(3) + row(2);
+            planes[5] = row(3) - row(2);
+        }
 
-            id = glCreateProgram();
-            glAttachShader(id, vertexShader);
-            glAttachShader(id, fragmentShader);
-            glLinkProgram(id);
-            checkShader(id, 2);
+        bool frustum::intersects(const aabb &box) const
+        {
+            for(const auto &plane : planes)
+            {
+                // The corner furthest along the plane's normal.
+                glm::vec3 corner {
+                    plane.x > 0 ? box.max.x : box.min.x,
+                    plane.y > 0 ? box.max.y : box.min.y,
+                    plane.z > 0 ? box.max.z : box.min.z,
+                };
+                if(glm::dot(glm::vec3(plane), corner) + plane.w < 0) return false;
+            }
+            return true;
+        }
 
-            glDeleteShader(vertexShader);
-            glDeleteShader(fragmentShader);
+        bool sphere::intersects(const aabb &box) const
+        {
+            auto closest = glm::clamp(center, box.min, box.max);
+            auto offset = closest - center;
+            return glm::dot(offset, offset) <= radius * radius;
+        }
 
-            checkErrors_(__PRETTY_FUNCTION__);
+        float ray::intersects(const aabb &box) const
+        {
+            // Slabs, a zero direction gives infinities which compare as they should unless the origin is on a face.
+            auto inverse = 1.f / direction;
+            auto t0 = (box.min - origin) * inverse, t1 = (box.max - origin) * inverse;
+            auto near = glm::min(t0, t1), far = glm::max(t0, t1);
+            float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.f));
+            float exit = std::min(std::min(far.x, far.y), std::min(far.z, length));
+            return enter <= exit ? enter : std::numeric_limits<float>::infinity();
         }
 
-        namespace shaders
+#pragma region AABB Tree
+        uint32_t aabb_tree::allocate_()
         {
-            geometry_shader::geometry_shader(const std::string &vertexSource, const std::string &fragmentSource)
-                : shader::shader(vertexSource, fragmentSource)
+            if(freeList == null_node)
             {
-                uniforms.transform           = getUniform("uTransform");
-                uniforms.normalMatrix        = getUniform("uNormalMatrix");
-                uniforms.texture0            = getUniform("uTexture");
-                uniforms.materialData.tiling = getUniform("uMaterialData.tiling");
-                uniforms.transformLightSpace = getUniform("uTransformLightSpace");
-                setUniform(uniforms.materialData.tiling, glm::vec2(1, 1));
-                setUniform(uniforms.texture0, 0);
+                nodes.emplace_back();
+                freeList = nodes.size() - 1;
             }
+            auto index = freeList;
+            freeList = nodes[index].parent;
+            nodes[index] = node { .height = 0 };
+            return index;
+        }
 
-            shadow_shader::shadow_shader(const std::string &vertexSource, const std::string &fragmentSource)
-                : shader::shader(vertexSource, fragmentSource)
+        void aabb_tree::free_(uint32_t index)
+        {
+            nodes[index].parent = freeList;
+            nodes[index].height = -1;
+            freeList = index;
+        }
+
+        uint32_t aabb_tree::insert(const aabb &box, uint32_t data)
+        {
+            auto leaf = allocate_();
+            nodes[leaf].box = { .min = box.min - margin, .max = box.max + margin };
+            nodes[leaf].data = data;
+            insertLeaf_(leaf);
+            leafCount++;
+            return leaf;
+        }
+
+        void aabb_tree::remove(uint32_t leaf)
+        {
+            removeLeaf_(leaf);
+            free_(leaf);
+            leafCount--;
+        }
+
+        bool aabb_tree::move(uint32_t leaf, const aabb &box, const glm::vec3 &displacement)
+        {
+            aabb fat { .min = box.min - margin, .max = box.max + margin };
+            auto &current = nodes[leaf].box;
+            // Also reinserted once the fattened box is far too large, e.g. after a fast object stopped.
+            if(current.contains(box) && current.area() < 4.f * fat.area() + 1e-6f) return false;
+
+            auto ahead = displacement * predict;
+            fat.min += glm::min(ahead, glm::vec3(0.f));
+            fat.max += glm::max(ahead, glm::vec3(0.f));
+            removeLeaf_(leaf);
+            nodes[leaf].box = fat;
+            insertLeaf_(leaf);
+            return true;
+        }
+
+        void aabb_tree::clear()
+        {
+            nodes.clear();
+            root = freeList = null_node;
+            leafCount = 0;
+        }
+
+        void aabb_tree::insertLeaf_(uint32_t leaf)
+        {
+            if(root == null_node)
             {
-                uniforms.transformLightSpace = getUniform("uTransformLightSpace");
+                root = leaf;
+                nodes[root].parent = null_node;
+                return;
             }
 
-            void geometry_shader_instance::use() const
+            // Descends while making the leaf a sibling further down costs less than here.
+            auto box = nodes[leaf].box;
+            uint32_t index = root;
+            while(!nodes[index].leaf())
             {
-                type.use();
-                type.setUniform(type.uniforms.materialData.tiling, uniforms.materialData.tiling);
+                const auto &n = nodes[index];
+                aabb combined = n.box;
+                combined.extend(box);
+                float cost = 2.f * combined.area();
+                // Every ancestor grows by as much.
+                float inheritance = 2.f * (combined.area() - n.box.area());
+                auto childCost = [&](uint32_t child)
+                {
+                    aabb grown = nodes[child].box;
+                    grown.extend(box);
+                    return grown.area() + inheritance - (nodes[child].leaf() ? 0.f : nodes[child].box.area());
+                };
+                float left = childCost(n.left), right = childCost(n.right);
+                if(cost < left && cost < right) break;
+                index = left < right ? n.left : n.right;
             }
 
-            screen_shader::screen_shader(const std::string &vertexSource, const std::string &fragmentSource)
-                : shader::shader(vertexSource, fragmentSource)
+            auto sibling = index;
+            auto oldParent = nodes[sibling].parent;
+            auto parent = allocate_();
+            nodes[parent].parent = oldParent;
+            nodes[parent].box = nodes[sibling].box;
+            nodes[parent].box.extend(box);
+            nodes[parent].height = nodes[sibling].height + 1;
+            nodes[parent].left = sibling;
+            nodes[parent].right = leaf;
+            nodes[sibling].parent = parent;
+            nodes[leaf].parent = parent;
+            if(oldParent == null_node) root = parent;
+            else if(nodes[oldParent].left == sibling) nodes[oldParent].left = parent;
+            else nodes[oldParent].right = parent;
+
+            for(index = nodes[leaf].parent; index != null_node; index = nodes[index].parent)
             {
-                uniforms.lighting.ambient     = getUniform("uLighting.ambient");
-                uniforms.lighting.directional = getUniform("uLighting.directional");
+                index = balance_(index);
+                auto &n = nodes[index];
+                n.height = 1 + std::max(nodes[n.left].height, nodes[n.right].height);
+                n.box = nodes[n.left].box;
+                n.box.extend(nodes[n.right].box);
+            }
+        }
+
+        void aabb_tree::removeLeaf_(uint32_t leaf)
+        {
+            if(leaf == root)
+            {
+                root = null_node;
+                return;
+            }
+
+            auto parent = nodes[leaf].parent;
+            auto grandParent = nodes[parent].parent;
+            auto sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+            free_(parent);
+            nodes[sibling].parent = grandParent;
+            if(grandParent == null_node)
+            {
+                root = sibling;
+                return;
+            }
+            if(nodes[grandParent].left == parent) nodes[grandParent].left = sibling;
+            else nodes[grandParent].right = sibling;
+
+            for(auto index = grandParent; index != null_node; index = nodes[index].parent)
+            {
+                index = balance_(index);
+                auto &n = nodes[index];
+                n.height = 1 + std::max(nodes[n.left].height, nodes[n.right].height);
+                n.box = nodes[n.left].box;
+                n.box.extend(nodes[n.right].box);
+            }
+        }
+
+        /** Rotates the taller child of 'a' up if the children's heights differ by more than one, returns the subtree's root. */
+        uint32_t aabb_tree::balance_(uint32_t a)
+        {
+            auto &A = nodes[a];
+            if(A.leaf() || A.height < 2) return a;
+
+            auto b = A.left, c = A.right;
+            int balance = nodes[c].height - nodes[b].height;
+            if(balance >= -1 && balance <= 1) return a;
+
+            // 'up' replaces 'a', which keeps its other child and takes the shorter child of 'up'.
+            auto up = balance > 1 ? c : b, other = balance > 1 ? b : c;
+            auto &U = nodes[up];
+            auto f = U.left, g = U.right;
+            U.left = a;
+            U.parent = A.parent;
+            A.parent = up;
+            if(U.parent == null_node) root = up;
+            else if(nodes[U.parent].left == a) nodes[U.parent].left = up;
+            else nodes[U.parent].right = up;
+
+            auto taller = nodes[f].height > nodes[g].height ? f : g, shorter = taller == f ? g : f;
+            U.right = taller;
+            if(balance > 1) A.right = shorter;
+            else A.left = shorter;
+            nodes[shorter].parent = a;
+
+            A.box = nodes[other].box;
+            A.box.extend(nodes[shorter].box);
+            A.height = 1 + std::max(nodes[other].height, nodes[shorter].height);
+            U.box = A.box;
+            U.box.extend(nodes[taller].box);
+            U.height = 1 + std::max(A.height, nodes[taller].height);
+            return up;
+        }
+#pragma endregion
+
+#pragma region Triangle BVH
+        triangle_bvh::triangle_bvh(const glm::vec3 *positions, const unsigned int *indices, size_t indexCount)
+        {
+            // Costs are in triangle tests, a node visit costs about as much as one.
+            constexpr uint32_t bins = 16, maxLeaf = 8;
+            constexpr float traversalCost = 1.f;
+            // Subtrees with more triangles than this are split off as jobs.
+            constexpr uint32_t parallelThreshold = 4096;
+
+            uint32_t count = indexCount / 3;
+            if(count == 0) return;
+
+            std::vector<aabb> boxes(count);
+            std::vector<glm::vec3> centroids(count);
+            ids.resize(count);
+            jobs::parallel_for(0, count, [&](size_t first, size_t last)
+            {
+                for(size_t i = first; i < last; ++i)
+                {
+                    aabb box;
+                    for(size_t c = 0; c < 3; ++c) box.extend(positions[indices[i * 3 + c]]);
+                    boxes[i] = box;
+                    centroids[i] = box.center();
+                    ids[i] = i;
+                }
+            }, 1024);
+
+            // A binary tree with one triangle per leaf has the most nodes, siblings are allocated in pairs.
+            nodes.resize(2 * count - 1);
+            std::atomic<uint32_t> used = 1;
+
+            std::function<void(uint32_t, uint32_t, uint32_t, uint32_t)> build =
+                [&](uint32_t index, uint32_t begin, uint32_t end, uint32_t depth)
+            {
+                aabb box, centers;
+                for(uint32_t i = begin; i < end; ++i)
+                {
+                    box.extend(boxes[ids[i]]);
+                    centers.extend(centroids[ids[i]]);
+                }
+                auto &n = nodes[index];
+                n.min = box.min;
+                n.max = box.max;
+                n.first = begin;
+                n.count = end - begin;
+                if(n.count == 1 || depth >= maxDepth_) return;
+
+                auto extent = centers.max - centers.min;
+                auto bin = [&](uint32_t t, int axis)
+                {
+                    auto b = (uint32_t)((centroids[t][axis] - centers.min[axis]) * (bins / extent[axis]));
+                    return std::min(b, bins - 1);
+                };
+
+                // Sweeps the bins from both sides, the cost of a split is the area of each half times its triangles.
+                int bestAxis = -1;
+                uint32_t bestSplit = 0;
+                float bestCost = std::numeric_limits<float>::max();
+                for(int axis = 0; axis < 3; ++axis)
+                {
+                    if(extent[axis] <= 0.f) continue;
+                    aabb binBoxes[bins];
+                    uint32_t binCounts[bins] = {};
+                    for(uint32_t i = begin; i < end; ++i)
+                    {
+                        auto b = bin(ids[i], axis);
+                        binCounts[b]++;
+                        binBoxes[b].extend(boxes[ids[i]]);
+                    }
+
+                    float rightCost[bins] = {};
+                    aabb side;
+                    uint32_t sideCount = 0;
+                    for(uint32_t b = bins - 1; b > 0; --b)
+                    {
+                        side.extend(binBoxes[b]);
+                        sideCount += binCounts[b];
+                        rightCost[b] = sideCount ? side.area() * sideCount : 0.f;
+                    }
+                    side = {};
+                    sideCount = 0;
+                    for(uint32_t b = 1; b < bins; ++b)
+                    {
+                        side.extend(binBoxes[b - 1]);
+                        sideCount += binCounts[b - 1];
+                        if(!sideCount || sideCount == n.count) continue;
+                        float cost = side.area() * sideCount + rightCost[b];
+                        if(cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestAxis = axis;
+                            bestSplit = b;
+                        }
+                    }
+                }
+
+                uint32_t middle;
+                float splitCost = traversalCost + bestCost / std::max(box.area(), std::numeric_limits<float>::min());
+                if(bestAxis >= 0 && (splitCost < n.count || n.count > maxLeaf))
+                {
+                    auto split = std::partition(ids.begin() + begin, ids.begin() + end,
+                        [&](uint32_t t) { return bin(t, bestAxis) < bestSplit; });
+                    middle = split - ids.begin();
+                }
+                // Every centroid is in the same spot, any split is as good as another.
+                else if(n.count > maxLeaf) middle = begin + n.count / 2;
+                else return;
+
+                uint32_t left = used.fetch_add(2, std::memory_order_relaxed);
+                n.first = left;
+                n.count = 0;
+                if(end - begin > parallelThreshold)
+                {
+                    jobs::job child([&build, left, begin, middle, depth]() { build(left, begin, middle, depth + 1); });
+                    jobs::run(child);
+                    build(left + 1, middle, end, depth + 1);
+                    jobs::wait(child);
+                }
+                else
+                {
+                    build(left, begin, middle, depth + 1);
+                    build(left + 1, middle, end, depth + 1);
+                }
+            };
+            build(0, 0, count, 0);
+            nodes.resize(used.load());
+            nodes.shrink_to_fit();
+
+            triangles.resize(count);
+            jobs::parallel_for(0, count, [&](size_t first, size_t last)
+            {
+                for(size_t i = first; i < last; ++i)
+                {
+                    auto *corners = indices + ids[i] * 3;
+                    auto &a = positions[corners[0]], &b = positions[corners[1]], &c = positions[corners[2]];
+                    triangles[i] = { a, b - a, c - a };
+                }
+            }, 1024);
+        }
+
+        aabb triangle_bvh::bounds() const
+        {
+            if(nodes.empty()) return {};
+            return { nodes[0].min, nodes[0].max };
+        }
+
+        size_t triangle_bvh::bytes() const
+        {
+            return nodes.size() * sizeof(node) + triangles.size() * sizeof(triangle) + ids.size() * sizeof(uint32_t);
+        }
+
+        bool triangle_bvh::intersect(const ray &r, hit &h) const
+        {
+            auto before = h.triangle;
+            trace_<false>(r, h);
+            return h.triangle != before;
+        }
+
+        bool triangle_bvh::occluded(const ray &r) const
+        {
+            hit h;
+            trace_<true>(r, h);
+            return (bool)h;
+        }
+
+        void triangle_bvh::intersect(std::span<const ray> rays, std::span<hit> hits) const
+        {
+            for(size_t i = 0; i < rays.size(); i += 4)
+                trace4_<false>(rays.data() + i, std::min<size_t>(4, rays.size() - i), hits.data() + i);
+        }
+
+        void triangle_bvh::occluded(std::span<const ray> rays, std::span<hit> hits) const
+        {
+            for(size_t i = 0; i < rays.size(); i += 4)
+                trace4_<true>(rays.data() + i, std::min<size_t>(4, rays.size() - i), hits.data() + i);
+        }
+
+        /** Huge instead of infinite for zero components, so that a slab test never multiplies 0 by infinity. */
+        static glm::vec3 inverseDirection_(const glm::vec3 &direction)
+        {
+            glm::vec3 inverse;
+            for(int i = 0; i < 3; ++i)
+                inverse[i] = std::abs(direction[i]) > 1e-30f ? 1.f / direction[i] : std::copysign(1e30f, direction[i]);
+            return inverse;
+        }
+
+        template<bool any>
+        void triangle_bvh::trace_(const ray &r, hit &h) const
+        {
+            if(nodes.empty()) return;
+            auto inverse = inverseDirection_(r.direction);
+            float limit = std::min(r.length, h.distance);
+            auto enter = [&](const node &n)
+            {
+                auto t0 = (n.min - r.origin) * inverse, t1 = (n.max - r.origin) * inverse;
+                auto near = glm::min(t0, t1), far = glm::max(t0, t1);
+                float in = std::max(std::max(near.x, near.y), std::max(near.z, 0.f));
+                float out = std::min(std::min(far.x, far.y), std::min(far.z, limit));
+                return in <= out ? in : std::numeric_limits<float>::infinity();
+            };
+
+            struct entry { uint32_t node; float enter; };
+            entry stack[maxDepth_ + 1];
+            int top = 0;
+            stack[top++] = { 0, enter(nodes[0]) };
+            while(top > 0)
+            {
+                auto [index, distance] = stack[--top];
+                if(distance > limit) continue;
+                const auto &n = nodes[index];
+                if(!n.leaf())
+                {
+                    entry near { n.first, enter(nodes[n.first]) }, far { n.first + 1, enter(nodes[n.first + 1]) };
+                    if(far.enter < near.enter) std::swap(near, far);
+                    if(far.enter <= limit) stack[top++] = far;
+                    if(near.enter <= limit) stack[top++] = near;
+                    continue;
+                }
+
+                // Möller-Trumbore, NaNs from degenerate triangles fail every comparison.
+                for(uint32_t i = n.first; i < n.first + n.count; ++i)
+                {
+                    const auto &tri = triangles[i];
+                    auto p = glm::cross(r.direction, tri.edge2);
+                    float inverseDet = 1.f / glm::dot(tri.edge1, p);
+                    auto s = r.origin - tri.corner;
+                    float u = glm::dot(s, p) * inverseDet;
+                    if(!(u >= 0.f && u <= 1.f)) continue;
+                    auto q = glm::cross(s, tri.edge1);
+                    float v = glm::dot(r.direction, q) * inverseDet;
+                    if(!(v >= 0.f && u + v <= 1.f)) continue;
+                    float t = glm::dot(tri.edge2, q) * inverseDet;
+                    if(!(t >= 0.f && t < limit)) continue;
+
+                    h = { t, u, v, ids[i] };
+                    if constexpr(any) return;
+                    limit = t;
+                }
+            }
+        }
+
+        template<bool any>
+        void triangle_bvh::trace4_(const ray *rays, size_t count, hit *hits) const
+        {
+#ifdef SRD_CORE_SSE
+            if(nodes.empty()) return;
+
+            // Structure of arrays, one ray per lane. Lanes past 'count' and finished any-hit rays have a negative limit.
+            alignas(16) float values[10][4];
+            for(size_t lane = 0; lane < 4; ++lane)
+            {
+                const auto &r = rays[std::min(lane, count - 1)];
+                auto inverse = inverseDirection_(r.direction);
+                for(int axis = 0; axis < 3; ++axis)
+                {
+                    values[axis][lane] = r.origin[axis];
+                    values[3 + axis][lane] = r.direction[axis];
+                    values[6 + axis][lane] = inverse[axis];
+                }
+                values[9][lane] = lane < count ? std::min(r.length, hits[lane].distance) : -1.f;
+            }
+            __m128 origin[3], direction[3], inverse[3];
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                origin[axis] = _mm_load_ps(values[axis]);
+                direction[axis] = _mm_load_ps(values[3 + axis]);
+                inverse[axis] = _mm_load_ps(values[6 + axis]);
+            }
+            __m128 limit = _mm_load_ps(values[9]), distance = limit, u = _mm_setzero_ps(), v = _mm_setzero_ps();
+            __m128i triangle = _mm_set1_epi32(-1);
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+
+            auto horizontal = [](__m128 x, auto &&op)
+            {
+                x = op(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtss_f32(op(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2))));
+            };
+            auto minimum = [](__m128 a, __m128 b) { return _mm_min_ps(a, b); };
+            auto maximum = [](__m128 a, __m128 b) { return _mm_max_ps(a, b); };
+            float farthest = horizontal(limit, maximum);
+
+            // The nearest distance at which any of the rays enters 'n', infinity if none does.
+            auto enter = [&](const node &n)
+            {
+                __m128 near = zero, far = limit;
+                for(int axis = 0; axis < 3; ++axis)
+                {
+                    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[axis]), origin[axis]), inverse[axis]);
+                    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[axis]), origin[axis]), inverse[axis]);
+                    near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+                    far = _mm_min_ps(far, _mm_max_ps(t0, t1));
+                }
+                __m128 inside = _mm_cmple_ps(near, far);
+                return horizontal(_mm_or_ps(_mm_and_ps(inside, near), _mm_andnot_ps(inside, infinity)), minimum);
+            };
+
+            struct entry { uint32_t node; float enter; };
+            entry stack[maxDepth_ + 1];
+            int top = 0;
+            stack[top++] = { 0, enter(nodes[0]) };
+            while(top > 0)
+            {
+                auto [index, nearest] = stack[--top];
+                if(nearest > farthest) continue;
+                const auto &n = nodes[index];
+                if(!n.leaf())
+                {
+                    entry near { n.first, enter(nodes[n.first]) }, far { n.first + 1, enter(nodes[n.first + 1]) };
+                    if(far.enter < near.enter) std::swap(near, far);
+                    if(far.enter <= farthest) stack[top++] = far;
+                    if(near.enter <= farthest) stack[top++] = near;
+                    continue;
+                }
+
+                for(uint32_t i = n.first; i < n.first + n.count; ++i)
+                {
+                    const auto &tri = triangles[i];
+                    __m128 e1[3], e2[3], s[3], p[3], q[3];
+                    for(int axis = 0; axis < 3; ++axis)
+                    {
+                        e1[axis] = _mm_set1_ps(tri.edge1[axis]);
+                        e2[axis] = _mm_set1_ps(tri.edge2[axis]);
+                        s[axis] = _mm_sub_ps(origin[axis], _mm_set1_ps(tri.corner[axis]));
+                    }
+                    auto cross = [](const __m128 *a, const __m128 *b, __m128 *out)
+                    {
+                        out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+                        out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+                        out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+                    };
+                    auto dot = [](const __m128 *a, const __m128 *b)
+                    {
+                        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+                    };
+                    cross(direction, e2, p);
+                    cross(s, e1, q);
+                    __m128 inverseDet = _mm_div_ps(one, dot(e1, p));
+                    __m128 hitU = _mm_mul_ps(dot(s, p), inverseDet);
+                    __m128 hitV = _mm_mul_ps(dot(direction, q), inverseDet);
+                    __m128 t = _mm_mul_ps(dot(e2, q), inverseDet);
+                    __m128 mask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(hitU, zero), _mm_cmpge_ps(hitV, zero)),
+                                             _mm_cmple_ps(_mm_add_ps(hitU, hitV), one));
+                    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, limit)));
+                    if(!_mm_movemask_ps(mask)) continue;
+
+                    auto select = [mask](__m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); };
+                    distance = select(t, distance);
+                    u = select(hitU, u);
+                    v = select(hitV, v);
+                    triangle = _mm_castps_si128(select(_mm_castsi128_ps(_mm_set1_epi32((int)ids[i])), _mm_castsi128_ps(triangle)));
+                    limit = select(any ? _mm_set1_ps(-1.f) : t, limit);
+                    farthest = horizontal(limit, maximum);
+                }
+                if(any && farthest < 0.f) break;
+            }
+
+            alignas(16) float hitDistance[4], hitU[4], hitV[4];
+            alignas(16) uint32_t hitTriangle[4];
+            _mm_store_ps(hitDistance, distance);
+            _mm_store_ps(hitU, u);
+            _mm_store_ps(hitV, v);
+            _mm_store_si128((__m128i*)hitTriangle, triangle);
+            for(size_t lane = 0; lane < count; ++lane)
+                if(hitTriangle[lane] != null_triangle) hits[lane] = { hitDistance[lane], hitU[lane], hitV[lane], hitTriangle[lane] };
+#else
+            for(size_t i = 0; i < count; ++i) trace_<any>(rays[i], hits[i]);
+#endif
+        }
+#pragma endregion
+    };
+
+    namespace gfx
+    {
+        bool vertex::operator==(const vertex &other) const
+        {
+            return position == other.position
+                && normal   == other.normal
+                && texcoord == other.texcoord
+                && tangent  == other.tangent;
+        }
+#pragma region Shader
+        /** Key of a program in the binary cache, binaries only work with the driver that produced them. */
+        uint64_t programKey_(const std::string &vertexSource, const std::string &fragmentSource)
+        {
+            // FNV-1a
+            uint64_t hash = 14695981039346656037ull;
+            auto add = [&](const char *data)
+            {
+                for(; data && *data; ++data) hash = (hash ^ (unsigned char)*data) * 1099511628211ull;
+                hash = (hash ^ 0xff) * 1099511628211ull; // Separator, so that moving text between parts changes the key.
+            };
+            add(vertexSource.c_str());
+            add(fragmentSource.c_str());
+            add((const char*)glGetString(GL_VENDOR));
+            add((const char*)glGetString(GL_RENDERER));
+            add((const char*)glGetString(GL_VERSION));
+            return hash;
+        }
+
+        struct program_binary_header_
+        {
+            uint32_t magic;
+            uint32_t format;
+            uint64_t key;
+            /** How long compiling took, to report the time saved by a hit. */
+            float compileTime;
+        };
+
+        constexpr uint32_t programBinaryMagic_ = 0x50445253; // "SRDP"
+
+        std::string programPath_(uint64_t key)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+            return shader::binaryCache + "/" + name;
+        }
+
+        /** Links 'program' from the cached binary, returns false if there is none or the driver rejects it. */
+        bool loadProgramBinary_(unsigned int program, uint64_t key, float &compileTime)
+        {
+            std::ifstream file(programPath_(key), std::ios::binary);
+            if(!file) return false;
+
+            program_binary_header_ header;
+            if(!file.read((char*)&header, sizeof(header)) || header.magic != programBinaryMagic_ || header.key != key)
+                return false;
+            std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            glProgramBinary(program, header.format, binary.data(), binary.size());
+            int success = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            // A failed glProgramBinary may leave an error behind, it is not an error for us.
+            while(glGetError() != GL_NO_ERROR);
+            compileTime = header.compileTime;
+            return success;
+        }
+
+        void saveProgramBinary_(unsigned int program, uint64_t key, float compileTime)
+        {
+            int length = 0;
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if(length <= 0) return;
+
+            std::vector<char> binary(length);
+            GLenum format;
+            glGetProgramBinary(program, length, &length, &format, binary.data());
+
+            std::error_code error;
+            std::filesystem::create_directories(shader::binaryCache, error);
+            std::ofstream file(programPath_(key), std::ios::binary);
+            if(!file)
+            {
+                logError("Could not write a program binary to '" + programPath_(key) + "'");
+                return;
+            }
+            program_binary_header_ header { .magic = programBinaryMagic_, .format = format, .key = key, .compileTime = compileTime };
+            file.write((const char*)&header, sizeof(header));
+            file.write(binary.data(), length);
+        }
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+        /** Whether the driver compiles in the background, KHR_parallel_shader_compile is not part of glad's profile. */
+        bool parallelShaderCompile_()
+        {
+            static int supported = -1;
+            if(supported < 0)
+            {
+                using max_threads_t = void (*)(unsigned int);
+                auto maxThreads = (max_threads_t)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+                supported = glfwExtensionSupported("GL_KHR_parallel_shader_compile") && maxThreads;
+                // Lets the driver pick the number of compiler threads.
+                if(supported) maxThreads(0xFFFFFFFF);
+                std::cout << "Parallel shader compilation: " << (supported ? "on" : "off") << std::endl;
+            }
+            return supported;
+        }
+
+        shader::shader(const std::string &vertexSource, const std::string &fragmentSource)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            auto elapsed = [&]() { return std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count(); };
+            parallelShaderCompile_();
+
+            int binaryFormats = 0;
+            if(!binaryCache.empty()) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+            binaryKey = binaryFormats ? programKey_(vertexSource, fragmentSource) : 0;
+
+            if(binaryFormats)
+            {
+                float cachedTime;
+                id = glCreateProgram();
+                if(loadProgramBinary_(id, binaryKey, cachedTime))
+                {
+                    float time = elapsed();
+                    ++binaryCacheStats.hits;
+                    binaryCacheStats.saved += cachedTime - time;
+                    std::cout << "Program binary cache hit: loaded in " << time * 1000.f << "ms, saved "
+                        << (cachedTime - time) * 1000.f << "ms" << std::endl;
+                    fromBinary = true;
+                    checkErrors_(__PRETTY_FUNCTION__);
+                    return;
+                }
+                glDeleteProgram(id);
+            }
+
+            // Nothing here queries a status, so that the driver may keep compiling in the background.
+            auto vertexSourceC = vertexSource.c_str();
+            auto fragmentSourceC = fragmentSource.c_str();
+
+            vertexShader = glCreateShader(GL_VERTEX_SHADER);
+            glShaderSource(vertexShader, 1, &vertexSourceC, NULL);
+            glCompileShader(vertexShader);
+
+            fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(fragmentShader, 1, &fragmentSourceC, NULL);
+            glCompileShader(fragmentShader);
+
+            id = glCreateProgram();
+            glAttachShader(id, vertexShader);
+            glAttachShader(id, fragmentShader);
+            if(binaryFormats) glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            glLinkProgram(id);
+
+            compileTime = elapsed();
+            checkErrors_(__PRETTY_FUNCTION__);
+        }
+
+        bool shader::ready() const
+        {
+            if(resolved || fromBinary || !parallelShaderCompile_()) return true;
+            int complete = 0;
+            glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &complete);
+            return complete;
+        }
+
+        void shader::resolve()
+        {
+            if(resolved) return;
+            resolved = true;
+            auto begin = std::chrono::steady_clock::now();
+
+            if(!fromBinary)
+            {
+                auto checkShader = [](unsigned int shader, int type)
+                {
+                    int  success;
+                    char infoLog[512];
+
+                    if(type < 2) glGetShaderiv (shader, GL_COMPILE_STATUS, &success);
+                    else         glGetProgramiv(shader,    GL_LINK_STATUS, &success);
+
+                    if(!success)
+                    {
+                        if(type < 2) glGetShaderInfoLog(shader, 512, NULL, infoLog);
+                        else         glGetProgramInfoLog(shader, 512, NULL, infoLog);
+                        std::cerr << "\033[0;31m" << (type==0?"Vertex Shader":type==1?"Fragment Shader":"Program")
+                            << " Compilation Failed!\033[0;0m\n" << infoLog << std::endl;
+                    }
+                    return success;
+                };
+
+                checkShader(vertexShader, 0);
+                checkShader(fragmentShader, 1);
+                linked = checkShader(id, 2);
+
+                glDeleteShader(vertexShader);
+                glDeleteShader(fragmentShader);
+                vertexShader = fragmentShader = 0;
+
+                compileTime += std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count();
+                if(binaryKey)
+                {
+                    ++binaryCacheStats.misses;
+                    std::cout << "Program binary cache miss: compiled in " << compileTime * 1000.f << "ms" << std::endl;
+                    if(linked) saveProgramBinary_(id, binaryKey, compileTime);
+                }
+            }
+            else linked = true;
+
+            locateUniforms();
+            checkErrors_(__PRETTY_FUNCTION__);
+        }
+
+        namespace shaders
+        {
+            geometry_shader::geometry_shader(const std::string &vertexSource, const std::string &fragmentSource)
+                : shader::shader(vertexSource, fragmentSource) {}
+
+            void geometry_shader::locateUniforms()
+            {
+                uniforms.transform           = getUniform("uTransform");
+                uniforms.normalMatrix        = getUniform("uNormalMatrix");
+                uniforms.texture0            = getUniform("uTexture");
+                uniforms.materialData.tiling = getUniform("uMaterialData.tiling");
+                uniforms.transformLightSpace = getUniform("uTransformLightSpace");
+                setUniform(uniforms.materialData.tiling, glm::vec2(1, 1));
+                setUniform(uniforms.texture0, 0);
+            }
+
+            shadow_shader::shadow_shader(const std::string &vertexSource, const std::string &fragmentSource)
+                : shader::shader(vertexSource, fragmentSource) {}
+
+            void shadow_shader::locateUniforms()
+            {
+                uniforms.transformLightSpace = getUniform("uTransformLightSpace");
+            }
+
+            void geometry_shader_instance::use() const
+            {
+                type.use();
+                type.setUniform(type.uniforms.materialData.tiling, uniforms.materialData.tiling);
+            }
+
+            screen_shader::screen_shader(const std::string &vertexSource, const std::string &fragmentSource)
+                : shader::shader(vertexSource, fragmentSource) {}
+
+            void screen_shader::locateUniforms()
+            {
+                uniforms.lighting.ambient     = getUniform("uLighting.ambient");
+                uniforms.lighting.directional = getUniform("uLighting.directional");
                 uniforms.lighting.directionalTint = getUniform("uLighting.directionalTint");
 
                 uniforms.texturePosition           = getUniform("gPosition");
@@ -590,169 +2622,494 @@ namespace srd::core
                 setUniform(uniforms.textureShadowDepth       , 4);
                 setUniform(uniforms.texturePositionLightSpace, 5);
 
-                uniforms.debug.showShadowMap = getUniform("uDebug_ShowShadowMap");
-                setUniform(uniforms.debug.showShadowMap, 0);
-            }
+                uniforms.debug.showShadowMap = getUniform("uDebug_ShowShadowMap");
+                setUniform(uniforms.debug.showShadowMap, 0);
+            }
+
+            void screen_shader_instance::use() const
+            {
+                type.use();
+                type.setUniform(type.uniforms.lighting.ambient, uniforms.lighting.ambient);
+                type.setUniform(type.uniforms.lighting.directional, uniforms.lighting.directional);
+                type.setUniform(type.uniforms.lighting.directionalTint, uniforms.lighting.directionalTint);
+                type.setUniform(type.uniforms.debug.showShadowMap, uniforms.debug.showShadowMap);
+            }
+
+            skybox_shader::skybox_shader(const std::string &vertexSource, const std::string &fragmentSource)
+                : shader::shader(vertexSource, fragmentSource) {}
+
+            void skybox_shader::locateUniforms()
+            {
+                uniforms.texture0 = getUniform("uTexture0");
+                uniforms.texture1 = getUniform("uTexture1");
+                uniforms.transform = getUniform("uTransform");
+                uniforms.tint       = getUniform("uTint");
+                uniforms.transition = getUniform("uTransition");
+
+                setUniform(uniforms.texture0, 0);
+                setUniform(uniforms.texture1, 0);
+            }
+
+            void skybox_shader_instance::use() const
+            {
+                type.use();
+                type.setUniform(type.uniforms.tint      , uniforms.tint);
+                type.setUniform(type.uniforms.transition, uniforms.transition);
+            }
+        }
+
+        bool shader::adopt(shader &other)
+        {
+            other.resolve();
+            if(!other.linked) return false;
+            std::swap(id, other.id);
+            resolved = linked = true;
+            fromBinary = other.fromBinary;
+            binaryKey = other.binaryKey;
+            compileTime = other.compileTime;
+            // Uniform locations belong to the program.
+            locateUniforms();
+            checkErrors_(__PRETTY_FUNCTION__);
+            return true;
+        }
+
+        void shader::use()
+        {
+            if(!resolved) resolve();
+            glUseProgram(id);
+        }
+
+        shader::~shader()
+        {
+            glDeleteProgram(id);
+        }
+
+        int shader::getUniform(const std::string &name) const
+        {
+            auto x = glGetUniformLocation(id, name.c_str());
+            if(x < 0) { std::cerr << "\033[0;31mNo uniform called " << name << " exists\033[0;0m" << std::endl; }
+            return x;
+        }
+        void shader::setUniform(int location, int value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniform1i(location, value);
+        }
+        void shader::setUniform(int location, bool value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniform1i(location, value ? 1 : 0);
+        }
+        void shader::setUniform(int location, float value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id); 
+            glUniform1f(location, value);
+        }
+        void shader::setUniform(int location, const glm::vec4 &value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniform4f(location, value.x, value.y, value.z, value.w);
+        }
+        void shader::setUniform(int location, const glm::quat &value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniform4f(location, value.x, value.y, value.z, value.w);
+        }
+        void shader::setUniform(int location, const glm::vec3 &value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniform3f(location, value.x, value.y, value.z);
+        }
+        void shader::setUniform(int location, const glm::vec2 &value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniform2f(location, value.x, value.y);
+        }
+        void shader::setUniform(int location, const glm::mat4 &value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+        void shader::setUniform(int location, const glm::mat3 &value) const
+        {
+            if(location < 0) return;
+            glUseProgram(id);
+            glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+
+        
+
+#pragma endregion
+#pragma region Mesh
+        float free_list::stats::fragmentation() const
+        {
+            auto freeCount = capacity - used;
+            if(freeCount == 0) return 0;
+            return 1.f - float(largestFree) / float(freeCount);
+        }
+
+        bool free_list::allocate(unsigned int count, range &result)
+        {
+            for(auto it = blocks.begin(); it != blocks.end(); ++it)
+            {
+                if(it->count < count) continue;
+                result = { it->offset, count };
+                it->offset += count;
+                it->count  -= count;
+                if(it->count == 0) blocks.erase(it);
+                return true;
+            }
+            return false;
+        }
+
+        void free_list::free(const range &r)
+        {
+            if(r.count == 0) return;
+            auto it = std::lower_bound(blocks.begin(), blocks.end(), r,
+                [](const range &a, const range &b) { return a.offset < b.offset; });
+            it = blocks.insert(it, r);
+
+            // Merge with the next block.
+            if(it + 1 != blocks.end() && it->offset + it->count == (it + 1)->offset)
+            {
+                it->count += (it + 1)->count;
+                blocks.erase(it + 1);
+            }
+
+            // Merge with the previous block.
+            if(it != blocks.begin() && (it - 1)->offset + (it - 1)->count == it->offset)
+            {
+                (it - 1)->count += it->count;
+                blocks.erase(it);
+            }
+        }
+
+        void free_list::grow(unsigned int newCapacity)
+        {
+            if(newCapacity <= capacity) return;
+            auto oldCapacity = capacity;
+            capacity = newCapacity;
+            free({ oldCapacity, newCapacity - oldCapacity });
+        }
+
+        free_list::stats free_list::statistics() const
+        {
+            stats s { .capacity = capacity, .used = capacity, .largestFree = 0,
+                      .freeBlocks = (unsigned int)blocks.size() };
+            for(const auto &b : blocks)
+            {
+                s.used -= b.count;
+                s.largestFree = std::max(s.largestFree, b.count);
+            }
+            return s;
+        }
+
+        mesh_arena::pool::pool(format type, unsigned int vertexCapacity, unsigned int indexCapacity)
+            : type(type)
+        {
+            glGenBuffers(1, &vbo);
+            glGenBuffers(1, &ebo);
+            glGenVertexArrays(1, &vao);
+
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferData(GL_ARRAY_BUFFER, vertexCapacity * stride(), NULL, GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+            vertices.grow(vertexCapacity);
+            indices.grow(indexCapacity);
+            setupAttributes();
+            checkErrors_(__PRETTY_FUNCTION__);
+        }
+
+        mesh_arena::pool::~pool()
+        {
+            glDeleteBuffers(1, &vbo);
+            glDeleteBuffers(1, &ebo);
+            glDeleteVertexArrays(1, &vao);
+        }
+
+        size_t mesh_arena::pool::stride() const
+        {
+            return type == Full ? sizeof(vertex) : sizeof(glm::vec3);
+        }
+
+        void mesh_arena::pool::setupAttributes()
+        {
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride(), (void*)0);
+
+            if(type == Full)
+            {
+                glEnableVertexAttribArray(1);
+                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)((3)     * sizeof(float)));
+
+                glEnableVertexAttribArray(2);
+                glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)((3+3)   * sizeof(float)));
+
+                glEnableVertexAttribArray(3);
+                glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)((3+3+2) * sizeof(float)));
+            }
+
+            glBindVertexArray(0);
+        }
+
+        void mesh_arena::pool::grow(unsigned int vertexCapacity, unsigned int indexCapacity)
+        {
+            std::cout << "Growing mesh arena " << (type == Full ? "(full)" : "(positions)") << " to "
+                      << vertexCapacity << " vertices, " << indexCapacity << " indices" << std::endl;
 
-            void screen_shader_instance::use() const
+            // Copies the contents of a buffer into a larger one, the ranges stay valid.
+            auto regrow = [](unsigned int &buffer, size_t oldSize, size_t newSize)
             {
-                type.use();
-                type.setUniform(type.uniforms.lighting.ambient, uniforms.lighting.ambient);
-                type.setUniform(type.uniforms.lighting.directional, uniforms.lighting.directional);
-                type.setUniform(type.uniforms.lighting.directionalTint, uniforms.lighting.directionalTint);
-                type.setUniform(type.uniforms.debug.showShadowMap, uniforms.debug.showShadowMap);
-            }
+                unsigned int newBuffer;
+                glGenBuffers(1, &newBuffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+                glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+                glDeleteBuffers(1, &buffer);
+                buffer = newBuffer;
+            };
 
-            skybox_shader::skybox_shader(const std::string &vertexSource, const std::string &fragmentSource)
-                : shader::shader(vertexSource, fragmentSource)
+            if(vertexCapacity > vertices.capacity)
             {
-                uniforms.texture0 = getUniform("uTexture0");
-                uniforms.texture1 = getUniform("uTexture1");
-                uniforms.transform = getUniform("uTransform");
-                uniforms.tint       = getUniform("uTint");
-                uniforms.transition = getUniform("uTransition");
-
-                setUniform(uniforms.texture0, 0);
-                setUniform(uniforms.texture1, 0);
+                regrow(vbo, vertices.capacity * stride(), vertexCapacity * stride());
+                vertices.grow(vertexCapacity);
             }
 
-            void skybox_shader_instance::use() const
+            if(indexCapacity > indices.capacity)
             {
-                type.use();
-                type.setUniform(type.uniforms.tint      , uniforms.tint);
-                type.setUniform(type.uniforms.transition, uniforms.transition);
+                regrow(ebo, indices.capacity * sizeof(unsigned int), indexCapacity * sizeof(unsigned int));
+                indices.grow(indexCapacity);
             }
+
+            setupAttributes();
+            checkErrors_(__PRETTY_FUNCTION__);
         }
 
-        void shader::use() const
+        void mesh_arena::pool::allocate(unsigned int vertexCount, unsigned int indexCount, range &vertexRange, range &indexRange)
         {
-            glUseProgram(id);
+            while(!vertices.allocate(vertexCount, vertexRange))
+                grow(std::max(vertices.capacity * 2, vertices.capacity + vertexCount), indices.capacity);
+
+            while(!indices.allocate(indexCount, indexRange))
+                grow(vertices.capacity, std::max(indices.capacity * 2, indices.capacity + indexCount));
         }
 
-        shader::~shader()
+        void mesh_arena::pool::free(const range &vertexRange, const range &indexRange)
         {
-            glDeleteProgram(id);
+            vertices.free(vertexRange);
+            indices.free(indexRange);
         }
 
-        int shader::getUniform(const std::string &name) const
+        void mesh_arena::pool::upload(const range &vertexRange, const void *data)
         {
-            auto x = glGetUniformLocation(id, name.c_str());
-            if(x < 0) { std::cerr << "\033[0;31mNo uniform called " << name << " exists\033[0;0m" << std::endl; }
-            return x;
+            if(vertexRange.count == 0) return;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferSubData(GL_ARRAY_BUFFER,
+                vertexRange.offset * stride(),
+                vertexRange.count  * stride(),
+                data
+            );
         }
-        void shader::setUniform(int location, int value) const
+
+        void mesh_arena::pool::upload(const range &indexRange, const unsigned int *data)
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniform1i(location, value);
+            if(indexRange.count == 0) return;
+            // Binding the EBO outside of a VAO would change the bound VAO's state.
+            glBindVertexArray(0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                indexRange.offset * sizeof(unsigned int),
+                indexRange.count  * sizeof(unsigned int),
+                data
+            );
         }
-        void shader::setUniform(int location, bool value) const
+
+        void mesh_arena::pool::bind() const
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniform1i(location, value ? 1 : 0);
+            glBindVertexArray(vao);
+            checkErrors_(__PRETTY_FUNCTION__);
         }
-        void shader::setUniform(int location, float value) const
+
+        mesh_arena::mesh_arena(unsigned int vertexCapacity, unsigned int indexCapacity)
+            : geometry(pool::Full, vertexCapacity, indexCapacity),
+              positions(pool::Position, vertexCapacity, indexCapacity) {}
+
+        mesh::mesh(mesh_arena &arena, const std::vector<vertex> &vertices, const std::vector<unsigned int> &indices,
+                   const std::vector<submesh> &submeshes)
+            : arena(arena), submeshes(submeshes)
         {
-            if(location < 0) return;
-            glUseProgram(id); 
-            glUniform1f(location, value);
+            std::cout << "Mesh Ctor" << std::endl;
+            arena.geometry.allocate(vertices.size(), indices.size(), this->vertices, this->indices);
+            arena.geometry.upload(this->vertices, vertices.data());
+            arena.geometry.upload(this->indices, indices.data());
+            elementCount = indices.size();
+            for(const auto &v : vertices) bounds.extend(v.position);
+
+            std::vector<glm::vec3> welded;
+            std::vector<unsigned int> weldedIndices;
+            weld(vertices, indices, welded, weldedIndices);
+
+            arena.positions.allocate(welded.size(), weldedIndices.size(), positions, positionIndices);
+            arena.positions.upload(positions, welded.data());
+            arena.positions.upload(positionIndices, weldedIndices.data());
+
+            if(this->submeshes.empty()) this->submeshes.push_back({ 0, elementCount, 0, bounds });
+            checkErrors_(__PRETTY_FUNCTION__);
         }
-        void shader::setUniform(int location, const glm::vec4 &value) const
+
+        mesh::mesh(mesh_arena &arena,
+                   const vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount,
+                   const glm::vec3 *positions, size_t positionCount, const unsigned int *positionIndices,
+                   const math::aabb &bounds, const std::vector<submesh> &submeshes)
+            : arena(arena), elementCount(indexCount), bounds(bounds), submeshes(submeshes)
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniform4f(location, value.x, value.y, value.z, value.w);
+            if(this->submeshes.empty()) this->submeshes.push_back({ 0, elementCount, 0, bounds });
+            arena.geometry.allocate(vertexCount, indexCount, this->vertices, this->indices);
+            arena.geometry.upload(this->vertices, (const void*)vertices);
+            arena.geometry.upload(this->indices, indices);
+
+            arena.positions.allocate(positionCount, indexCount, this->positions, this->positionIndices);
+            arena.positions.upload(this->positions, (const void*)positions);
+            arena.positions.upload(this->positionIndices, positionIndices);
+
+            checkErrors_(__PRETTY_FUNCTION__);
         }
-        void shader::setUniform(int location, const glm::quat &value) const
+
+        void mesh::weld(const std::vector<vertex> &vertices, const std::vector<unsigned int> &indices,
+                        std::vector<glm::vec3> &positions, std::vector<unsigned int> &positionIndices)
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniform4f(location, value.x, value.y, value.z, value.w);
+            positions.clear();
+            std::vector<unsigned int> remap(vertices.size());
+            std::unordered_map<glm::vec3, unsigned int> positionMap;
+            for(size_t i = 0; i < vertices.size(); ++i)
+            {
+                auto [it, inserted] = positionMap.try_emplace(vertices[i].position, (unsigned int)positions.size());
+                if(inserted) positions.push_back(vertices[i].position);
+                remap[i] = it->second;
+            }
+
+            positionIndices.resize(indices.size());
+            for(size_t i = 0; i < indices.size(); ++i)
+                positionIndices[i] = remap[indices[i]];
         }
-        void shader::setUniform(int location, const glm::vec3 &value) const
+
+        void mesh::weld(const glm::vec3 *positions, size_t positionCount, const unsigned int *indices, size_t indexCount,
+                        std::vector<glm::vec3> &welded, std::vector<unsigned int> &weldedIndices)
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniform3f(location, value.x, value.y, value.z);
+            welded.clear();
+            std::vector<unsigned int> remap(positionCount);
+            std::unordered_map<glm::vec3, unsigned int> positionMap;
+            for(size_t i = 0; i < positionCount; ++i)
+            {
+                auto [it, inserted] = positionMap.try_emplace(positions[i], (unsigned int)welded.size());
+                if(inserted) welded.push_back(positions[i]);
+                remap[i] = it->second;
+            }
+
+            weldedIndices.resize(indexCount);
+            for(size_t i = 0; i < indexCount; ++i)
+                weldedIndices[i] = remap[indices[i]];
         }
-        void shader::setUniform(int location, const glm::vec2 &value) const
+
+        void mesh::bind() const
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniform2f(location, value.x, value.y);
+            arena.geometry.bind();
         }
-        void shader::setUniform(int location, const glm::mat4 &value) const
+
+        void mesh::draw() const
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+            glDrawElementsBaseVertex(GL_TRIANGLES, elementCount, GL_UNSIGNED_INT,
+                (void*)(indices.offset * sizeof(unsigned int)), vertices.offset);
         }
-        void shader::setUniform(int location, const glm::mat3 &value) const
+
+        void mesh::draw(const submesh &range) const
         {
-            if(location < 0) return;
-            glUseProgram(id);
-            glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+                (void*)((indices.offset + range.indexOffset) * sizeof(unsigned int)), vertices.offset);
         }
 
-        
-
-#pragma endregion
-#pragma region Mesh
-        mesh::mesh(const std::vector<vertex> &vertices, const std::vector<unsigned int> &indices)
+        void mesh::bindDepth() const
         {
-            std::cout << "Mesh Ctor" << std::endl;
-            elementCount = 0;
-            glGenBuffers(1, &vbo);
-            glGenBuffers(1, &ebo);
+            arena.positions.bind();
+        }
 
-            glGenVertexArrays(1, &vao);
-            glBindVertexArray(vao);
+        void mesh::drawDepth() const
+        {
+            glDrawElementsBaseVertex(GL_TRIANGLES, elementCount, GL_UNSIGNED_INT,
+                (void*)(positionIndices.offset * sizeof(unsigned int)), positions.offset);
+        }
 
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER,
-                vertices.size() * sizeof(vertex),
-                &vertices[0],
-                GL_STATIC_DRAW
-            );
+        /** Position indices follow the same order as the indices, so submeshes apply to both. */
+        void mesh::drawDepth(const submesh &range) const
+        {
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+                (void*)((positionIndices.offset + range.indexOffset) * sizeof(unsigned int)), positions.offset);
+        }
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                indices.size() * sizeof(unsigned int),
-                &indices[0],
-                GL_STATIC_DRAW
+        void mesh::read(std::vector<vertex> &vertices, std::vector<unsigned int> &indices) const
+        {
+            vertices.resize(this->vertices.count);
+            indices.resize(this->indices.count);
+
+            glBindBuffer(GL_ARRAY_BUFFER, arena.geometry.vbo);
+            glGetBufferSubData(GL_ARRAY_BUFFER,
+                this->vertices.offset * sizeof(vertex),
+                this->vertices.count  * sizeof(vertex),
+                vertices.data()
             );
 
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
-
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)((3)     * sizeof(float)));
-
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)((3+3)   * sizeof(float)));
-
-            glEnableVertexAttribArray(3);
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)((3+3+2) * sizeof(float)));
-
             glBindVertexArray(0);
-
-            elementCount = indices.size();
-
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.geometry.ebo);
+            glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                this->indices.offset * sizeof(unsigned int),
+                this->indices.count  * sizeof(unsigned int),
+                indices.data()
+            );
             checkErrors_(__PRETTY_FUNCTION__);
         }
 
-        void mesh::bind() const
+        size_t mesh::bytes() const
         {
-            glBindVertexArray(vao);
-            checkErrors_(__PRETTY_FUNCTION__);
+            return vertices.count * arena.geometry.stride() + positions.count * arena.positions.stride()
+                 + (indices.count + positionIndices.count) * sizeof(unsigned int);
+        }
+
+        void mesh::swap(mesh &other)
+        {
+            if(&arena != &other.arena)
+            {
+                logError("Cannot swap meshes from different arenas");
+                return;
+            }
+            std::swap(vertices, other.vertices);
+            std::swap(indices, other.indices);
+            std::swap(positions, other.positions);
+            std::swap(positionIndices, other.positionIndices);
+            std::swap(elementCount, other.elementCount);
+            std::swap(bounds, other.bounds);
+            std::swap(submeshes, other.submeshes);
+            std::swap(bvh, other.bvh);
         }
 
         mesh::~mesh()
         {
-            glDeleteBuffers(1, &vbo);
-            glDeleteBuffers(1, &ebo);
-            glDeleteVertexArrays(1, &vao);
+            arena.geometry.free(vertices, indices);
+            arena.positions.free(positions, positionIndices);
         }
 #pragma endregion
 #pragma region Texture
@@ -767,20 +3124,36 @@ namespace srd::core
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             
-            if(data.data)
+            // With a pixel unpack buffer bound (see 'upload_context::stage') the data is an offset into it.
+            int unpackBuffer = 0;
+            glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackBuffer);
+            if(data.data || unpackBuffer)
             {
                 glTexImage2D(GL_TEXTURE_2D, 0, sRGB?GL_SRGB:GL_RGB, data.width, data.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data);
                 glGenerateMipmap(GL_TEXTURE_2D);
+                // Drivers pad RGB to four bytes, the mip chain adds a third.
+                bytes = size_t(data.width) * data.height * 4 * 4 / 3;
             }
             checkErrors_(__PRETTY_FUNCTION__);
         }
 
+        texture::~texture()
+        {
+            glDeleteTextures(1, &id);
+        }
+
         void texture::bind(int unit)
         {
             glActiveTexture(GL_TEXTURE0 + unit);
             glBindTexture(GL_TEXTURE_2D, id);
         }
 
+        void texture::swap(texture &other)
+        {
+            std::swap(id, other.id);
+            std::swap(bytes, other.bytes);
+        }
+
         cubemap::cubemap(const texture::data &xPos,
                          const texture::data &xNeg,
                          const texture::data &yPos,
@@ -805,17 +3178,21 @@ namespace srd::core
                 &xPos, &xNeg, &yPos, &yNeg, &zPos, &zNeg
             };
 
+            int unpackBuffer = 0;
+            glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackBuffer);
+
             glGenTextures(1, &id);
             glBindTexture(GL_TEXTURE_CUBE_MAP, id);
 
             for(int i = 0; i < 6; ++i)
             {
-                if(!datas[i]->data) {
+                if(!datas[i]->data && !unpackBuffer) {
                     logError(std::string("Bad texture for a cubemap's ") + "XXYYZZ"[i] + "+-+-+-"[i] + " (=null)");
                 }
                 //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, data.width, data.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data);
                 glTexImage2D(types[i], 0, GL_SRGB, datas[i]->width, datas[i]->height, 0, GL_RGBA,
                     GL_UNSIGNED_BYTE, datas[i]->data);
+                bytes += size_t(datas[i]->width) * datas[i]->height * 4;
 
                 glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
                 glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -838,9 +3215,144 @@ namespace srd::core
         {
             glDeleteTextures(1, &id);
         }
+
+        void cubemap::swap(cubemap &other)
+        {
+            std::swap(id, other.id);
+            std::swap(bytes, other.bytes);
+        }
+
+        upload_context::upload_context(window::window &shared)
+        {
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            win = glfwCreateWindow(1, 1, "Upload", nullptr, (GLFWwindow*)shared.win);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+            if(!win)
+            {
+                logError("Failed to create the upload context");
+                return;
+            }
+
+            thread = std::thread([this]()
+            {
+                glfwMakeContextCurrent((GLFWwindow*)win);
+                glGenBuffers(1, &pbo);
+
+                while(true)
+                {
+                    task t;
+                    {
+                        std::unique_lock lock(mutex);
+                        condition.wait(lock, [this]() { return stopping || !queued.empty(); });
+                        if(queued.empty()) break;
+                        t = std::move(queued.front());
+                        queued.pop_front();
+                    }
+
+                    t.upload();
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                    t.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    // Without a flush the fence might never reach the GPU.
+                    glFlush();
+                    checkErrors_(__PRETTY_FUNCTION__);
+
+                    std::lock_guard lock(mutex);
+                    uploaded.push_back(std::move(t));
+                }
+
+                glDeleteBuffers(1, &pbo);
+                glfwMakeContextCurrent(nullptr);
+            });
+        }
+
+        upload_context::~upload_context()
+        {
+            std::deque<task> cancelled;
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+                cancelled.swap(queued);
+            }
+            condition.notify_one();
+            for(auto &t : cancelled)
+                if(t.cancel) t.cancel();
+            if(thread.joinable()) thread.join();
+
+            // Their objects already exist, dropping them would leak them.
+            for(auto &t : uploaded)
+            {
+                while(glClientWaitSync((GLsync)t.fence, 0, 100000000) == GL_TIMEOUT_EXPIRED);
+                glDeleteSync((GLsync)t.fence);
+                t.ready();
+            }
+            if(win) glfwDestroyWindow((GLFWwindow*)win);
+        }
+
+        void upload_context::submit(std::function<void()> upload, std::function<void()> ready, std::function<void()> cancel)
+        {
+            {
+                std::lock_guard lock(mutex);
+                queued.push_back(task { .upload = std::move(upload), .ready = std::move(ready), .cancel = std::move(cancel) });
+            }
+            condition.notify_one();
+        }
+
+        size_t upload_context::poll()
+        {
+            std::vector<task> finished;
+            size_t unfinished;
+            {
+                std::lock_guard lock(mutex);
+                // Fences signal in order, so the first unsignaled one ends the search.
+                while(!uploaded.empty())
+                {
+                    auto status = glClientWaitSync((GLsync)uploaded.front().fence, 0, 0);
+                    if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+                    finished.push_back(std::move(uploaded.front()));
+                    uploaded.pop_front();
+                }
+                unfinished = queued.size() + uploaded.size();
+            }
+
+            for(auto &t : finished)
+            {
+                glDeleteSync((GLsync)t.fence);
+                t.ready();
+            }
+            return unfinished;
+        }
+
+        std::vector<texture::data> upload_context::stage(const std::vector<texture::data> &images)
+        {
+            size_t size = 0;
+            for(const auto &image : images) size += size_t(image.width) * image.height * 4;
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            // Orphans the previous storage, the driver may still be reading from it.
+            pboCapacity = std::max(pboCapacity, size);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, pboCapacity, nullptr, GL_STREAM_DRAW);
+            auto mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+            std::vector<texture::data> staged;
+            size_t offset = 0;
+            for(const auto &image : images)
+            {
+                size_t bytes = size_t(image.width) * image.height * 4;
+                if(mapped && image.data) std::copy_n(image.data, bytes, mapped + offset);
+                staged.push_back(texture::data {
+                    .width = image.width, .height = image.height, .channels = image.channels,
+                    .data = (unsigned char*)offset
+                });
+                offset += bytes;
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            return staged;
+        }
 #pragma endregion
 #pragma region Camera
         camera::camera(int width, int height, float near, float far)
+            : nearPlane(near), farPlane(far)
         {
             // projMatrix = glm::mat4(1.f);
             projMatrix = glm::perspective(glm::pi<float>() * 0.25f, (float)width / (float)height, near, far);
@@ -848,7 +3360,7 @@ namespace srd::core
 
         void camera::resize(int width, int height)
         {
-            projMatrix = glm::perspective(glm::pi<float>() * 0.25f, (float)width / (float)height, 0.05f, 100.f);
+            projMatrix = glm::perspective(glm::pi<float>() * 0.25f, (float)width / (float)height, nearPlane, farPlane);
         }
 
         void camera::update()
@@ -891,7 +3403,7 @@ namespace srd::core
             shader.use();
             texture.bind(0);
             shader.type.setUniform(shader.type.uniforms.transform, camera.projection(transform.matrix));
-            glDrawElements(GL_TRIANGLES, mesh.elementCount, GL_UNSIGNED_INT, 0);
+            mesh.draw();
         }
 
         sbuffer::sbuffer(int width, int height)
@@ -1025,13 +3537,13 @@ namespace srd::core
             glDisable(GL_CULL_FACE);
             glViewport(0, 0, shadowBuffer.width, shadowBuffer.height);
             glBindFramebuffer(GL_FRAMEBUFFER, shadowBuffer.fbo);
-            data.mesh_.bind();
+            data.mesh_.bindDepth();
             data.shadowShader.use();
             data.shadowShader.setUniform(
                 data.shadowShader.uniforms.transformLightSpace,
                 data.lightSpaceMatrix * data.transform.matrix
             );
-            glDrawElements(GL_TRIANGLES, data.mesh_.elementCount, GL_UNSIGNED_INT, 0);
+            data.mesh_.drawDepth();
             glEnable(GL_CULL_FACE);
 
             glCullFace(GL_BACK);
@@ -1044,7 +3556,98 @@ namespace srd::core
             data.shader.type.setUniform(data.shader.type.uniforms.transformLightSpace, data.lightSpaceMatrix * data.transform.matrix);
             data.shader.type.setUniform(data.shader.type.uniforms.normalMatrix, normalMatrix);
             data.shader.type.setUniform(data.shader.type.uniforms.transform, camera.projection(data.transform.matrix));
-            glDrawElements(GL_TRIANGLES, data.mesh_.elementCount, GL_UNSIGNED_INT, 0);
+            data.mesh_.draw();
+        }
+
+        void frame_packet::setup()
+        {
+            viewFrustum  = math::frustum(view.projMatrix * view.viewMatrix);
+            lightFrustum = math::frustum(lightSpaceMatrix);
+        }
+
+        bool frame_packet::prepare(draw_command &draw) const
+        {
+            auto bounds = (draw.submesh_ ? draw.submesh_->bounds : draw.mesh_->bounds).transformed(draw.model);
+            draw.passes = 0;
+            if(lightFrustum.intersects(bounds)) draw.passes |= draw_command::Shadow;
+            if(viewFrustum .intersects(bounds)) draw.passes |= draw_command::Geometry;
+            if(!draw.passes) return false;
+
+            // 24 bits of depth up to the far plane.
+            float depth = glm::clamp(glm::distance(view.transform.position, bounds.center()) / view.farPlane, 0.f, 1.f);
+            draw.key = (uint64_t(draw.shaderId  & 0xFFFF)   << 48)
+                     | (uint64_t(draw.textureId & 0xFFFFFF) << 24)
+                     |  uint64_t(depth * 0xFFFFFF);
+            return true;
+        }
+
+        void frame_packet::merge(const std::vector<std::vector<draw_command>> &buffers)
+        {
+            draws.clear();
+            size_t total = 0;
+            for(const auto &b : buffers) total += b.size();
+            draws.reserve(total);
+
+            std::vector<size_t> heads(buffers.size(), 0);
+            for(;;)
+            {
+                // There are only as many buffers as threads, a linear scan is enough.
+                int best = -1;
+                for(size_t i = 0; i < buffers.size(); ++i)
+                {
+                    if(heads[i] == buffers[i].size()) continue;
+                    if(best < 0 || buffers[i][heads[i]].key < buffers[best][heads[best]].key) best = i;
+                }
+                if(best < 0) break;
+                draws.push_back(buffers[best][heads[best]++]);
+            }
+        }
+
+        void deferred_renderer::render(const frame_packet &packet, shaders::shadow_shader &shadowShader)
+        {
+            const mesh_arena *boundArena = nullptr;
+            const shaders::geometry_shader *boundShader = nullptr;
+            const texture *boundTexture = nullptr;
+
+            glDisable(GL_CULL_FACE);
+            glViewport(0, 0, shadowBuffer.width, shadowBuffer.height);
+            glBindFramebuffer(GL_FRAMEBUFFER, shadowBuffer.fbo);
+            shadowShader.use();
+            for(const auto &draw : packet.draws)
+            {
+                if(!(draw.passes & draw_command::Shadow)) continue;
+                if(boundArena != &draw.mesh_->arena) draw.mesh_->bindDepth();
+                boundArena = &draw.mesh_->arena;
+                shadowShader.setUniform(shadowShader.uniforms.transformLightSpace, packet.lightSpaceMatrix * draw.model);
+                if(draw.submesh_) draw.mesh_->drawDepth(*draw.submesh_);
+                else draw.mesh_->drawDepth();
+            }
+            glEnable(GL_CULL_FACE);
+
+            glCullFace(GL_BACK);
+            glViewport(0, 0, width, height);
+            glBindFramebuffer(GL_FRAMEBUFFER, buffer.fbo);
+            auto viewProjection = packet.view.projMatrix * packet.view.viewMatrix;
+            boundArena = nullptr;
+            for(const auto &draw : packet.draws)
+            {
+                if(!(draw.passes & draw_command::Geometry)) continue;
+
+                // Draws are sorted by shader and texture, so most of these are skipped.
+                if(boundArena != &draw.mesh_->arena) draw.mesh_->bind();
+                if(boundShader != draw.shader) draw.shader->use();
+                if(boundTexture != draw.texture_) draw.texture_->bind(0);
+                boundArena = &draw.mesh_->arena;
+                boundShader = draw.shader;
+                boundTexture = draw.texture_;
+
+                draw.shader->setUniform(draw.shader->uniforms.materialData.tiling, draw.tiling);
+                draw.shader->setUniform(draw.shader->uniforms.transformLightSpace, packet.lightSpaceMatrix * draw.model);
+                draw.shader->setUniform(draw.shader->uniforms.normalMatrix, draw.model);
+                draw.shader->setUniform(draw.shader->uniforms.transform, viewProjection * draw.model);
+                if(draw.submesh_) draw.mesh_->draw(*draw.submesh_);
+                else draw.mesh_->draw();
+            }
         }
 
         void deferred_renderer::sky(camera &camera, skybox &sky, shaders::skybox_shader_instance &shader)
@@ -1069,7 +3672,7 @@ namespace srd::core
                 camera.transform.matrix *
                 glm::mat4(glm::inverse(glm::mat3_cast(camera.transform.rotation))));
 
-            glDrawElements(GL_TRIANGLES, sky.skyMesh.elementCount, GL_UNSIGNED_INT, 0);
+            sky.skyMesh.draw();
             glDepthFunc(GL_LESS);
             checkErrors_(__PRETTY_FUNCTION__);
         }
@@ -1107,7 +3710,7 @@ namespace srd::core
 
             quadMesh.bind();
             lightPassShader.use();
-            glDrawElements(GL_TRIANGLES, quadMesh.elementCount, GL_UNSIGNED_INT, 0);
+            quadMesh.draw();
             glDisable(GL_FRAMEBUFFER_SRGB);
         }
 
@@ -1122,10 +3725,30 @@ namespace srd::core
     }
 }
 
+/**
+ * Mixes every component, the old XOR of the member hashes collided for mirrored vertices.
+ * Adding 0 folds -0 into +0 so that the hash agrees with 'operator=='.
+ */
 size_t std::hash<srd::core::gfx::vertex>::operator()(srd::core::gfx::vertex const& vertex) const {
-    return ((hash<glm::vec3>()(vertex.position) ^
-            (hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
-            (hash<glm::vec2>()(vertex.texcoord) << 1);
+    const float values[] = {
+        vertex.position.x, vertex.position.y, vertex.position.z,
+        vertex.normal.x, vertex.normal.y, vertex.normal.z,
+        vertex.texcoord.x, vertex.texcoord.y,
+        vertex.tangent.x, vertex.tangent.y, vertex.tangent.z
+    };
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    for(float value : values)
+    {
+        uint32_t bits;
+        value += 0.0f;
+        std::memcpy(&bits, &value, sizeof(bits));
+        h = (h ^ bits) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 32;
+    return size_t(h);
 }
 
 
@@ -1213,7 +3836,7 @@ namespace srd::core::window
             
             after_render();
 
-            glfwSwapBuffers(win);
+            if(!r.renderThreaded) glfwSwapBuffers(win);
             glfwPollEvents();
 
             lastTime = currentTime;
@@ -1221,5 +3844,76 @@ namespace srd::core::window
     }
 }
 
+namespace srd::core::gfx
+{
+    /**
+     * Takes over the window's GL context and renders packets submitted by the
+     * simulation thread, so that simulating frame N+1 overlaps with submitting frame N.
+     * 'framesInFlight' is how many packets the simulation may be ahead by (2 = double buffered).
+     * 'Packet' must have a 'double timestamp' member.
+     */
+    template<typename Packet>
+    struct render_thread
+    {
+        window::window &win;
+        frame_queue<Packet> queue;
+        std::atomic<bool> stopping = false;
+        std::thread thread;
+
+        /** Average time from a packet being submitted to its frame being swapped, in seconds. */
+        std::atomic<float> latency = 0;
+
+        template<window::callable<Packet&> F>
+        render_thread(window::window &win, size_t framesInFlight, F execute)
+            : win(win), queue(std::max<size_t>(framesInFlight, 1))
+        {
+            glfwMakeContextCurrent(NULL);
+            win.renderThreaded = true;
+            thread = std::thread([this, execute]() mutable
+            {
+                glfwMakeContextCurrent((GLFWwindow*)this->win.win);
+                for(;;)
+                {
+                    auto &packet = queue.front();
+                    if(stopping.load(std::memory_order_acquire)) break;
+
+                    execute(packet);
+                    glfwSwapBuffers((GLFWwindow*)this->win.win);
+
+                    float frameLatency = glfwGetTime() - packet.timestamp;
+                    latency.store(latency.load(std::memory_order_relaxed) * 0.9f + frameLatency * 0.1f,
+                        std::memory_order_relaxed);
+                    queue.pop();
+                }
+                glfwMakeContextCurrent(NULL);
+            });
+        }
+
+        ~render_thread()
+        {
+            // An empty packet wakes the thread up so it can see that it should stop.
+            stopping.store(true, std::memory_order_release);
+            queue.back();
+            queue.push();
+            thread.join();
+
+            win.renderThreaded = false;
+            glfwMakeContextCurrent((GLFWwindow*)win.win);
+        }
+
+        /** Returns the packet to fill, blocks while 'framesInFlight' packets are pending. */
+        Packet &begin()
+        {
+            return queue.back();
+        }
+
+        void submit()
+        {
+            queue.back().timestamp = glfwGetTime();
+            queue.push();
+        }
+    };
+}
+
 #endif
 #endif // CORE
@@ -2,6 +2,7 @@
 #define SRD_LOG
 #include <iostream>
 #include <string>
+#include <atomic>
 
 #define SRD_LOG_ESC "\033[0;"
 #define SRD_LOG_END "m"
@@ -20,7 +21,8 @@ namespace srd::log
         std::string prefix = "";
         std::string postfix = "";
         int indent = 0;
-        bool shouldDecorate = true;
+        /** Loggers are used by the loading jobs too, lines may interleave but the flag stays consistent. */
+        std::atomic<bool> shouldDecorate = true;
     };
 
     template<typename T>
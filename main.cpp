@@ -9,6 +9,14 @@
 #include <thread>
 #include <queue>
 #include <chrono>
+#include <map>
+#include <tuple>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <array>
+#include <string_view>
+#include <utility>
 
 // 3rd-Party Header-Only Libraries
 #include <inipp.h>
@@ -22,11 +30,6 @@
 #include "core.hpp"
 #undef  SRD_CORE_IMPLEMENTATION
 
-// Tiny .Obj Loader - Loading .Obj Files.
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-#undef TINYOBJLOADER_IMPLEMENTATION
-
 // STB Image - Loading images.
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -123,32 +126,291 @@ struct ValueInfo
         NONE, VEC3, VEC2, QUAT, STRING, FLOAT, INT
     } type;
 
-    ValueInfo() : type(NONE) { }
+    ValueInfo() : type(NONE), valQuat(0, 0, 0, 0) { }
 
     union
     {
-        glm::quat    valQuat;
-        glm::vec3    valVec3;
-        glm::vec2    valVec2;
-        std::string *valString;
-        float        valFloat;
-        int          valInt;
+        glm::quat        valQuat;
+        glm::vec3        valVec3;
+        glm::vec2        valVec2;
+        /** Points into the scene file, which is kept until the components are loaded (see `SceneInfo`). */
+        std::string_view valString;
+        float            valFloat;
+        int              valInt;
+    };
+};
+
+/** The properties of one entity, see `SceneSchema`. Missing ones are zeroed, strings are empty. */
+struct EntityProperties
+{
+    const ValueInfo *values;
+
+    const ValueInfo &operator[](std::string_view name) const;
+};
+
+/** 64 bit FNV-1a of a resource name, names written as literals are hashed at compile time. */
+struct ResourceId
+{
+    uint64_t value;
+
+    static constexpr uint64_t hash(std::string_view name)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for(unsigned char c : name) hash = (hash ^ c) * 0x100000001b3ull;
+        return hash;
+    }
+
+    consteval ResourceId(const char *name) : value(hash(name)) {}
+    ResourceId(const std::string &name) : value(hash(name)) {}
+    ResourceId(std::string_view name) : value(hash(name)) {}
+};
+
+/** A slot index and the generation it was handed out in, stale once the slot is reused. */
+template<typename T>
+struct ResourceHandle
+{
+    uint32_t index = UINT32_MAX, generation = 0;
+
+    explicit operator bool() const { return index != UINT32_MAX; }
+};
+
+/**
+ * Resources of one type in a dense array of slots. Names are only hashed and looked up to
+ * get a handle, dereferencing one is an index and a generation check. Misses never insert.
+ * An evicted resource keeps its slot and handles, acquiring it again requests a reload.
+ */
+template<typename T>
+struct ResourcePool
+{
+    struct Slot
+    {
+        std::unique_ptr<T> resource;
+        std::string name;
+        uint32_t generation = 1;
+        /** References held through `acquire`, only unreferenced resources are evicted. */
+        uint32_t references = 0;
+        /** Frame in which the resource was stored or its last reference released, for LRU eviction. */
+        uint64_t released = 0;
+        size_t cpuBytes = 0, gpuBytes = 0;
+        bool requested = false;
     };
 
-    ~ValueInfo()
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<uint64_t, uint32_t> indices;
+
+    /** Bytes of the resident resources. */
+    size_t cpuBytes = 0, gpuBytes = 0;
+    size_t resident = 0;
+    /** Names of evicted resources acquired again, `ResourceLoader::reload` takes them. */
+    std::vector<std::string> requests;
+    /** Set by `ResourceManager::collect`. */
+    uint64_t frame = 0;
+
+    /** Returns an invalid handle if nothing is called 'id'. */
+    ResourceHandle<T> find(ResourceId id) const
+    {
+        auto it = indices.find(id.value);
+        if(it == indices.end()) return {};
+        return { it->second, slots[it->second].generation };
+    }
+
+    /** Returns nullptr for invalid, stale and evicted handles, debug builds warn about stale ones. */
+    T *get(ResourceHandle<T> handle) const
+    {
+        if(handle.index >= slots.size()) return nullptr;
+        const auto &slot = slots[handle.index];
+        if(slot.generation != handle.generation)
+        {
+#ifndef NDEBUG
+            log::cwrn << "Stale handle to resource slot " << handle.index << " (generation "
+                      << handle.generation << ", now " << slot.generation << ")" << log::endl;
+#endif
+            return nullptr;
+        }
+        return slot.resource.get();
+    }
+
+    T *operator[](ResourceId id) const { return get(find(id)); }
+
+    /** Finds and references a resource, which requests it again if it was evicted. Pair with `release`. */
+    ResourceHandle<T> acquire(ResourceId id)
+    {
+        auto handle = find(id);
+        if(!handle) return handle;
+        auto &slot = slots[handle.index];
+        slot.references++;
+        if(!slot.resource && !slot.requested)
+        {
+            slot.requested = true;
+            requests.push_back(slot.name);
+        }
+        return handle;
+    }
+
+    void release(ResourceHandle<T> handle)
+    {
+        if(handle.index >= slots.size()) return;
+        auto &slot = slots[handle.index];
+        if(slot.generation != handle.generation || !slot.references) return;
+        if(--slot.references == 0) slot.released = frame;
+    }
+
+    /** Acquires a reference that is never released, for resources that are kept as plain pointers. */
+    T *pin(ResourceId id) { return get(acquire(id)); }
+
+    /**
+     * Stores 'resource' as 'name' with the bytes it holds. A previous one is deleted,
+     * its handles stay valid and see the new one. Types with a 'swap' are replaced in
+     * place, so that plain pointers to the previous one (see `pin`) stay valid as well.
+     */
+    ResourceHandle<T> set(const std::string &name, T *resource, size_t cpuBytes = 0, size_t gpuBytes = 0)
+    {
+        auto [it, inserted] = indices.try_emplace(ResourceId(name).value, 0);
+        if(inserted)
+        {
+            if(freeSlots.empty())
+            {
+                it->second = slots.size();
+                slots.emplace_back();
+            }
+            else
+            {
+                it->second = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            slots[it->second].name = name;
+        }
+        else if(slots[it->second].name != name)
+            log::cerr << "Resource names '" << slots[it->second].name << "' and '" << name << "' have the same ID!" << log::endl;
+
+        auto &slot = slots[it->second];
+        std::unique_ptr<T> fresh(resource);
+        if constexpr(requires(T &a, T &b) { a.swap(b); })
+        {
+            // The resident object takes the new data, the old data is unloaded in the fresh one.
+            if(slot.resource && fresh)
+            {
+                slot.resource->swap(*fresh);
+                std::swap(slot.resource, fresh);
+            }
+        }
+        unload(it->second);
+        slot.resource = std::move(fresh);
+        slot.cpuBytes = cpuBytes;
+        slot.gpuBytes = gpuBytes;
+        slot.released = frame;
+        slot.requested = false;
+        this->cpuBytes += cpuBytes;
+        this->gpuBytes += gpuBytes;
+        if(resource) resident++;
+        return { it->second, slot.generation };
+    }
+
+    /** Deletes the resource in slot 'index', it stays findable and is reloaded once acquired again. */
+    void unload(uint32_t index)
+    {
+        auto &slot = slots[index];
+        if(!slot.resource) return;
+        slot.resource.reset();
+        cpuBytes -= slot.cpuBytes;
+        gpuBytes -= slot.gpuBytes;
+        resident--;
+    }
+
+    /** Deletes the resource called 'id', its handles become stale. */
+    void remove(ResourceId id)
     {
-        log::cerr << "~ValueInfo()!" << log::endl;
-        if(type == STRING) delete valString;
+        auto it = indices.find(id.value);
+        if(it == indices.end()) return;
+        unload(it->second);
+        auto &slot = slots[it->second];
+        slot = Slot { .generation = slot.generation + 1 };
+        freeSlots.push_back(it->second);
+        indices.erase(it);
     }
 };
 
 /** Container for all resources. */
 struct ResourceManager
 {
-    std::unordered_map<std::string, std::unique_ptr<core::gfx::mesh>> meshes;
-    std::unordered_map<std::string, std::unique_ptr<core::gfx::texture>> textures;
-    std::unordered_map<std::string, std::unique_ptr<core::gfx::shader>> shaders;
-    std::unordered_map<std::string, std::unique_ptr<core::gfx::cubemap>> cubemaps;
+    // Declared first so that it outlives the meshes allocated from it.
+    core::gfx::mesh_arena meshArena { 1 << 16, 1 << 18 };
+
+    ResourcePool<core::gfx::mesh> meshes;
+    ResourcePool<core::gfx::texture> textures;
+    ResourcePool<core::gfx::shader> shaders;
+    ResourcePool<core::gfx::cubemap> cubemaps;
+
+    /** Budgets in bytes, 0 for none, see `[resources]` in config.ini. */
+    size_t cpuBudget = 0, gpuBudget = 0;
+    uint64_t frame = 0;
+    size_t evictions = 0;
+
+    /** Stores an uploaded resource along with the bytes it holds, see `collect`. */
+    void store(const std::string &name, core::gfx::mesh *mesh)
+    {
+        meshes.set(name, mesh, mesh ? sizeof(*mesh) + mesh->submeshes.capacity() * sizeof(core::gfx::submesh)
+            + (mesh->bvh ? mesh->bvh->bytes() : 0) : 0, mesh ? mesh->bytes() : 0);
+    }
+
+    void store(const std::string &name, core::gfx::texture *texture)
+    {
+        textures.set(name, texture, texture ? sizeof(*texture) : 0, texture ? texture->bytes : 0);
+    }
+
+    void store(const std::string &name, core::gfx::cubemap *cubemap)
+    {
+        cubemaps.set(name, cubemap, cubemap ? sizeof(*cubemap) : 0, cubemap ? cubemap->bytes : 0);
+    }
+
+    size_t cpuBytes() const { return meshes.cpuBytes + textures.cpuBytes + shaders.cpuBytes + cubemaps.cpuBytes; }
+    size_t gpuBytes() const { return meshes.gpuBytes + textures.gpuBytes + shaders.gpuBytes + cubemaps.gpuBytes; }
+
+    /**
+     * Starts a frame and evicts unreferenced meshes, textures and cubemaps, least recently
+     * used first, until both budgets are met. Deletes GL objects, so only on the GL thread.
+     */
+    void collect()
+    {
+        meshes.frame = textures.frame = shaders.frame = cubemaps.frame = ++frame;
+        bool overCpu = cpuBudget && cpuBytes() > cpuBudget;
+        bool overGpu = gpuBudget && gpuBytes() > gpuBudget;
+        if(!overCpu && !overGpu) return;
+
+        // (released, pool, slot), pools in the order meshes, textures, cubemaps.
+        std::vector<std::tuple<uint64_t, int, uint32_t>> candidates;
+        auto gather = [&](const auto &pool, int kind)
+        {
+            for(uint32_t i = 0; i < pool.slots.size(); ++i)
+                if(pool.slots[i].resource && !pool.slots[i].references)
+                    candidates.emplace_back(pool.slots[i].released, kind, i);
+        };
+        gather(meshes, 0);
+        gather(textures, 1);
+        gather(cubemaps, 2);
+        std::sort(candidates.begin(), candidates.end());
+
+        auto evict = [&](auto &pool, uint32_t index)
+        {
+            const auto &slot = pool.slots[index];
+            if(!(overCpu && slot.cpuBytes) && !(overGpu && slot.gpuBytes)) return;
+            log::cout << "Evicting '" << slot.name << "' (" << (slot.cpuBytes + slot.gpuBytes) / 1024 << " KiB)" << log::endl;
+            pool.unload(index);
+            evictions++;
+        };
+        for(auto [released, kind, index] : candidates)
+        {
+            if(kind == 0) evict(meshes, index);
+            else if(kind == 1) evict(textures, index);
+            else evict(cubemaps, index);
+            overCpu = cpuBudget && cpuBytes() > cpuBudget;
+            overGpu = gpuBudget && gpuBytes() > gpuBudget;
+            if(!overCpu && !overGpu) break;
+        }
+    }
+    /** Mesh nodes of the .glb files loaded as meshes, see `SceneInfo`. */
+    std::unordered_map<std::string, std::vector<GlbNode>> glbNodes;
 };
 
 /** This class is a holder for all resources that need to be quicky accessible. */
@@ -162,6 +424,10 @@ public:
     static inline rbEnvironment *physicsEnv = nullptr;
 
     static inline core::window::window *window;
+
+    /** Set while rendering on a separate thread (see `core::gfx::render_thread`). */
+    static inline std::atomic<float> *renderLatency = nullptr;
+    static inline int framesInFlight = 0;
 };
 
 // Forward-Decl.
@@ -171,7 +437,24 @@ class Entity;
 enum class EntityComponentType
 {
     RigidBody,
-    StaticMesh
+    StaticMesh,
+    PlayerController
+};
+
+/** Data sets read and written by the frame graph's nodes (see `core::jobs::access`). */
+struct FrameData
+{
+    enum : uint64_t
+    {
+        Input        = 1 << 0, // Window and ImGui input state.
+        Camera       = 1 << 1,
+        Forces       = 1 << 2, // Forces applied to rigid bodies before the physics update.
+        RigidBodies  = 1 << 3, // The physics environment and the state of its bodies.
+        Transforms   = 1 << 4, // Entity transforms.
+        RenderData   = 1 << 5, // Meshes, textures and materials of static meshes and batches.
+        DrawCommands = 1 << 6,
+        SpatialIndex = 1 << 7  // The scene's trees of entity bounds.
+    };
 };
 
 /** Represents a component of an entity. */
@@ -181,6 +464,11 @@ public:
     EntityComponentType type;
     Entity *entity;
 
+    /** Data used by `update` and `afterUpdate`, each component type declares its own. */
+    static constexpr core::jobs::access updateAccess {}, afterUpdateAccess {};
+    /** Whether the updates have to run on the main thread, otherwise entities are updated in parallel. */
+    static constexpr bool mainThread = false;
+
     virtual ~EntityComponent()
     {
         log::cerr << "~EntityComponent()!" << log::endl;
@@ -188,7 +476,7 @@ public:
 
     /** Called when added to the entity. */
     virtual void load(
-        std::unordered_map<std::string, ValueInfo> &info,
+        const EntityProperties &info,
         ResourceManager &resourceManager) {} /** FIXME: @note NOTE: */
     
     /** Called before the first update/render cycle. NOTE: All components are accessble. */
@@ -200,8 +488,11 @@ public:
     /** Called after physics world update. */
     virtual void afterUpdate(float dt) {}
 
-    /** Called when the scene is rendered. */
-    virtual void render(core::gfx::camera &camera, core::gfx::deferred_renderer &renderer) {}
+    /**
+     * Called when the scene is rendered, adds the component's visible draws to 'commands'.
+     * May be called from any thread, must only read the component's state.
+     */
+    virtual void render(const core::gfx::frame_packet &packet, std::vector<core::gfx::draw_command> &commands) const {}
 };
 
 /** Represents an entity in a world. */
@@ -211,6 +502,8 @@ public:
     core::math::transform transform;
     std::vector<EntityComponent*> components;
     size_t componentCount = 0;
+    /** Its leaf in the scene's spatial index, see `Scene::indexEntities`. */
+    uint32_t indexLeaf = core::math::aabb_tree::null_node;
 
     Entity()
     {
@@ -256,28 +549,23 @@ public:
 
     void add(EntityComponent *component)
     {
-        log::cout << "Entity::add(" << component << ")" << log::endl;
         if(!component) log::cerr << "Entity::add(nullptr)!" << log::endl;
-        log::cout << "component->entity (" << component->entity << ") = " << this << log::endl;
         component->entity = this;
         components.push_back(component);
         ++componentCount;
-        log::cout << "Entity: Added component! Component Count: " << componentCount << log::endl;
     }
 
-    void render(
-        core::gfx::camera &camera,
-        core::gfx::deferred_renderer &renderer)
+    void render(const core::gfx::frame_packet &packet, std::vector<core::gfx::draw_command> &commands) const
     {
         for(size_t i = 0; i < componentCount; ++i)
-            components[i]->render(camera, renderer);
+            components[i]->render(packet, commands);
     }
 };
 
 
 
 #define EC_STATIC_CREATE(NAME) \
-    static EntityComponent *create(Entity *e, ResourceManager &rm, std::unordered_map<std::string, ValueInfo> &info) \
+    static EntityComponent *create(Entity *e, ResourceManager &rm, const EntityProperties &info) \
     { \
         auto c = new NAME(); \
         c->entity = e; \
@@ -285,43 +573,99 @@ public:
         return c; \
     }
 
-class ECStaticMesh : EntityComponent
+class ECStaticMesh : public EntityComponent
 {
 public:
-    core::gfx::mesh *mesh;
-    core::gfx::texture *texture;
+    ResourceHandle<core::gfx::mesh> mesh;
+    ResourceHandle<core::gfx::texture> texture;
+    /** Textures by submesh material ID, from 'staticmesh.textures'. Missing ones fall back to 'texture'. */
+    std::vector<ResourceHandle<core::gfx::texture>> materialTextures;
+    ResourceManager *resources = nullptr;
     core::gfx::shaders::geometry_shader_instance *shader;
 
+    /** Whether the mesh may be merged into a static batch (see `buildStaticBatches`). */
+    bool batchable = false;
+    /** Per submesh, set once it has been merged and a batch renders it instead. */
+    std::vector<bool> batched;
+
     ECStaticMesh() { type = EntityComponentType::StaticMesh; }
     ~ECStaticMesh()
     {
         log::cerr << "~ECStaticMesh()!" << log::endl;
         delete shader;
+        if(!resources) return;
+        // Unreferenced resources may be evicted, see `ResourceManager::collect`.
+        resources->meshes.release(mesh);
+        resources->textures.release(texture);
+        for(auto handle : materialTextures) resources->textures.release(handle);
     }
 
     virtual void load(
-        std::unordered_map<std::string, ValueInfo> &info,
+        const EntityProperties &info,
         ResourceManager &resourceManager) override
     {
-        mesh = resourceManager.meshes[*info["staticmesh.mesh"].valString].get();
-        texture = resourceManager.textures[*info["staticmesh.texture"].valString].get();
+        resources = &resourceManager;
+        mesh = resourceManager.meshes.acquire(info["staticmesh.mesh"].valString);
+        texture = resourceManager.textures.acquire(info["staticmesh.texture"].valString);
+        forEachTexture(info, [&](std::string_view name)
+        {
+            materialTextures.push_back(resourceManager.textures.acquire(name));
+        });
+        if(auto m = getMesh()) batched.assign(m->submeshes.size(), false);
         shader = new core::gfx::shaders::geometry_shader_instance {
-            .type = *static_cast<core::gfx::shaders::geometry_shader*>(resourceManager.shaders["lit"].get())
+            .type = *static_cast<core::gfx::shaders::geometry_shader*>(resourceManager.shaders["lit"])
         };
         shader->uniforms.materialData.tiling = info["staticmesh.texture.tiling"].valVec2;
+
+        // Only entities which never move can be baked into world space.
+        batchable = info["staticmesh.batch"].valInt && info["rigidbody.static"].valInt;
+    }
+
+    /** Calls 'f' with the names in 'staticmesh.textures', which are separated by spaces. */
+    template<typename F>
+    static void forEachTexture(const EntityProperties &info, F &&f)
+    {
+        auto textures = info["staticmesh.textures"].valString;
+        for(size_t begin = textures.find_first_not_of(" \t"); begin != std::string_view::npos;)
+        {
+            size_t end = std::min(textures.find_first_of(" \t", begin), textures.size());
+            f(textures.substr(begin, end - begin));
+            begin = textures.find_first_not_of(" \t", end);
+        }
+    }
+
+    core::gfx::mesh *getMesh() const { return resources->meshes.get(mesh); }
+
+    core::gfx::texture *textureFor(unsigned int material) const
+    {
+        return material < materialTextures.size() && materialTextures[material]
+            ? resources->textures.get(materialTextures[material]) : resources->textures.get(texture);
     }
 
-    virtual void render(core::gfx::camera &camera, core::gfx::deferred_renderer &renderer) override
+    /** Every submesh is its own draw, so that they sort and cull with everything else. */
+    virtual void render(const core::gfx::frame_packet &packet, std::vector<core::gfx::draw_command> &commands) const override
     {
         // puts("StaticMesh: render()");
-        renderer.render(camera, {
-            entity->transform,
-            *mesh,
-            *texture,
-            *shader,
-            *ResourceGlobals::shadowShader,
-            *ResourceGlobals::lightSpaceMatrix
-        });
+        auto mesh = getMesh();
+        if(!mesh) return;
+        for(size_t i = 0; i < mesh->submeshes.size(); ++i)
+        {
+            if(i < batched.size() && batched[i]) continue;
+            // Skipped while an evicted texture is reloading.
+            auto texture = textureFor(mesh->submeshes[i].material);
+            if(!texture) continue;
+            core::gfx::draw_command draw {
+                .mesh_     = mesh,
+                .submesh_  = &mesh->submeshes[i],
+                .texture_  = texture,
+                .shader    = &shader->type,
+                .textureId = texture->id,
+                .shaderId  = shader->type.id,
+                .tiling    = shader->uniforms.materialData.tiling,
+                .model     = entity->transform.matrix
+            };
+            if(packet.prepare(draw)) commands.push_back(draw);
+        }
     }
 
     EC_STATIC_CREATE(ECStaticMesh);
@@ -360,11 +704,19 @@ class ECRigidBody : public EntityComponent
 
     glm::vec3 offset;
 public:
+    static constexpr core::jobs::access updateAccess { .writes = FrameData::Forces };
+    static constexpr core::jobs::access afterUpdateAccess {
+        .reads = FrameData::RigidBodies, .writes = FrameData::Transforms
+    };
+
+    /** From 'rigidbody.static', the body never moves. */
+    bool isStatic = false;
+
     ECRigidBody() { type = EntityComponentType::RigidBody; }
 
     /** Called when added to the entity. */
     virtual void load(
-        std::unordered_map<std::string, ValueInfo> &info,
+        const EntityProperties &info,
         ResourceManager &resourceManager)
     {
         log::cout << "ECRigidBody::load(); entity = " << entity << log::endl; // entity is NULL!!!
@@ -372,7 +724,7 @@ public:
 
         log::cout << "setting up size & static" << log::endl;
         auto size = info["rigidbody.size"].valVec3;
-        auto isStatic = info["rigidbody.static"].valInt; // TODO Booleans
+        isStatic = info["rigidbody.static"].valInt; // TODO Booleans
 
         log::cout << "set parameter" << log::endl;
         rb.SetShapeParameter(
@@ -385,6 +737,12 @@ public:
         env->Register(&rb);
 
         this->offset = info["rigidbody.offset"].valVec3;
+        place();
+    }
+
+    /** Moves the body to the entity's transform, e.g. after the entity was moved in the scene file. */
+    void place()
+    {
         rb.SetPosition(glm2rb(entity->transform.position + offset * entity->transform.rotation));
         rb.SetOrientation(glm2rb(glm::mat3_cast(entity->transform.rotation)));
     }
@@ -418,12 +776,20 @@ public:
     EC_STATIC_CREATE(ECRigidBody);
 };
 
-class ECPlayerController : EntityComponent
+class ECPlayerController : public EntityComponent
 {
     ECRigidBody *rb;
     float speed = 10.f;
 
 public:
+    static constexpr core::jobs::access updateAccess {
+        .reads = FrameData::Input | FrameData::Transforms, .writes = FrameData::Forces
+    };
+    /** Polls the window. */
+    static constexpr bool mainThread = true;
+
+    ECPlayerController() { type = EntityComponentType::PlayerController; }
+
     virtual void start() override
     {
         // who needs c++'s casts, right?
@@ -450,151 +816,344 @@ public:
 class Scene
 {
 public:
+    /** In the order of the scene file, null for entities of cells that are not streamed in (see `SceneStreamer`). */
     std::vector<std::unique_ptr<Entity>> entities;
 
+    /** Components by type, filled by `start` and updated by the frame graph. */
+    std::vector<ECRigidBody*> rigidBodies;
+    std::vector<ECPlayerController*> playerControllers;
+    /** Components of types without a system of their own, the frame graph updates them on the main thread. */
+    std::vector<EntityComponent*> otherComponents;
+
+    /**
+     * Bounds of the entities, whose index is the leaves' data. Static entities only move when the
+     * scene is edited, so they have their own tree, which dynamic ones moving every frame do not touch.
+     */
+    core::math::aabb_tree staticTree, dynamicTree;
+    struct IndexEntry
+    {
+        uint32_t leaf = core::math::aabb_tree::null_node;
+        bool dynamic = false;
+        glm::vec3 center { 0.f };
+    };
+    std::vector<IndexEntry> index;
+    std::vector<uint32_t> dynamicEntities;
+    /** Static entities indexed by their position only, their mesh was not resident yet. */
+    std::vector<uint32_t> unresolvedEntities;
+
     void start()
     {
-        for(auto &e : entities) e->start();
+        for(auto &e : entities) if(e) e->start();
+
+        rigidBodies.clear();
+        playerControllers.clear();
+        otherComponents.clear();
+        for(auto &e : entities)
+        {
+            if(!e) continue;
+            for(size_t i = 0; i < e->componentCount; ++i)
+            {
+                auto c = e->components[i];
+                if(c->type == EntityComponentType::RigidBody)
+                    rigidBodies.push_back(static_cast<ECRigidBody*>(c));
+                else if(c->type == EntityComponentType::PlayerController)
+                    playerControllers.push_back(static_cast<ECPlayerController*>(c));
+                // Static meshes do not update.
+                else if(c->type != EntityComponentType::StaticMesh)
+                    otherComponents.push_back(c);
+            }
+        }
+        indexEntities();
+    }
+
+    /** World bounds of the entity's mesh, or just its position if it has no resident mesh. */
+    static core::math::aabb bounds(Entity &e, bool &resolved)
+    {
+        auto mesh = (ECStaticMesh*)e.findComponentByType(EntityComponentType::StaticMesh);
+        auto meshData = mesh ? mesh->getMesh() : nullptr;
+        resolved = meshData || !mesh;
+        if(!meshData) return { .min = e.transform.position, .max = e.transform.position };
+        return meshData->bounds.transformed(e.transform.matrix);
     }
 
-    void afterUpdate(float dt)
+    /** Adds entities created since the last call to the spatial index and removes deleted ones. */
+    void indexEntities()
     {
-        for(auto &e : entities) e->afterUpdate(dt);
+        auto unindex = [this](size_t i)
+        {
+            auto &entry = index[i];
+            if(entry.leaf == core::math::aabb_tree::null_node) return;
+            (entry.dynamic ? dynamicTree : staticTree).remove(entry.leaf);
+            entry = {};
+        };
+        for(size_t i = entities.size(); i < index.size(); ++i) unindex(i);
+        index.resize(entities.size());
+
+        dynamicEntities.clear();
+        for(size_t i = 0; i < entities.size(); ++i)
+        {
+            auto e = entities[i].get();
+            auto &entry = index[i];
+            if(!e || e->indexLeaf == core::math::aabb_tree::null_node)
+            {
+                // A new entity, or its slot was emptied or reused since.
+                unindex(i);
+                if(!e) continue;
+                auto rb = (ECRigidBody*)e->findComponentByType(EntityComponentType::RigidBody);
+                entry.dynamic = rb && !rb->isStatic;
+                bool resolved;
+                auto box = bounds(*e, resolved);
+                entry.center = box.center();
+                entry.leaf = e->indexLeaf = (entry.dynamic ? dynamicTree : staticTree).insert(box, i);
+                if(!resolved && !entry.dynamic) unresolvedEntities.push_back(i);
+            }
+            if(entry.dynamic) dynamicEntities.push_back(i);
+        }
     }
 
-    void update(float dt)
+    /** Updates the bounds of an entity after it moved, returns false while it has no resident mesh. */
+    bool refit(size_t i)
+    {
+        if(i >= index.size() || !entities[i] || index[i].leaf == core::math::aabb_tree::null_node) return true;
+        auto &entry = index[i];
+        bool resolved;
+        auto box = bounds(*entities[i], resolved);
+        auto center = box.center();
+        (entry.dynamic ? dynamicTree : staticTree).move(entry.leaf, box, center - entry.center);
+        entry.center = center;
+        return resolved;
+    }
+
+    /** Refits every entity, e.g. after meshes were reloaded. */
+    void refit()
     {
-        // TODO? Make similar to loop in Entity.update()? Optimize?
-        for(auto &e : entities) e->update(dt);
+        for(size_t i = 0; i < index.size(); ++i) refit(i);
     }
 
-    void render(
-        core::gfx::camera &camera,
-        core::gfx::deferred_renderer &renderer)
+    /** Follows the dynamic entities and static ones whose mesh became resident, once per frame. */
+    void updateIndex()
     {
-        for(auto &e : entities) e->render(camera, renderer);
+        for(auto i : dynamicEntities) refit(i);
+        std::erase_if(unresolvedEntities, [this](uint32_t i) { return refit(i); });
     }
-};
 
+    /** Calls 'f(query, entity)' for the entities whose bounds overlap one of 'queries' (boxes, spheres or frustums). */
+    template<typename Q, typename F>
+    void query(std::span<const Q> queries, F &&f) const
+    {
+        staticTree.query(queries, f);
+        dynamicTree.query(queries, f);
+    }
 
-/**
- * Prefer to use inipp::Ini<char> instead of this, this exists
- * so that SceneInfo can load multiple entities of the same type.
- * 
- * As I said before, this is bad code...
- */
-struct MultiIni
-{
-    using Section = std::map<std::string, std::string>;
-    using Sections = std::map<std::string, std::vector<Section>>;
-    Sections sections;
+    /** See `core::math::aabb_tree::raycast`, lengths 'f' returns carry over from the static to the dynamic entities. */
+    template<typename F>
+    void raycast(std::span<const core::math::ray> rays, F &&f) const
+    {
+        std::vector<core::math::ray> clipped(rays.begin(), rays.end());
+        auto clip = [&](size_t r, uint32_t e, float length) { return clipped[r].length = f(r, e, length); };
+        staticTree.raycast(std::span<const core::math::ray>(clipped), clip);
+        dynamicTree.raycast(std::span<const core::math::ray>(clipped), clip);
+    }
 
-    MultiIni(const std::string &filename)
+    /**
+     * The first entity along 'r' and how far along it is, -1 if there is none. Meshes with
+     * a triangle BVH are hit on their triangles, anything else on its bounds.
+     */
+    int pick(const core::math::ray &r, float &distance) const
     {
-        std::ifstream ifs(filename);
-        int lineno = 0;
-        std::string section;
-        for(std::string line; std::getline(ifs, line);)
+        int picked = -1;
+        distance = r.length;
+        raycast(std::span<const core::math::ray>(&r, 1), [&](size_t, uint32_t i, float length)
         {
-            // log::cout << "MultiIni: Reading line: '" << line << "'" << log::endl;
-            ++lineno;
-
-            // Trim the line:
-            // [https://stackoverflow.com/a/217605/9110517]
-            line.erase(line.begin(), std::find_if(line.begin(), line.end(), [](auto ch) {
-                return !std::isspace(ch);
-            }));
-            line.erase(std::find_if(line.rbegin(), line.rend(), [](auto ch) {
-                return !std::isspace(ch);
-            }).base(), line.end());
-
-            // Line is empty or is a comment:
-            if(line.size() == 0 || *line.begin() == ';')
-            {
-                log::cout << "MultiIni: Comment/Empty" << log::endl;
-                // continue; - Skip the line.
-            }
-            else if(*line.begin() == '[')
+            if(!entities[i]) return length;
+            auto &e = *entities[i];
+            auto mesh = (ECStaticMesh*)e.findComponentByType(EntityComponentType::StaticMesh);
+            auto meshData = mesh ? mesh->getMesh() : nullptr;
+            float hit;
+            if(meshData && meshData->bvh)
             {
-                if(*line.rbegin() != ']')
-                {
-                    log::cerr << filename << ':' << lineno << ": Expected ending ']'" << log::endl;
-                    log::cerr << lineno << " | " << line << log::endl;
-                }
-                else
-                {
-                    // log::cout << "MultiIni: Section" << log::endl;
-                    sections[section = line.substr(1, line.size() - 2)].push_back(Section());
-                }
-            }
-            else if(line.find('=') != std::string::npos)
-            {   //  ^^^^^^^^^^^^^^───────────┬───[1]
-                // [TODO] Optimize line.find └───vvvvvvvvvvvvvv 
-                std::string name = line.substr(0, line.find('=') - 1);
-                // log::cout << "MultiIni: Equals" << log::endl;
-
-                // Right trim the name `<name>   =   <value>`
-                //        This ───────────────^^^
-                name.erase(std::find_if(name.rbegin(), name.rend(), [](auto ch) {
-                    return !std::isspace(ch);
-                }).base(), name.end());
-
-                // Left trim the value `<name>   =   <value>`
-                //       This ────────────────────^^^
-                std::string value = line.substr(line.find('=') + 1); // [1] This also
-                
-                value.erase(value.begin(), std::find_if(value.begin(), value.end(), [](auto ch) {
-                    return !std::isspace(ch);
-                }));
-
-                // log::cout << "MultiIni: '" << name << "' = '" << value << "'" << log::endl;
-
-                sections[section].back()[name] = value;
+                // The direction is not normalized again, so distances along it are the same in object space.
+                auto inverse = glm::inverse(e.transform.matrix);
+                core::math::ray local { glm::vec3(inverse * glm::vec4(r.origin, 1.f)),
+                                        glm::vec3(inverse * glm::vec4(r.direction, 0.f)), length };
+                core::math::triangle_bvh::hit h;
+                if(!meshData->bvh->intersect(local, h)) return length;
+                hit = h.distance;
             }
             else
             {
-                log::cerr << filename << ':' << lineno << ": Bad format..." << log::endl;
-                log::cerr << lineno << " | " << line << log::endl;
+                bool resolved;
+                hit = core::math::ray { r.origin, r.direction, length }.intersects(bounds(e, resolved));
+                if(hit > length) return length;
             }
-        }
+            picked = i;
+            return distance = hit;
+        });
+        return picked;
     }
-    
-    auto getQuat(const std::string &sec, const std::string &name, int index = 0, const glm::quat &def = { 1, 0, 0, 0}) -> glm::quat
-    {
-        try { return stringToQuat(sections[sec].at(index)[name]); } catch(std::out_of_range&) { return def; }
-    };
 
-    auto getVec3(const std::string &sec, const std::string &name, int index = 0, const glm::vec3 &def = { 0, 0, 0 }) -> glm::vec3
+    /**
+     * Adds a node to 'graph' calling 'method' on every component of 'list', with the data
+     * access declared by the component type. Unless it is main thread affine, chunks of
+     * the list are processed in parallel.
+     */
+    template<typename T>
+    static void addSystem(core::jobs::graph &graph, std::string name, core::jobs::access access,
+                          std::vector<T*> &list, void (T::*method)(float), const float &dt)
     {
-        try { return stringToVec3(sections[sec].at(index)[name]); } catch(std::out_of_range&) { return def; }
+        graph.add(std::move(name), access, [&list, method, &dt]()
+        {
+            if constexpr(T::mainThread)
+                for(auto c : list) (c->*method)(dt);
+            else
+                core::jobs::parallel_for(0, list.size(), [&](size_t first, size_t last)
+                {
+                    for(size_t i = first; i < last; ++i) (list[i]->*method)(dt);
+                }, 64);
+        }, T::mainThread);
     }
 
-    auto getVec2(const std::string &sec, const std::string &name, int index = 0, const glm::vec2 &def = { 0, 0 }) -> glm::vec2
+    /** Renders the entities at 'indices', see `EntityComponent::render`. */
+    void render(const core::gfx::frame_packet &packet, std::vector<core::gfx::draw_command> &commands,
+                std::span<const uint32_t> indices) const
     {
-        try { return stringToVec2(sections[sec].at(index)[name]); } catch(std::out_of_range&) { return def; }
+        for(auto i : indices) if(entities[i]) entities[i]->render(packet, commands);
     }
+};
+
+
+/** Geometry of static entities that share a material and a cell, baked into world space. */
+struct StaticBatch
+{
+    std::unique_ptr<core::gfx::mesh> mesh;
+    core::gfx::texture *texture;
+    core::gfx::shaders::geometry_shader_instance *shader;
+    core::math::aabb bounds; // Kept for culling.
+    size_t submeshCount = 0;
+};
 
-    auto getFloat(const std::string &sec, const std::string &name, int index = 0, float def = 0) -> float
+/**
+ * Merges the submeshes of batchable entities into one mesh per material and spatial cell,
+ * so that each cell is drawn with a single call per pass instead of one per entity.
+ */
+std::vector<StaticBatch> buildStaticBatches(Scene &scene, ResourceManager &resourceManager, float cellSize)
+{
+    struct Key
     {
-        try { return stringToFloat(sections[sec].at(index)[name]); } catch(std::out_of_range&) { return def; }
-    }
+        core::gfx::texture *texture;
+        core::gfx::shaders::geometry_shader *shader;
+        glm::vec2 tiling;
+        glm::ivec3 cell;
+
+        bool operator<(const Key &o) const
+        {
+            auto tie = [](const Key &k) {
+                return std::make_tuple(k.texture, k.shader, k.tiling.x, k.tiling.y, k.cell.x, k.cell.y, k.cell.z);
+            };
+            return tie(*this) < tie(o);
+        }
+    };
+
+    struct Source
+    {
+        ECStaticMesh *component;
+        size_t submesh;
+        std::vector<core::gfx::vertex> vertices; // Already in world space.
+        std::vector<unsigned int> indices;
+    };
+
+    std::map<Key, std::vector<Source>> groups;
+    size_t drawsBefore = 0;
 
-    auto getInt(const std::string &sec, const std::string &name, int index = 0, int def = 0) -> int
+    for(auto &e : scene.entities)
     {
-        try { return stringToInt(sections[sec].at(index)[name]); } catch(std::out_of_range&) { return def; }
+        if(!e) continue;
+        auto mesh = (ECStaticMesh*)e->findComponentByType(EntityComponentType::StaticMesh);
+        auto meshData = mesh ? mesh->getMesh() : nullptr;
+        if(!meshData) continue;
+        drawsBefore += meshData->submeshes.size();
+        if(!mesh->batchable) continue;
+
+        std::vector<core::gfx::vertex> vertices;
+        std::vector<unsigned int> indices;
+        meshData->read(vertices, indices);
+
+        const auto &model = e->transform.matrix;
+        glm::mat3 normalModel = model;
+        for(auto &v : vertices)
+        {
+            v.position = glm::vec3(model * glm::vec4(v.position, 1.f));
+            v.normal   = normalModel * v.normal;
+            v.tangent  = normalModel * v.tangent;
+        }
+
+        for(size_t i = 0; i < meshData->submeshes.size(); ++i)
+        {
+            const auto &submesh = meshData->submeshes[i];
+            auto texture = mesh->textureFor(submesh.material);
+            if(!texture) continue;
+
+            // Only the vertices the submesh uses, renumbered.
+            Source source { .component = mesh, .submesh = i };
+            std::unordered_map<unsigned int, unsigned int> remap;
+            core::math::aabb bounds;
+            for(unsigned int k = submesh.indexOffset; k < submesh.indexOffset + submesh.indexCount; ++k)
+            {
+                auto [it, inserted] = remap.try_emplace(indices[k], (unsigned int)source.vertices.size());
+                if(inserted)
+                {
+                    source.vertices.push_back(vertices[indices[k]]);
+                    bounds.extend(source.vertices.back().position);
+                }
+                source.indices.push_back(it->second);
+            }
+
+            Key key {
+                .texture = texture,
+                .shader  = &mesh->shader->type,
+                .tiling  = mesh->shader->uniforms.materialData.tiling,
+                .cell    = glm::ivec3(glm::floor(bounds.center() / cellSize)),
+            };
+            groups[key].push_back(std::move(source));
+        }
     }
 
-    auto getString(const std::string &sec,
-                         const std::string &name,
-                         int index = 0,
-                         const std::string &def = "") -> std::string
+    std::vector<StaticBatch> batches;
+    size_t mergedCount = 0;
+    for(auto &[key, sources] : groups)
     {
-        try { return sections[sec].at(index)[name]; } catch(std::out_of_range&) { return def; }
+        // A single submesh gains nothing from being merged.
+        if(sources.size() < 2) continue;
+
+        StaticBatch batch {
+            .texture = key.texture,
+            .shader  = sources[0].component->shader,
+        };
+
+        std::vector<core::gfx::vertex> vertices;
+        std::vector<unsigned int> indices;
+        for(auto &source : sources)
+        {
+            auto base = (unsigned int)vertices.size();
+            for(const auto &v : source.vertices) batch.bounds.extend(v.position);
+            vertices.insert(vertices.end(), source.vertices.begin(), source.vertices.end());
+            for(auto i : source.indices) indices.push_back(base + i);
+            source.component->batched[source.submesh] = true;
+        }
+
+        batch.mesh.reset(new core::gfx::mesh{ resourceManager.meshArena, vertices, indices });
+        batch.submeshCount = sources.size();
+        mergedCount += sources.size();
+        batches.push_back(std::move(batch));
     }
-};
 
-using CreateEntityComponentFunc =
-    EntityComponent*(*)(Entity*, ResourceManager&, std::unordered_map<std::string, ValueInfo>&);
+    log::cout << "Static batching: merged " << mergedCount << " submeshes into " << batches.size()
+              << " batches, draw calls per pass: " << drawsBefore << " -> "
+              << drawsBefore - mergedCount + batches.size() << log::endl;
+    return batches;
+}
+
+using CreateEntityComponentFunc = EntityComponent*(*)(Entity*, ResourceManager&, const EntityProperties&);
 
 struct EntityComponentInfo
 {
@@ -611,7 +1170,9 @@ std::unordered_map<std::string_view, EntityComponentInfo> entityComponentInfo =
             .info = {
                 { "staticmesh.mesh", ValueInfo::STRING },
                 { "staticmesh.texture", ValueInfo::STRING },
-                { "staticmesh.texture.tiling", ValueInfo::VEC2 }
+                { "staticmesh.textures", ValueInfo::STRING },
+                { "staticmesh.texture.tiling", ValueInfo::VEC2 },
+                { "staticmesh.batch", ValueInfo::INT }
             }
         }
     },
@@ -631,95 +1192,1315 @@ std::unordered_map<std::string_view, EntityComponentInfo> entityComponentInfo =
     },
 };
 
+/**
+ * Every property declared in `entityComponentInfo` gets a slot in the block of values each
+ * entity has in `SceneInfo::values`. Built and checked once, not per entity.
+ */
+struct SceneSchema
+{
+    std::unordered_map<std::string_view, uint32_t> slots;
+    std::vector<ValueInfo::Type> types;
+
+    SceneSchema()
+    {
+        for(const auto &[component, info] : entityComponentInfo)
+            for(const auto &[name, type] : info.info)
+            {
+                auto [slot, inserted] = slots.try_emplace(name, (uint32_t)types.size());
+                if(inserted) types.push_back(type);
+                else if(types[slot->second] != type)
+                    log::cerr << "Property '" << name << "' of '" << component << "' is declared with another type!" << log::endl;
+            }
+    }
+
+    static const SceneSchema &get()
+    {
+        static const SceneSchema schema;
+        return schema;
+    }
+
+    /** Returns UINT32_MAX if no component has the property. */
+    uint32_t find(std::string_view name) const
+    {
+        auto slot = slots.find(name);
+        return slot == slots.end() ? UINT32_MAX : slot->second;
+    }
+};
+
+const ValueInfo &EntityProperties::operator[](std::string_view name) const
+{
+    static const ValueInfo none;
+    auto slot = SceneSchema::get().find(name);
+    return slot == UINT32_MAX ? none : values[slot];
+}
+
+/** An entity of a scene file, its components and properties are ranges of the arrays in `SceneInfo`. */
+struct EntityInfo
+{
+    glm::vec3 position { 0, 0, 0 };
+    glm::quat rotation { 0, 1, 0, 0 };
+    glm::vec3 scale { 1, 1, 1 };
+    uint32_t firstComponent = 0, componentCount = 0;
+    uint32_t firstValue = 0;
+    /** Order independent hashes of the section's keys, of all of them and of all but the transform. */
+    uint64_t hash = 0, layoutHash = 0;
+};
+
+/**
+ * Header of a scene snapshot, a `SceneInfo` with the entities' current transforms (see `writeSnapshot`).
+ * The entities come first, then their components as indices into the types, then per type the entities
+ * having it and a block of their property values. Strings are indices into one table, the scene's name
+ * too. All values are in the saving machine's byte order, arrays start on 8 bytes.
+ */
+struct SnapshotHeader
+{
+    static constexpr uint32_t MAGIC = 0x53445253; // "SRDS"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic, version;
+    uint32_t entityCount, componentCount;
+    uint32_t typeCount, stringCount;
+    uint32_t name, reserved;
+    uint64_t entityOffset, componentOffset, typeOffset;
+    uint64_t stringOffset, textOffset, textSize;
+};
+
+struct SnapshotEntity
+{
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+    uint32_t firstComponent, componentCount;
+    uint64_t hash, layoutHash;
+};
+
+/**
+ * A component type with 'propertyCount' properties and 'count' instances: the entities at
+ * 'entityOffset' and 'count * propertyCount' values at 'valueOffset', one entity after another.
+ */
+struct SnapshotType
+{
+    uint32_t name, propertyCount;
+    uint32_t count, reserved;
+    uint64_t propertyOffset, entityOffset, valueOffset;
+};
+
+struct SnapshotProperty
+{
+    uint32_t name;
+    uint32_t type;
+};
+
+/** A `ValueInfo`, numbers are stored as they are in memory. */
+struct SnapshotValue
+{
+    uint32_t type;
+    union
+    {
+        float    numbers[4];
+        uint32_t string;
+    };
+};
+
+struct SnapshotString
+{
+    uint32_t offset, size;
+};
+
+/**
+ * A scene file parsed straight from its mapping. Nothing is allocated per entity: they are flat
+ * records, numbers are read with `from_chars` and strings are views into the file, which the
+ * scene info keeps. Sections other than [_info] and [glb] are entities.
+ */
+struct SceneInfo
+{
+    std::string name;
+    std::vector<EntityInfo> entities;
+    std::vector<CreateEntityComponentFunc> components;
+    /** `SceneSchema::types.size()` values per entity, missing ones are zeroed. */
+    std::vector<ValueInfo> values;
+
+    VirtualFile file;
+    /** Mesh names made up for the nodes of [glb] sections. */
+    std::deque<std::string> names;
+
+    /** Empty, see `readSnapshot`. */
+    SceneInfo() = default;
+
+    SceneInfo(const std::string &path, const ResourceManager &resourceManager)
+    {
+        if(!readVirtualFile(path, file))
+        {
+            log::cerr << "Could not read file at '" << path << "'!" << log::endl;
+            return;
+        }
+
+        const auto &schema = SceneSchema::get();
+        auto text = file.text();
+        // An upper bound, commented out sections are counted as well.
+        size_t sections = std::count(text.begin(), text.end(), '[');
+        entities.reserve(sections);
+        values.reserve(sections * schema.types.size());
+
+        enum { NoSection, InfoSection, EntitySection, GlbSection } kind = NoSection;
+        std::string_view glb;
+        int lineno = 0;
+        auto error = [&](const char *message, std::string_view line)
+        {
+            log::cerr << path << ':' << lineno << ": " << message << log::endl;
+            log::cerr << lineno << " | " << line << log::endl;
+        };
+        auto finishSection = [&]()
+        {
+            if(kind == GlbSection) addGlbNodes(glb, resourceManager);
+        };
+
+        for(size_t begin = 0; begin < text.size();)
+        {
+            size_t end = std::min(text.find('\n', begin), text.size());
+            auto line = trim(text.substr(begin, end - begin));
+            begin = end + 1;
+            ++lineno;
+
+            if(line.empty() || line[0] == ';') continue;
+            if(line[0] == '[')
+            {
+                if(line.back() != ']')
+                {
+                    error("Expected ending ']'", line);
+                    continue;
+                }
+                finishSection();
+                auto section = line.substr(1, line.size() - 2);
+                kind = section == "_info" ? InfoSection : section == "glb" ? GlbSection : EntitySection;
+                glb = {};
+                if(kind == InfoSection) continue;
+
+                auto &e = entities.emplace_back();
+                e.firstComponent = components.size();
+                e.firstValue = values.size();
+                values.resize(values.size() + schema.types.size());
+                continue;
+            }
+
+            auto equals = line.find('=');
+            if(equals == std::string_view::npos)
+            {
+                error("Bad format...", line);
+                continue;
+            }
+            auto key = trim(line.substr(0, equals)), value = trim(line.substr(equals + 1));
+            if(kind == NoSection)
+            {
+                error("Expected a section first", line);
+                continue;
+            }
+            if(kind == InfoSection)
+            {
+                if(key == "name") name = value;
+                continue;
+            }
+
+            auto &e = entities.back();
+            auto keyHash = ResourceId::hash(key) * 0x100000001b3ull + ResourceId::hash(value);
+            e.hash += keyHash;
+            bool ok = true;
+            if(key == "position") ok = parseNumbers(value, &e.position.x, 3);
+            else if(key == "rotation")
+            {
+                // Written as "x y z w".
+                float q[4];
+                ok = parseNumbers(value, q, 4);
+                if(ok) e.rotation = glm::quat(q[3], q[0], q[1], q[2]);
+            }
+            else if(key == "scale") ok = parseNumbers(value, &e.scale.x, 3);
+            else
+            {
+                e.layoutHash += keyHash;
+                if(key == "components") addComponents(e, value);
+                else if(kind == GlbSection && key == "glb") glb = value;
+                else if(auto slot = schema.find(key); slot != UINT32_MAX)
+                    ok = parseValue(schema.types[slot], value, values[e.firstValue + slot]);
+            }
+            if(!ok) error("Bad value", line);
+        }
+        finishSection();
+    }
+
+    EntityProperties properties(const EntityInfo &e) const { return { values.data() + e.firstValue }; }
+
+    /**
+     * Reads a snapshot written by `writeSnapshot`, nothing is parsed: the arrays are used from the
+     * file and strings become views into it. Components and properties are looked up once per type.
+     * Returns false if it is missing, from another version, truncated or made with other components.
+     */
+    bool readSnapshot(const std::string &path)
+    {
+        if(!readVirtualFile(path, file) || file.size < sizeof(SnapshotHeader)) return false;
+        auto fits = [this](uint64_t offset, uint64_t count, size_t size)
+        {
+            return offset % 8 == 0 && offset <= file.size && count <= (file.size - offset) / size;
+        };
+
+        auto header = (const SnapshotHeader*)file.data;
+        if(header->magic != SnapshotHeader::MAGIC || header->version != SnapshotHeader::VERSION
+            || !fits(header->entityOffset, header->entityCount, sizeof(SnapshotEntity))
+            || !fits(header->componentOffset, header->componentCount, sizeof(uint32_t))
+            || !fits(header->typeOffset, header->typeCount, sizeof(SnapshotType))
+            || !fits(header->stringOffset, header->stringCount, sizeof(SnapshotString))
+            || header->textOffset > file.size || header->textSize > file.size - header->textOffset
+            || header->name >= header->stringCount)
+            return false;
+
+        std::vector<std::string_view> strings(header->stringCount);
+        auto stringTable = (const SnapshotString*)(file.data + header->stringOffset);
+        auto text = (const char*)file.data + header->textOffset;
+        for(uint32_t i = 0; i < header->stringCount; ++i)
+        {
+            const auto &string = stringTable[i];
+            if(uint64_t(string.offset) + string.size > header->textSize) return false;
+            strings[i] = { text + string.offset, string.size };
+        }
+        name = strings[header->name];
+
+        const auto &schema = SceneSchema::get();
+        auto stride = schema.types.size();
+        auto snapshotEntities = (const SnapshotEntity*)(file.data + header->entityOffset);
+        entities.resize(header->entityCount);
+        for(uint32_t i = 0; i < header->entityCount; ++i)
+        {
+            const auto &from = snapshotEntities[i];
+            if(uint64_t(from.firstComponent) + from.componentCount > header->componentCount) return false;
+            entities[i] = {
+                .position = from.position, .rotation = from.rotation, .scale = from.scale,
+                .firstComponent = from.firstComponent, .componentCount = from.componentCount,
+                .firstValue = uint32_t(i * stride), .hash = from.hash, .layoutHash = from.layoutHash
+            };
+        }
+        values.assign(header->entityCount * stride, ValueInfo());
+
+        std::vector<CreateEntityComponentFunc> creates(header->typeCount);
+        auto types = (const SnapshotType*)(file.data + header->typeOffset);
+        for(uint32_t t = 0; t < header->typeCount; ++t)
+        {
+            const auto &type = types[t];
+            if(type.name >= header->stringCount
+                || !fits(type.propertyOffset, type.propertyCount, sizeof(SnapshotProperty))
+                || !fits(type.entityOffset, type.count, sizeof(uint32_t))
+                || !fits(type.valueOffset, uint64_t(type.count) * type.propertyCount, sizeof(SnapshotValue)))
+                return false;
+            auto info = entityComponentInfo.find(strings[type.name]);
+            if(info == entityComponentInfo.end())
+            {
+                log::cwrn << "Snapshot '" << path << "' has the unknown component '" << strings[type.name] << "'" << log::endl;
+                return false;
+            }
+            creates[t] = info->second.createFunc;
+
+            // Properties no component has any more are skipped, new ones stay zeroed.
+            auto properties = (const SnapshotProperty*)(file.data + type.propertyOffset);
+            std::vector<uint32_t> slots(type.propertyCount);
+            for(uint32_t p = 0; p < type.propertyCount; ++p)
+            {
+                if(properties[p].name >= header->stringCount) return false;
+                slots[p] = schema.find(strings[properties[p].name]);
+                if(slots[p] != UINT32_MAX && schema.types[slots[p]] != properties[p].type)
+                {
+                    log::cwrn << "Snapshot '" << path << "' has '" << strings[properties[p].name]
+                              << "' with another type" << log::endl;
+                    return false;
+                }
+            }
+
+            auto owners = (const uint32_t*)(file.data + type.entityOffset);
+            auto block = (const SnapshotValue*)(file.data + type.valueOffset);
+            for(uint32_t i = 0; i < type.count; ++i)
+            {
+                if(owners[i] >= header->entityCount) return false;
+                auto out = values.data() + entities[owners[i]].firstValue;
+                for(uint32_t p = 0; p < type.propertyCount; ++p)
+                {
+                    const auto &from = block[i * type.propertyCount + p];
+                    if(slots[p] == UINT32_MAX || from.type == ValueInfo::NONE) continue;
+                    if(from.type != properties[p].type) return false;
+                    auto &value = out[slots[p]];
+                    value.type = ValueInfo::Type(from.type);
+                    if(from.type != ValueInfo::STRING) std::memcpy(&value.valQuat, from.numbers, sizeof(from.numbers));
+                    else if(from.string < header->stringCount) value.valString = strings[from.string];
+                    else return false;
+                }
+            }
+        }
+
+        auto typeIndices = (const uint32_t*)(file.data + header->componentOffset);
+        components.resize(header->componentCount);
+        for(uint32_t i = 0; i < header->componentCount; ++i)
+        {
+            if(typeIndices[i] >= header->typeCount) return false;
+            components[i] = creates[typeIndices[i]];
+        }
+        return true;
+    }
+
+    /** Appends the components named in 'list', unknown ones are reported once. */
+    void addComponents(EntityInfo &e, std::string_view list)
+    {
+        static std::vector<std::string> unknown;
+        for(size_t begin = list.find_first_not_of(" \t"); begin != std::string_view::npos;)
+        {
+            size_t end = std::min(list.find_first_of(" \t", begin), list.size());
+            auto component = list.substr(begin, end - begin);
+            begin = list.find_first_not_of(" \t", end);
+
+            auto info = entityComponentInfo.find(component);
+            if(info != entityComponentInfo.end())
+            {
+                components.push_back(info->second.createFunc);
+                e.componentCount++;
+            }
+            else if(std::find(unknown.begin(), unknown.end(), component) == unknown.end())
+            {
+                log::cerr << "Unknown Entity Component: '" << component << "'!" << log::endl;
+                unknown.emplace_back(component);
+            }
+        }
+    }
+
+    /**
+     * A [glb] section places an entity for every mesh node of the .glb mesh resource named by 'glb'.
+     * The section's transform applies to the whole file, the other keys to every entity.
+     */
+    void addGlbNodes(std::string_view glb, const ResourceManager &resourceManager)
+    {
+        auto section = entities.back();
+        entities.pop_back();
+        auto nodes = resourceManager.glbNodes.find(std::string(glb));
+        if(nodes == resourceManager.glbNodes.end())
+        {
+            log::cerr << "No .glb mesh named '" << glb << "' was loaded!" << log::endl;
+            return;
+        }
+
+        const auto &schema = SceneSchema::get();
+        auto stride = schema.types.size();
+        auto meshSlot = schema.find("staticmesh.mesh");
+        core::math::transform root { .position = section.position, .rotation = section.rotation, .scale = section.scale };
+        root.update();
+
+        std::vector<std::string_view> meshNames;
+        for(const auto &node : nodes->second)
+        {
+            if(size_t(node.mesh) >= meshNames.size()) meshNames.resize(node.mesh + 1);
+            if(meshNames[node.mesh].empty())
+                meshNames[node.mesh] = names.emplace_back(std::string(glb) + "/" + std::to_string(node.mesh));
+
+            auto &e = entities.emplace_back(section);
+            e.firstValue = values.size();
+            values.resize(values.size() + stride);
+            std::copy_n(values.begin() + section.firstValue, stride, values.begin() + e.firstValue);
+            values[e.firstValue + meshSlot].type = ValueInfo::STRING;
+            values[e.firstValue + meshSlot].valString = meshNames[node.mesh];
+            e.hash += ResourceId::hash(meshNames[node.mesh]);
+            e.layoutHash += ResourceId::hash(meshNames[node.mesh]);
+
+            core::math::transform local { .position = node.position, .rotation = node.rotation, .scale = node.scale };
+            local.update();
+            decomposeTransform(root.matrix * local.matrix, e.position, e.rotation, e.scale);
+        }
+    }
+
+    static std::string_view trim(std::string_view text)
+    {
+        auto space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+        while(!text.empty() && space(text.front())) text.remove_prefix(1);
+        while(!text.empty() && space(text.back())) text.remove_suffix(1);
+        return text;
+    }
+
+    /** Reads 'count' numbers separated by spaces, fails if there are fewer or anything follows. */
+    template<typename T>
+    static bool parseNumbers(std::string_view text, T *out, int count)
+    {
+        const char *p = text.data(), *end = p + text.size();
+        for(int i = 0; i < count; ++i)
+        {
+            while(p < end && (*p == ' ' || *p == '\t')) ++p;
+            if(p < end && *p == '+') ++p;
+            auto result = std::from_chars(p, end, out[i]);
+            if(result.ec != std::errc()) return false;
+            p = result.ptr;
+        }
+        return trim({ p, size_t(end - p) }).empty();
+    }
+
+    static bool parseValue(ValueInfo::Type type, std::string_view text, ValueInfo &value)
+    {
+        value.type = type;
+        switch(type)
+        {
+        case ValueInfo::STRING: value.valString = text; return true;
+        case ValueInfo::VEC3  : return parseNumbers(text, &value.valVec3.x, 3);
+        case ValueInfo::VEC2  : return parseNumbers(text, &value.valVec2.x, 2);
+        case ValueInfo::QUAT  :
+        {
+            float q[4];
+            if(!parseNumbers(text, q, 4)) return false;
+            value.valQuat = glm::quat(q[3], q[0], q[1], q[2]);
+            return true;
+        }
+        case ValueInfo::FLOAT : return parseNumbers(text, &value.valFloat, 1);
+        case ValueInfo::INT   : return parseNumbers(text, &value.valInt, 1);
+        default: log::cerr << "Internal error: Bad prop type: " << type << log::endl; return false;
+        }
+    }
+};
+
+/** Creates an entity and its components as described by 'einfo'. */
+Entity *createEntity(const SceneInfo &scene, const EntityInfo &einfo, ResourceManager &resourceManager)
+{
+    auto e = new Entity();
+    e->transform.position = einfo.position;
+    e->transform.rotation = einfo.rotation;
+    e->transform.scale = einfo.scale;
+    e->transform.update();
+    auto properties = scene.properties(einfo);
+    for(uint32_t i = 0; i < einfo.componentCount; ++i)
+        e->add(scene.components[einfo.firstComponent + i](e, resourceManager, properties));
+    return e;
+}
+
+/**
+ * Writes 'scene' as a snapshot (see `SnapshotHeader`), with 'entities' instead of its own so that the
+ * transforms can be the current ones. Written next to 'path' and renamed, so a snapshot is never half written.
+ */
+bool writeSnapshot(const std::string &path, const SceneInfo &scene, const std::vector<EntityInfo> &entities)
+{
+    std::unordered_map<std::string_view, uint32_t> stringIds;
+    std::vector<SnapshotString> strings;
+    std::string text;
+    auto intern = [&](std::string_view string)
+    {
+        auto [id, inserted] = stringIds.try_emplace(string, (uint32_t)strings.size());
+        if(inserted)
+        {
+            strings.push_back({ (uint32_t)text.size(), (uint32_t)string.size() });
+            text += string;
+        }
+        return id->second;
+    };
+
+    struct Type
+    {
+        SnapshotType header {};
+        std::vector<SnapshotProperty> properties;
+        std::vector<uint32_t> slots, entities;
+        std::vector<SnapshotValue> values;
+    };
+    const auto &schema = SceneSchema::get();
+    std::vector<Type> types;
+    std::unordered_map<CreateEntityComponentFunc, uint32_t> typeIds;
+    std::vector<uint32_t> components;
+    components.reserve(scene.components.size());
+    for(auto create : scene.components)
+    {
+        auto [id, inserted] = typeIds.try_emplace(create, (uint32_t)types.size());
+        components.push_back(id->second);
+        if(!inserted) continue;
+
+        auto &type = types.emplace_back();
+        for(const auto &[component, info] : entityComponentInfo)
+        {
+            if(info.createFunc != create) continue;
+            type.header.name = intern(component);
+            for(const auto &[property, propertyType] : info.info)
+            {
+                type.properties.push_back({ intern(property), propertyType });
+                type.slots.push_back(schema.find(property));
+            }
+        }
+    }
+
+    std::vector<SnapshotEntity> records;
+    records.reserve(entities.size());
+    for(uint32_t i = 0; i < entities.size(); ++i)
+    {
+        const auto &e = entities[i];
+        records.push_back({ e.position, e.rotation, e.scale, e.firstComponent, e.componentCount, e.hash, e.layoutHash });
+        for(uint32_t c = 0; c < e.componentCount; ++c)
+        {
+            auto &type = types[components[e.firstComponent + c]];
+            type.entities.push_back(i);
+            for(auto slot : type.slots)
+            {
+                const auto &value = scene.values[e.firstValue + slot];
+                auto &out = type.values.emplace_back();
+                out.type = value.type;
+                if(value.type == ValueInfo::STRING) out.string = intern(value.valString);
+                else std::memcpy(out.numbers, &value.valQuat, sizeof(out.numbers));
+            }
+        }
+    }
+
+    SnapshotHeader header {};
+    header.magic = SnapshotHeader::MAGIC;
+    header.version = SnapshotHeader::VERSION;
+    header.name = intern(scene.name);
+
+    std::string data(sizeof(header), '\0');
+    auto append = [&data](const void *bytes, size_t size)
+    {
+        data.resize((data.size() + 7) & ~size_t(7));
+        uint64_t offset = data.size();
+        if(size) data.append((const char*)bytes, size);
+        return offset;
+    };
+    auto appendArray = [&append](const auto &array)
+    {
+        return append(array.data(), array.size() * sizeof(array[0]));
+    };
+
+    header.entityCount = records.size();
+    header.entityOffset = appendArray(records);
+    header.componentCount = components.size();
+    header.componentOffset = appendArray(components);
+    for(auto &type : types)
+    {
+        type.header.propertyCount = type.properties.size();
+        type.header.count = type.entities.size();
+        type.header.propertyOffset = appendArray(type.properties);
+        type.header.entityOffset = appendArray(type.entities);
+        type.header.valueOffset = appendArray(type.values);
+    }
+    std::vector<SnapshotType> typeHeaders;
+    for(const auto &type : types) typeHeaders.push_back(type.header);
+    header.typeCount = typeHeaders.size();
+    header.typeOffset = appendArray(typeHeaders);
+    header.stringCount = strings.size();
+    header.stringOffset = appendArray(strings);
+    header.textSize = text.size();
+    header.textOffset = append(text.data(), text.size());
+    std::memcpy(data.data(), &header, sizeof(header));
+
+    std::error_code error;
+    auto directory = std::filesystem::path(path).parent_path();
+    if(!directory.empty()) std::filesystem::create_directories(directory, error);
+    error.clear();
+    auto temporary = path + ".tmp";
+    std::ofstream ofs(temporary, std::ios::binary);
+    ofs.write(data.data(), data.size());
+    ofs.close();
+    if(ofs) std::filesystem::rename(temporary, path, error);
+    if(!ofs || error)
+    {
+        log::cerr << "Could not write snapshot '" << path << "'!" << log::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Streams a scene in square cells on the XZ plane (see `[world] streamCellSize`), only the entities of
+ * cells near the camera exist. A cell is loaded within 'loadRadius' of the camera and kept until it is
+ * farther than 'unloadRadius', so that moving along its border does not load and unload it every frame.
+ * A loading cell references the meshes and textures of its entities first, which requests evicted ones
+ * from the loader, and its entities are created once they are resident, under 'budget' per frame.
+ * Rigid bodies are registered with their entities, so only for the loaded cells.
+ */
+struct SceneStreamer
+{
+    struct Cell
+    {
+        enum State { Unloaded, Loading, Active } state = Unloaded;
+        glm::ivec2 coord;
+        /** Indices into `SceneInfo::entities` and `Scene::entities`. */
+        std::vector<uint32_t> entities;
+        /** Held while the cell is loaded, so that its resources are loaded before and stay resident. */
+        std::vector<ResourceHandle<core::gfx::mesh>> meshes;
+        std::vector<ResourceHandle<core::gfx::texture>> textures;
+    };
+
+    /** Streaming is off while it is 0. */
+    float cellSize = 0;
+    float loadRadius = 0, unloadRadius = 0;
+    /** Seconds per frame spent creating entities, at least one is created. */
+    float budget = 0;
+    std::vector<Cell> cells;
+
+    /** Seconds the main thread spent streaming in the last frames, see `record`. */
+    std::array<float, 128> stalls {};
+    size_t frame = 0;
+    float maxStall = 0;
+    size_t loadedEntities = 0;
+
+    explicit operator bool() const { return cellSize > 0; }
+
+    glm::ivec2 cellOf(const glm::vec3 &position) const
+    {
+        return glm::ivec2(glm::floor(glm::vec2(position.x, position.z) / cellSize));
+    }
+
+    /** Distance on the XZ plane from 'position' to the closest point of the cell. */
+    float distance(const Cell &cell, const glm::vec3 &position) const
+    {
+        glm::vec2 min = glm::vec2(cell.coord) * cellSize, point(position.x, position.z);
+        return glm::length(point - glm::clamp(point, min, min + cellSize));
+    }
+
+    /**
+     * Sorts the entities of 'info' into cells, e.g. after the scene was reloaded. Cells which were
+     * loaded are loaded again, so that entities which are new or moved into them are created. Entities
+     * in cells which are not loaded are deleted, returns whether there were any.
+     */
+    bool partition(Scene &scene, const SceneInfo &info, ResourceManager &resourceManager)
+    {
+        auto key = [](glm::ivec2 coord) { return (uint64_t(uint32_t(coord.x)) << 32) | uint32_t(coord.y); };
+        std::vector<Cell> previous = std::move(cells);
+        cells.clear();
+        std::unordered_map<uint64_t, uint32_t> indices;
+        for(uint32_t i = 0; i < info.entities.size(); ++i)
+        {
+            auto coord = cellOf(info.entities[i].position);
+            auto [index, inserted] = indices.try_emplace(key(coord), (uint32_t)cells.size());
+            if(inserted) cells.push_back({ .coord = coord });
+            cells[index->second].entities.push_back(i);
+        }
+
+        for(auto &old : previous)
+        {
+            auto index = indices.find(key(old.coord));
+            if(old.state != Cell::Unloaded && index != indices.end()) request(cells[index->second], info, resourceManager);
+            release(old, resourceManager);
+        }
+
+        bool deleted = false;
+        for(auto &cell : cells)
+            if(cell.state == Cell::Unloaded) deleted |= unload(cell, scene, resourceManager);
+        loadedEntities = std::count_if(scene.entities.begin(), scene.entities.end(), [](const auto &e) { return e != nullptr; });
+        return deleted;
+    }
+
+    /** References the resources of the cell's entities, evicted ones are requested from the loader. */
+    void request(Cell &cell, const SceneInfo &info, ResourceManager &resourceManager)
+    {
+        cell.state = Cell::Loading;
+        for(auto i : cell.entities)
+        {
+            auto properties = info.properties(info.entities[i]);
+            if(auto mesh = properties["staticmesh.mesh"].valString; !mesh.empty())
+                cell.meshes.push_back(resourceManager.meshes.acquire(mesh));
+            if(auto texture = properties["staticmesh.texture"].valString; !texture.empty())
+                cell.textures.push_back(resourceManager.textures.acquire(texture));
+            ECStaticMesh::forEachTexture(properties, [&](std::string_view name)
+            {
+                cell.textures.push_back(resourceManager.textures.acquire(name));
+            });
+        }
+    }
+
+    void release(Cell &cell, ResourceManager &resourceManager)
+    {
+        for(auto handle : cell.meshes) resourceManager.meshes.release(handle);
+        for(auto handle : cell.textures) resourceManager.textures.release(handle);
+        cell.meshes.clear();
+        cell.textures.clear();
+    }
+
+    /** Whether the resources of a loading cell are resident, unknown ones are not waited for. */
+    bool resident(const Cell &cell, const ResourceManager &resourceManager) const
+    {
+        for(auto handle : cell.meshes) if(handle && !resourceManager.meshes.get(handle)) return false;
+        for(auto handle : cell.textures) if(handle && !resourceManager.textures.get(handle)) return false;
+        return true;
+    }
+
+    /** Deletes the cell's entities at once, which unregisters their bodies, returns whether there were any. */
+    bool unload(Cell &cell, Scene &scene, ResourceManager &resourceManager)
+    {
+        bool deleted = false;
+        for(auto i : cell.entities)
+        {
+            if(!scene.entities[i]) continue;
+            scene.entities[i].reset();
+            loadedEntities--;
+            deleted = true;
+        }
+        release(cell, resourceManager);
+        cell.state = Cell::Unloaded;
+        return deleted;
+    }
+
+    struct Changes
+    {
+        /** Entities were created or deleted, `Scene::start` has to run again. */
+        bool entities = false;
+        /** Cells finished loading or were unloaded, static batches have to be built again. */
+        bool cells = false;
+    };
+
+    /**
+     * Loads and unloads cells around 'position'. Unloading cells are deleted at once, the static
+     * batches may refer to them. Loading cells are created nearest first until the budget is spent.
+     */
+    Changes update(const glm::vec3 &position, Scene &scene, const SceneInfo &info, ResourceManager &resourceManager)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto elapsed = [&]() { return std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count(); };
+
+        Changes changes;
+        std::vector<std::pair<float, Cell*>> loading;
+        for(auto &cell : cells)
+        {
+            float d = distance(cell, position);
+            if(cell.state == Cell::Unloaded && d <= loadRadius) request(cell, info, resourceManager);
+            else if(cell.state != Cell::Unloaded && d > unloadRadius)
+            {
+                changes.entities |= unload(cell, scene, resourceManager);
+                changes.cells = true;
+            }
+            if(cell.state == Cell::Loading) loading.push_back({ d, &cell });
+        }
+
+        std::sort(loading.begin(), loading.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        bool created = false;
+        for(auto [d, cell] : loading)
+        {
+            if(!resident(*cell, resourceManager)) continue;
+            for(auto i : cell->entities)
+            {
+                if(scene.entities[i]) continue;
+                if(created && elapsed() > budget) return changes;
+                scene.entities[i].reset(createEntity(info, info.entities[i], resourceManager));
+                loadedEntities++;
+                changes.entities = created = true;
+            }
+            cell->state = Cell::Active;
+            changes.cells = true;
+        }
+        return changes;
+    }
+
+    /** Adds the seconds a frame spent streaming to the history shown by the GUI. */
+    void record(float seconds)
+    {
+        stalls[frame++ % stalls.size()] = seconds;
+        maxStall = std::max(maxStall, seconds);
+    }
+
+    size_t count(Cell::State state) const
+    {
+        return std::count_if(cells.begin(), cells.end(), [state](const Cell &cell) { return cell.state == state; });
+    }
+};
+
+/** Container for to-be loaded resources. */
+/**
+ * Decodes resources on the job system, decoded resources are queued and
+ * uploaded on the GL thread by `upload` under a time budget per frame.
+ */
+struct ResourceLoader
+{
+    using ResourceLoadMap = std::unordered_map<std::string, std::string>;
+
+    /** Sources of a shader, 'create' compiles them on the GL thread. */
+    struct ShaderSource
+    {
+        std::string vertex, fragment;
+        std::function<core::gfx::shader*(const std::string &vertex, const std::string &fragment)> create;
+    };
+
+    /** The faces are read from prefix + (px, nx, py, ny, pz, nz) + suffix. */
+    struct CubemapSource
+    {
+        std::string prefix, suffix;
+
+        std::string face(int i) const
+        {
+            static const char *faces[6] = { "px", "nx", "py", "ny", "pz", "nz" };
+            return prefix + faces[i] + suffix;
+        }
+    };
+
+    /**
+     * A decoded resource, 'upload' creates its GL objects and frees the decoded data. It returns
+     * false when the upload was handed to the upload context, which finishes it in 'ready'.
+     */
+    struct Decoded
+    {
+        std::string name;
+        std::function<bool(ResourceManager&)> upload;
+    };
+
+    ResourceLoadMap meshes;
+    ResourceLoadMap textures;
+    std::unordered_map<std::string, ShaderSource> shaders;
+    std::unordered_map<std::string, CubemapSource> cubemaps;
+
+    int count = 0;
+    int uploadedCount = 0;
+    /** Name of the last uploaded resource. */
+    std::string current = "";
+
+    std::vector<std::unique_ptr<core::jobs::job>> decodeJobs;
+    /** Set once everything from `beforeLoader` is uploaded, later uploads are reloads. */
+    bool loaded = false;
+    /** Submitted shaders whose programs are not resolved yet. */
+    std::vector<std::pair<std::string, core::gfx::shader*>> compiling;
+    std::mutex decodedMutex;
+    std::deque<Decoded> decoded;
+
+    /** Directory of cooked meshes (see `loadCookedMesh`), OBJ files are parsed on every launch if empty. */
+    std::string meshCache = "";
+    /** Builds a triangle BVH for every mesh while decoding, see `core::gfx::mesh::bvh`. */
+    bool meshBVH = false;
+
+    /** Textures and cubemaps are uploaded here if set, see `[render] uploadContext`. */
+    core::gfx::upload_context *uploadContext = nullptr;
+
+    std::chrono::steady_clock::time_point started;
+    float uploadTime = 0;
+    /** Time the GL thread spent uploading during the last frame, and the worst frame so far. */
+    float frameHitch = 0, maxHitch = 0;
+
+#if SRD_HOT_RELOAD
+    /** A resource read from a watched file, see `hotReload`. */
+    struct WatchedResource
+    {
+        enum Kind { Mesh, Texture, Shader, Cubemap } kind;
+        std::string name;
+    };
+
+    FileWatcher watcher;
+    /** Resources by the `packPath` of the files they are read from. */
+    std::unordered_map<std::string, std::vector<WatchedResource>> watched;
+    /** Resources being hot reloaded by name, with their kind and when the change was noticed. */
+    std::unordered_map<std::string, std::pair<WatchedResource::Kind, std::chrono::steady_clock::time_point>> hotReloading;
+    /** Time from noticing a change to the reloaded resource being usable, for the last hot reload. */
+    float reloadLatency = 0;
+    std::string lastReloaded = "";
+    /** Set once a mesh was hot reloaded, static batches keep copies of the geometry they merged. */
+    bool meshesReloaded = false;
+#endif
+
+    ~ResourceLoader()
+    {
+        for(auto &j : decodeJobs) core::jobs::wait(*j);
+    }
+
+    /** Counts the resources and starts decoding them. */
+    void beforeLoader()
+    {
+        count = meshes.size() + textures.size() + shaders.size() + cubemaps.size();
+        started = std::chrono::steady_clock::now();
+
+        // Shaders go first, so that the driver compiles them while everything else loads.
+        for(const auto &[name, source] : shaders) loadShader(name, source);
+        for(const auto &[name, path] : meshes) loadMesh(name, path);
+        for(const auto &[name, path] : textures) loadTexture(name, path);
+        for(const auto &[name, source] : cubemaps) loadCubemap(name, source);
+    }
+
+    /**
+     * Decodes the evicted resources that were acquired again (see `ResourcePool::acquire`),
+     * `upload` then uploads them like everything else.
+     */
+    void reload(ResourceManager &rm)
+    {
+        std::vector<std::string> files;
+        for(const auto &name : std::exchange(rm.meshes.requests, {}))
+        {
+            // Meshes of a .glb file are called '<file>/<i>', the whole file is decoded again.
+            auto source = meshes.find(name);
+            if(source == meshes.end()) source = meshes.find(name.substr(0, name.rfind('/')));
+            if(source == meshes.end() || std::find(files.begin(), files.end(), source->first) != files.end()) continue;
+            files.push_back(source->first);
+            log::cout << "Reloading mesh '" << name << "'" << log::endl;
+            count++;
+            loadMesh(source->first, source->second);
+        }
+        for(const auto &name : std::exchange(rm.textures.requests, {}))
+        {
+            log::cout << "Reloading texture '" << name << "'" << log::endl;
+            count++;
+            loadTexture(name, textures.at(name));
+        }
+        for(const auto &name : std::exchange(rm.cubemaps.requests, {}))
+        {
+            log::cout << "Reloading cubemap '" << name << "'" << log::endl;
+            count++;
+            loadCubemap(name, cubemaps.at(name));
+        }
+    }
+
+#if SRD_HOT_RELOAD
+    /** Starts watching the files of every resource, see `hotReload`. */
+    void watch()
+    {
+        auto add = [this](const std::string &path, WatchedResource::Kind kind, const std::string &name)
+        {
+            watcher.watch(path);
+            watched[packPath(path)].push_back({ kind, name });
+        };
+        for(const auto &[name, path] : meshes) add(path, WatchedResource::Mesh, name);
+        for(const auto &[name, path] : textures) add(path, WatchedResource::Texture, name);
+        for(const auto &[name, source] : shaders)
+        {
+            add(source.vertex, WatchedResource::Shader, name);
+            add(source.fragment, WatchedResource::Shader, name);
+        }
+        for(const auto &[name, source] : cubemaps)
+            for(int i = 0; i < 6; ++i) add(source.face(i), WatchedResource::Cubemap, name);
+        log::cout << "Watching " << watcher.files.size() << " files for hot reloading" << log::endl;
+    }
+
+    /**
+     * Decodes the resources whose files changed again, `upload` then replaces them in place so
+     * that their handles and pointers stay valid. Returns the changed files which are no
+     * resources, e.g. a scene watched through 'watcher', for the caller to handle.
+     */
+    std::vector<std::string> hotReload()
+    {
+        std::vector<std::string> others;
+        std::vector<const WatchedResource*> reloads;
+        for(const auto &path : watcher.poll())
+        {
+            auto resources = watched.find(path);
+            if(resources == watched.end())
+            {
+                others.push_back(path);
+                continue;
+            }
+            log::cout << "'" << path << "' changed" << log::endl;
+            // A shader whose two files were saved together is only compiled once.
+            for(const auto &resource : resources->second)
+                if(std::none_of(reloads.begin(), reloads.end(), [&](auto r) { return r->kind == resource.kind && r->name == resource.name; }))
+                    reloads.push_back(&resource);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for(auto resource : reloads)
+        {
+            // Still measured from the first change if an earlier reload is in flight.
+            hotReloading.try_emplace(resource->name, resource->kind, now);
+            count++;
+            switch(resource->kind)
+            {
+            case WatchedResource::Mesh:    loadMesh(resource->name, meshes.at(resource->name)); break;
+            case WatchedResource::Texture: loadTexture(resource->name, textures.at(resource->name)); break;
+            case WatchedResource::Shader:  loadShader(resource->name, shaders.at(resource->name)); break;
+            case WatchedResource::Cubemap: loadCubemap(resource->name, cubemaps.at(resource->name)); break;
+            }
+        }
+        return others;
+    }
+#endif
+
+    void loadShader(const std::string &name, const ShaderSource &source)
+    {
+        decode([this, name = name, source = source]()
+        {
+            auto vertex = readFile(source.vertex.c_str());
+            auto fragment = readFile(source.fragment.c_str());
+            return Decoded { name, [this, name, create = source.create, vertex, fragment](ResourceManager &rm)
+            {
+                // Only submitted, 'upload' resolves it once the driver is done compiling. A reloaded
+                // shader is not stored, the resident one adopts its program instead.
+                auto shader = create(vertex, fragment);
+                if(!rm.shaders[name]) rm.shaders.set(name, shader);
+                compiling.push_back({ name, shader });
+                return false;
+            }};
+        });
+    }
+
+    void loadMesh(const std::string &name, const std::string &path)
+    {
+        if(std::filesystem::path(path).extension() == ".glb")
+        {
+            decode([name = name, path = path, bvh = meshBVH]() { return decodeGlb(name, path, bvh); });
+            return;
+        }
+
+        if(!meshCache.empty())
+        {
+            decode([this, name = name, path = path]()
+            {
+                auto cooked = std::make_shared<CookedMesh>();
+                if(!loadCookedMesh(path, meshCache, *cooked))
+                {
+                    log::cwrn << "Could not cook '" << path << "', loading the OBJ file instead" << log::endl;
+                    return decodeObj(name, path, meshBVH);
+                }
+
+                std::shared_ptr<const core::math::triangle_bvh> bvh;
+                if(meshBVH)
+                    bvh = std::make_shared<core::math::triangle_bvh>(cooked->positions, cooked->positionIndices, cooked->header->indexCount);
+                return Decoded { name, [name, cooked, bvh](ResourceManager &rm)
+                {
+                    // The arena uploads straight from the mapping, nothing is copied on our side.
+                    auto begin = std::chrono::steady_clock::now();
+                    const auto &h = *cooked->header;
+                    auto mesh = new core::gfx::mesh{ rm.meshArena,
+                        cooked->vertices, h.vertexCount, cooked->indices, h.indexCount,
+                        cooked->positions, h.positionCount, cooked->positionIndices, cooked->bounds(), cooked->submeshes() };
+                    mesh->bvh = bvh;
+                    rm.store(name, mesh);
+                    log::cout << "Uploaded cooked mesh '" << name << "' in " << std::chrono::duration<float, std::micro>(
+                        std::chrono::steady_clock::now() - begin).count() << "us" << log::endl;
+                    return true;
+                }};
+            });
+            return;
+        }
+
+        decode([name = name, path = path, bvh = meshBVH]() { return decodeObj(name, path, bvh); });
+    }
+
+    void loadTexture(const std::string &name, const std::string &path)
+    {
+        decode([this, name = name, path = path]()
+        {
+            auto data = readTexture(path);
+            return Decoded { name, [this, name, data](ResourceManager &rm)
+            {
+                if(!uploadContext)
+                {
+                    rm.store(name, new core::gfx::texture{ data });
+                    deleteTexture(data);
+                    return true;
+                }
+
+                auto texture = std::make_shared<core::gfx::texture*>(nullptr);
+                uploadContext->submit([this, data, texture]()
+                {
+                    *texture = new core::gfx::texture{ uploadContext->stage({ data })[0] };
+                    deleteTexture(data);
+                }, [this, &rm, name, texture]()
+                {
+                    rm.store(name, *texture);
+                    finished(name);
+                }, [data]() { deleteTexture(data); });
+                return false;
+            }};
+        });
+    }
+
+    void loadCubemap(const std::string &name, const CubemapSource &source)
+    {
+        decode([this, name = name, source = source]()
+        {
+            std::array<core::gfx::texture::data, 6> data;
+            core::jobs::parallel_for(0, 6, [&](size_t first, size_t last)
+            {
+                for(size_t i = first; i < last; ++i)
+                    data[i] = readTexture(source.face(i), true);
+            });
+            return Decoded { name, [this, name, data](ResourceManager &rm)
+            {
+                if(!uploadContext)
+                {
+                    rm.store(name, new core::gfx::cubemap{ data[0], data[1], data[2], data[3], data[4], data[5] });
+                    for(const auto &face : data) deleteTexture(face);
+                    return true;
+                }
 
-struct EntityInfo
-{
-    glm::vec3 position;
-    glm::quat rotation;
-    glm::vec3 scale;
-    std::vector<CreateEntityComponentFunc> components;
-    std::unordered_map<std::string, ValueInfo> info;
+                auto cubemap = std::make_shared<core::gfx::cubemap*>(nullptr);
+                uploadContext->submit([this, data, cubemap]()
+                {
+                    auto f = uploadContext->stage({ data.begin(), data.end() });
+                    *cubemap = new core::gfx::cubemap{ f[0], f[1], f[2], f[3], f[4], f[5] };
+                    for(const auto &face : data) deleteTexture(face);
+                }, [this, &rm, name, cubemap]()
+                {
+                    rm.store(name, *cubemap);
+                    finished(name);
+                }, [data]() { for(const auto &face : data) deleteTexture(face); });
+                return false;
+            }};
+        });
+    }
 
-    EntityInfo(MultiIni::Section &section)
+    /** Parses an OBJ file, along with a triangle BVH of it if 'bvh' is set. */
+    static Decoded decodeObj(const std::string &name, const std::string &path, bool bvh)
     {
-        for(const auto &kv : section)
+        std::vector<core::gfx::vertex> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<core::gfx::submesh> submeshes;
+        readMesh(path.c_str(), vertices, indices, &submeshes);
+        std::shared_ptr<const core::math::triangle_bvh> triangles;
+        if(bvh)
         {
-            std::cout << "Entity Section '" << kv.first << "' -> '" << kv.second << "'" << std::endl;
+            std::vector<glm::vec3> positions(vertices.size());
+            for(size_t i = 0; i < vertices.size(); ++i) positions[i] = vertices[i].position;
+            triangles = std::make_shared<core::math::triangle_bvh>(positions.data(), indices.data(), indices.size());
         }
-
-        position = stringToVec3(getOrDefault(section, std::string("position"), std::string("0 0 0")));
-        rotation = stringToQuat(getOrDefault(section, std::string("rotation"), std::string("1 0 0 0")));
-        scale = stringToVec3(getOrDefault(section, std::string("scale"), std::string("1 1 1")));
-
-        std::cout << "EntityInfo:"
-            << "\n  position: " << vectorToString(position)
-            << "\n  rotation: " << vectorToString(rotation)
-            << "\n  scale   : " << vectorToString( scale  ) << std::endl;
-
-        std::cout << "Components: " << section["components"] << std::endl; 
-        std::istringstream components(section["components"]);
-        for(std::string component; components >> component;)
+        // Meshes stay on the GL thread, the arena's VAOs are not shared and it may grow.
+        return Decoded { name, [name, vertices = std::move(vertices), indices = std::move(indices),
+                                submeshes = std::move(submeshes), triangles](ResourceManager &rm)
         {
-            if(entityComponentInfo.find(component) == entityComponentInfo.end())
-                log::cerr << "Unknown Entity Component: '" << component << "'!" << log::endl;
+            auto mesh = new core::gfx::mesh{ rm.meshArena, vertices, indices, submeshes };
+            mesh->bvh = triangles;
+            rm.store(name, mesh);
+            return true;
+        }};
+    }
 
-            // Nice thing about the error above and this ──────────┐
-            // Missing comp. types are reported only once.         │
-            //                                        vvvvvvvvvvv──┘
-            for(auto &prop : entityComponentInfo[component].info)
+    /**
+     * Mesh 'i' of the file becomes the mesh '<name>/<i>', its nodes are kept for the scene.
+     * Buffer views that already match the arena's layout are uploaded straight from the mapping,
+     * the positions are welded for the depth passes like those of OBJ meshes.
+     */
+    static Decoded decodeGlb(const std::string &name, const std::string &path, bool bvh)
+    {
+        struct Welded { std::vector<glm::vec3> positions; std::vector<unsigned int> indices; };
+        auto glb = std::make_shared<GlbFile>();
+        auto glbMeshes = std::make_shared<std::vector<GlbMesh>>();
+        auto welded = std::make_shared<std::vector<Welded>>();
+        std::vector<std::shared_ptr<const core::math::triangle_bvh>> bvhs;
+        std::vector<GlbNode> nodes;
+        if(readGlb(path, *glb))
+        {
+            glbMeshes->resize(glb->json["meshes"].size());
+            welded->resize(glbMeshes->size());
+            bvhs.resize(glbMeshes->size());
+            core::jobs::parallel_for(0, glbMeshes->size(), [&](size_t first, size_t last)
             {
-                switch(prop.second)
+                for(size_t i = first; i < last; ++i)
                 {
-                case ValueInfo::STRING: info[prop.first].valString = new std::string(section[prop.first]); break;
-                case ValueInfo::VEC3  : info[prop.first].valVec3   = stringToVec3 (section[prop.first]); break;
-                case ValueInfo::VEC2  : info[prop.first].valVec2   = stringToVec2 (section[prop.first]); break;
-                case ValueInfo::QUAT  : info[prop.first].valQuat   = stringToQuat (section[prop.first]); break;
-                case ValueInfo::FLOAT : info[prop.first].valFloat  = stringToFloat(section[prop.first]); break;
-                case ValueInfo::INT   : info[prop.first].valInt    = stringToInt  (section[prop.first]); break;
-                default: log::cerr << "Internal error: Bad prop type: " << prop.second << log::endl; break;
+                    auto &m = (*glbMeshes)[i];
+                    auto &w = (*welded)[i];
+                    if(!readGlbMesh(*glb, i, m))
+                    {
+                        log::cerr << "Could not read mesh " << i << " of '" << path << "'!" << log::endl;
+                        continue;
+                    }
+                    core::gfx::mesh::weld(m.positions, m.vertexCount, m.indices, m.indexCount, w.positions, w.indices);
+                    if(bvh && m.vertexCount)
+                        bvhs[i] = std::make_shared<core::math::triangle_bvh>(w.positions.data(), w.indices.data(), w.indices.size());
                 }
-            }
-
-            this->components.push_back(entityComponentInfo[component].createFunc);
+            });
+            readGlbNodes(*glb, nodes);
         }
+
+        return Decoded { name, [name, glb, glbMeshes, welded, bvhs = std::move(bvhs), nodes = std::move(nodes)](ResourceManager &rm)
+        {
+            for(size_t i = 0; i < glbMeshes->size(); ++i)
+            {
+                const auto &m = (*glbMeshes)[i];
+                const auto &w = (*welded)[i];
+                if(!m.vertexCount) continue;
+                auto mesh = new core::gfx::mesh{ rm.meshArena,
+                    m.vertices, m.vertexCount, m.indices, m.indexCount,
+                    w.positions.data(), w.positions.size(), w.indices.data(), m.bounds, m.submeshes };
+                mesh->bvh = bvhs[i];
+                rm.store(name + "/" + std::to_string(i), mesh);
+            }
+            rm.glbNodes[name] = nodes;
+            return true;
+        }};
     }
-};
 
-struct SceneInfo
-{
-    std::vector<EntityInfo> entities;
-    std::string name;
+    /** Runs 'f' as a job, the resource it returns is queued for uploading. */
+    template<typename F>
+    void decode(F &&f)
+    {
+        auto &j = decodeJobs.emplace_back(new core::jobs::job);
+        j->work = [this, f = std::forward<F>(f)]()
+        {
+            auto resource = f();
+            std::lock_guard lock(decodedMutex);
+            decoded.push_back(std::move(resource));
+        };
+        core::jobs::run(*j);
+    }
 
-    SceneInfo(MultiIni &c)
+    /** Uploads decoded resources until 'budget' seconds have passed, returns whether everything is loaded. */
+    bool upload(ResourceManager &resourceManager, float budget)
     {
-        log::cout << "SceneInfo ctor:" << log::endl;
-        name = c.getString("_info", "name");
-        log::cout << "name = '" << name << '\'' << log::endl;
-        bool shouldCheckInfo = true; /* Tiny optimization... */
-        for(auto &section : c.sections)
+        auto begin = std::chrono::steady_clock::now();
+        auto elapsed = [&]() { return std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count(); };
+
+        if(uploadContext) uploadContext->poll();
+        std::erase_if(compiling, [&](const auto &pending)
+        {
+            if(!pending.second->ready()) return false;
+            auto resident = resourceManager.shaders[pending.first];
+            if(resident == pending.second) pending.second->resolve();
+            else
+            {
+                if(!resident->adopt(*pending.second))
+                    log::cwrn << "Shader '" << pending.first << "' did not link, keeping the previous program" << log::endl;
+                delete pending.second;
+            }
+            finished(pending.first);
+            return true;
+        });
+
+        while(uploadedCount < count && elapsed() < budget)
+        {
+            Decoded resource;
+            {
+                std::lock_guard lock(decodedMutex);
+                if(decoded.empty()) break;
+                resource = std::move(decoded.front());
+                decoded.pop_front();
+            }
+            if(resource.upload(resourceManager)) finished(resource.name);
+        }
+        frameHitch = elapsed();
+        maxHitch = std::max(maxHitch, frameHitch);
+        uploadTime += frameHitch;
+
+        if(uploadedCount < count) return false;
+        if(!decodeJobs.empty() && !loaded)
         {
-            log::cout << "Section: '" << section.first << '\'' << log::endl;
-            if(shouldCheckInfo && section.first == "_info") { shouldCheckInfo = false; continue; }
-            for(auto &sect : section.second)
-                entities.push_back(EntityInfo(sect));
+            loaded = true;
+            log::cout << "Loaded " << count << " resources in " << this->elapsed() << "s ("
+                << uploadTime * 1000.f << "ms uploading, worst frame " << maxHitch * 1000.f << "ms) on "
+                << core::jobs::threadCount() << " threads" << (uploadContext ? " with an upload context" : "")
+                << log::endl;
+
+            const auto &stats = core::gfx::shader::binaryCacheStats;
+            if(!core::gfx::shader::binaryCache.empty())
+                log::cout << "Program binary cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                    << stats.saved * 1000.f << "ms saved" << log::endl;
         }
+        // A job which handed over its resource may still be finishing on its worker.
+        std::erase_if(decodeJobs, [](const auto &j) { return core::jobs::done(*j); });
+        return true;
     }
-};
 
-/** Container for to-be loaded resources. */
-struct ResourceLoader
-{
-    using ResourceLoadMap = std::unordered_map<std::string, std::string>;
-    ResourceLoadMap meshes;
-    ResourceLoadMap textures;
-    ResourceLoadMap shaders;
-    ResourceLoadMap cubemaps;
+    /** Called on the GL thread once a resource may be used. */
+    void finished(const std::string &name)
+    {
+        current = name;
+        ++uploadedCount;
+
+#if SRD_HOT_RELOAD
+        auto reloading = hotReloading.find(name);
+        if(reloading == hotReloading.end()) return;
+        reloadLatency = std::chrono::duration<float>(std::chrono::steady_clock::now() - reloading->second.second).count();
+        lastReloaded = name;
+        meshesReloaded |= reloading->second.first == WatchedResource::Mesh;
+        log::cout << "Hot reloaded '" << name << "' in " << reloadLatency * 1000.f << "ms" << log::endl;
+        hotReloading.erase(reloading);
+#endif
+    }
 
-    int count = 0;
+    float elapsed() const
+    {
+        return std::chrono::duration<float>(std::chrono::steady_clock::now() - started).count();
+    }
 
-    void beforeLoader()
+    float progress() const
     {
-        count = meshes.size() + textures.size() + shaders.size() + cubemaps.size();
+        return count ? float(uploadedCount) / float(count) : 1.f;
+    }
+
+    /** Estimated seconds until everything is loaded, extrapolated from the progress so far. */
+    float eta() const
+    {
+        float p = progress();
+        return p > 0 ? elapsed() * (1.f - p) / p : 0.f;
     }
 };
 
@@ -809,6 +2590,33 @@ struct Configuration
 /** Function for saving the configuration, assigned in `main()` */
 std::function<void()> saveGlobalConfig;
 
+/** Frame data handed from the simulation to the renderer. */
+struct FramePacket : core::gfx::frame_packet
+{
+    decltype(core::gfx::shaders::screen_shader_instance::uniforms) screen;
+    decltype(core::gfx::shaders::skybox_shader_instance::uniforms) sky;
+
+    /** Copy of ImGui's draw data, only filled when rendering on a separate thread. */
+    std::vector<ImDrawList*> gui;
+    ImDrawData guiData;
+
+    ~FramePacket()
+    {
+        for(auto list : gui) IM_DELETE(list);
+    }
+
+    /** ImGui reuses its buffers on the next frame, so they are copied for the render thread. */
+    void copyGui(const ImDrawData &data)
+    {
+        for(auto list : gui) IM_DELETE(list);
+        gui.clear();
+        for(int i = 0; i < data.CmdListsCount; ++i)
+            gui.push_back(data.CmdLists[i]->CloneOutput());
+        guiData = data;
+        guiData.CmdLists = gui.data();
+    }
+};
+
 /** Represents a controller of the game. */
 class Composition
 {
@@ -826,12 +2634,16 @@ public:
         ResourceManager &resourceManager,
         ResourceLoader &resourceLoader) {}
     
+    /** Simulates a frame and fills the packet, always called on the main thread. */
     virtual void loop(
         float dt,
-        core::gfx::deferred_renderer &renderer,
+        FramePacket &packet,
         ImGuiIO &io,
         ResourceManager &resourceManager,
         ResourceLoader &resourceLoader) {}
+
+    /** Renders a packet filled by `loop`, possibly on the render thread. */
+    virtual void render(FramePacket &packet, core::gfx::deferred_renderer &renderer) {}
     
     virtual void mousemove(double xpos, double ypos) {}
 };
@@ -839,11 +2651,9 @@ public:
 class LoadingComposition : public Composition
 {
 public:
-    enum { Meshes, Textures, Shaders, Cubemaps, Done } loadingWhat;
-    ResourceLoader::ResourceLoadMap::const_iterator currentResource;
     bool isDone = false;
-    int loadedCount = 0;
-    std::string currentLoading = "";
+    /** Seconds per frame spent uploading decoded resources. */
+    float uploadBudget;
     
     core::gfx::texture *screenTextures;
     ImVec2 *screenTextureSizes;
@@ -869,9 +2679,7 @@ public:
         ResourceManager &resourceManager,
         ResourceLoader &resourceLoader) override
     {
-        loadingWhat = Meshes;
-        currentResource = resourceLoader.meshes.begin();
-        currentLoading = resourceLoader.meshes.begin()->first;
+        uploadBudget = config.getFloat("loading", "uploadBudget", 4.f) / 1000.f;
 
         auto data1 = readTexture("data/textures/Screen_PortalImage1.png", true);
         screenTextures = new core::gfx::texture[1] { core::gfx::texture{data1, false} };
@@ -881,61 +2689,19 @@ public:
     
     void loop(
         float dt,
-        core::gfx::deferred_renderer &renderer,
+        FramePacket &packet,
         ImGuiIO &io,
         ResourceManager &resourceManager,
         ResourceLoader &resourceLoader) override
     {
-        // renderer.clear();
-        if(!isDone)
-        {
-            switch(loadingWhat)
-            {
-                case Meshes:
-                {
-                    std::vector<core::gfx::vertex> vertices;
-                    std::vector<unsigned int> indices;
-                    readMesh(currentResource->second.c_str(), vertices, indices);
-                    resourceManager.meshes[currentResource->first] = std::move(
-                        std::unique_ptr<core::gfx::mesh>(new core::gfx::mesh{ vertices, indices }));
-
-                    ++currentResource;
-                    ++loadedCount;
-                    if(currentResource == resourceLoader.meshes.end())
-                    {
-                        loadingWhat = Textures;
-                        currentResource = resourceLoader.textures.begin();
-                    }
-                    currentLoading = currentResource->second;
-                } break;
-                case Textures:
-                {
-                    auto data = readTexture(currentResource->second.c_str());
-                    resourceManager.textures[currentResource->first] = std::move(
-                        std::unique_ptr<core::gfx::texture>(new core::gfx::texture{ data }));
-                    deleteTexture(data);
-
-                    ++currentResource;
-                    ++loadedCount;
-                    if(currentResource == resourceLoader.textures.end())
-                    {
-                        loadingWhat = Done;
-                        isDone = true;
-                    }
-                    else
-                    {
-                        currentLoading = currentResource->second;
-                    }
-                } break;
-
-                default: break;
-            }
-
-            // [NOTE] For debugging.
-            // std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        }
+        if(!isDone) isDone = resourceLoader.upload(resourceManager, uploadBudget);
 
-        float progress = float(loadedCount) / float(resourceLoader.count);
+        float progress = resourceLoader.progress();
+        char status[256];
+        std::snprintf(status, sizeof(status), "%s (%d/%d, %.1fs left, upload %.2fms/frame, worst %.2fms)",
+            resourceLoader.current.c_str(), resourceLoader.uploadedCount, resourceLoader.count, resourceLoader.eta(),
+            resourceLoader.frameHitch * 1000.f, resourceLoader.maxHitch * 1000.f);
+        std::string currentLoading = status;
         ImGui::SetNextWindowSize(ImGui::GetMainViewport()->Size);
         ImGui::SetNextWindowPos(ImGui::GetMainViewport()->Pos);
         ImGui::Begin("LoadingScreen", nullptr, // ImGuiWindowFlags_NoBackground | 
@@ -958,7 +2724,7 @@ public:
             ImGui::GetWindowSize().x / 2 -
             font_size + (font_size / 2)
         );
-        ImGui::Text(currentLoading.c_str());
+        ImGui::TextUnformatted(currentLoading.c_str());
         ImGui::End();
 
         if(isDone) changeComposition(1, true);
@@ -994,6 +2760,37 @@ public:
 
     core::gfx::mesh *quadMesh;
 
+    std::vector<StaticBatch> staticBatches;
+
+    /** One linear buffer of draw commands per render preparation thread. */
+    std::vector<std::vector<core::gfx::draw_command>> commandBuffers;
+    std::vector<uint32_t> visibleEntities;
+    float renderPrepTime = 0;
+
+    /** Built once by `buildFrameGraph`, the nodes read the frame's state below. */
+    core::jobs::graph frameGraph;
+    float frameDt = 0;
+    FramePacket *framePacket = nullptr;
+    bool captureKeyboard = false, captureMouse = false;
+    /** Seconds per frame spent uploading reloaded resources, see `[loading] uploadBudget`. */
+    float uploadBudget = 0;
+    float staticBatchCellSize = 32.f;
+
+    std::string scenePath = "data/scenes/main.ini";
+    /** Kept for `saveSnapshot`, its entities are the scene's in the same order. */
+    std::shared_ptr<const SceneInfo> sceneInfo;
+    /** See `[data] sceneSnapshot`, empty if the scene is not snapshotted. */
+    std::string snapshotPath;
+    std::unique_ptr<core::jobs::job> snapshotJob;
+    SceneStreamer streamer;
+#if SRD_HOT_RELOAD
+    /** See `[data] hotReload`, only while rendering on the main thread. */
+    bool hotReload = false;
+    /** `EntityInfo::hash` and `layoutHash` of the scene's entities as last applied, see `reloadScene`. */
+    std::vector<std::pair<uint64_t, uint64_t>> sceneHashes;
+    float sceneReloadTime = 0;
+#endif
+
     core::window::window *win;
 
     rbEnvironment *env;
@@ -1003,6 +2800,7 @@ public:
     ~MainComposition()
     {
         log::cerr << "~MainComposition()!" << log::endl;
+        if(snapshotJob) core::jobs::wait(*snapshotJob);
         delete camera;
         delete skybox;
         delete skyboxShader;
@@ -1019,6 +2817,7 @@ public:
     {
         log::cout << "MainComposition::load()" << log::endl;
         this->win = win;
+        uploadBudget = config.getFloat("loading", "uploadBudget", 4.f) / 1000.f;
 
         // -----------============  Camera Setup  ============----------- //
 
@@ -1041,8 +2840,8 @@ public:
         ResourceGlobals::physicsEnv = env;
 
         skybox = new core::gfx::skybox {
-            .texture = *resourceManager.cubemaps["skybox"],
-            .skyMesh = *resourceManager.meshes["cube"],
+            .texture = *resourceManager.cubemaps.pin("skybox"),
+            .skyMesh = *resourceManager.meshes.pin("cube"),
         };
 
         skybox->update(camera->transform.position);
@@ -1050,12 +2849,12 @@ public:
         // auto &skyboxShader = *resourceManager.shaders["skybox"];
 
         skyboxShader = new core::gfx::shaders::skybox_shader_instance {
-            .type = *static_cast<core::gfx::shaders::skybox_shader*>(resourceManager.shaders["skybox"].get())
+            .type = *static_cast<core::gfx::shaders::skybox_shader*>(resourceManager.shaders["skybox"])
         };
         
         // core::gfx::mesh &quadMesh = *resourceManager.meshes["quad"];
         screenShader = new core::gfx::shaders::screen_shader_instance {
-            .type = *static_cast<core::gfx::shaders::screen_shader*>(resourceManager.shaders["screen"].get())
+            .type = *static_cast<core::gfx::shaders::screen_shader*>(resourceManager.shaders["screen"])
         };
 
         auto lightPosition = config.getVec3("lighting", "lightPosition"); // glm::vec4(1.f, 1.f, 0.3f, 1.4f);
@@ -1065,37 +2864,49 @@ public:
 
         updateLightMatrix();
 
-        shadowShader = static_cast<core::gfx::shaders::shadow_shader*>(resourceManager.shaders["shadow"].get());
+        shadowShader = static_cast<core::gfx::shaders::shadow_shader*>(resourceManager.shaders["shadow"]);
         ResourceGlobals::shadowShader = shadowShader;
-        quadMesh = resourceManager.meshes["quad"].get();
+        quadMesh = resourceManager.meshes.pin("quad");
 
         log::cout << "Loading scene configuration..." << log::endl;
-        MultiIni iniConfig("data/scenes/main.ini");
-        log::cout << "SceneInfo initializer..." << log::endl;
-        SceneInfo sceneInfo(iniConfig);
-        log::cout << "Iterating Entities..." << log::endl;
-        for(auto &einfo : sceneInfo.entities)
-        {
-            log::cout << "Loading entity..." << log::endl;
-            auto e = new Entity();
-            e->transform.position = einfo.position;
-            e->transform.rotation = einfo.rotation;
-            e->transform.scale = einfo.scale;
-            for(const auto &comp : einfo.components)
-            {
-                log::cout << "  Loading entity component..." << log::endl;
-                log::cout << "e - " << e << log::endl;
-                log::cout << "comp - " << (void*)comp << log::endl;
-                auto cp = comp(e, resourceManager, einfo.info);
-                log::cout << "cp - " << cp << log::endl;
-                e->add(cp);
-                log::cout << "  Done loading entity component!" << log::endl;
-            }
-            scene.entities.push_back(std::unique_ptr<Entity>(e));
-            log::cout << "Done loading entity!" << log::endl;
+        snapshotPath = config.getString("data", "sceneSnapshot", "");
+        auto parseBegin = std::chrono::steady_clock::now();
+        auto info = std::make_shared<SceneInfo>();
+        bool fromSnapshot = snapshotCurrent() && info->readSnapshot(snapshotPath);
+        if(!fromSnapshot) info = std::make_shared<SceneInfo>(scenePath, resourceManager);
+        sceneInfo = info;
+        log::cout << (fromSnapshot ? "Read '" + snapshotPath : "Parsed '" + scenePath) << "' ("
+                  << sceneInfo->entities.size() << " entities) in "
+                  << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - parseBegin).count()
+                  << "ms" << log::endl;
+        streamer.cellSize = config.getFloat("world", "streamCellSize", 0.f);
+        streamer.loadRadius = config.getFloat("world", "streamLoadRadius", 64.f);
+        streamer.unloadRadius = std::max(config.getFloat("world", "streamUnloadRadius", 80.f), streamer.loadRadius);
+        streamer.budget = config.getFloat("world", "streamBudget", 2.f) / 1000.f;
+        if(streamer)
+        {
+            // The cells around the camera are created right away, everything they need is resident by now.
+            scene.entities.resize(sceneInfo->entities.size());
+            streamer.partition(scene, *sceneInfo, resourceManager);
+            auto budget = std::exchange(streamer.budget, std::numeric_limits<float>::infinity());
+            streamer.update(camera->transform.position, scene, *sceneInfo, resourceManager);
+            streamer.budget = budget;
+        }
+        else
+        {
+            scene.entities.reserve(sceneInfo->entities.size());
+            for(const auto &einfo : sceneInfo->entities)
+                scene.entities.push_back(std::unique_ptr<Entity>(createEntity(*sceneInfo, einfo, resourceManager)));
         }
+#if SRD_HOT_RELOAD
+        for(const auto &einfo : sceneInfo->entities) sceneHashes.push_back({ einfo.hash, einfo.layoutHash });
+#endif
         log::cout << "Done loading scene!" << log::endl;
-        log::cout << "Scene entity count: " << scene.entities.size() << log::endl;
+        if(streamer)
+            log::cout << "Scene entity count: " << streamer.loadedEntities << " of " << scene.entities.size()
+                      << " in " << streamer.count(SceneStreamer::Cell::Active) << " of " << streamer.cells.size() << " cells" << log::endl;
+        else
+            log::cout << "Scene entity count: " << scene.entities.size() << log::endl;
 
         
         // {
@@ -1190,10 +3001,218 @@ public:
 
         // TODO: add start() to Composition.
         scene.start();
+
+        staticBatchCellSize = config.getFloat("world", "staticBatchCellSize", 32.f);
+        // Batches are built again as cells stream, which needs the GL context (see `loop`).
+        if(streamer && config.getInt("render", "threaded", 0))
+            log::cwrn << "Streamed scenes are not batched with the render thread" << log::endl;
+        else
+            staticBatches = buildStaticBatches(scene, resourceManager, staticBatchCellSize);
+
+#if SRD_HOT_RELOAD
+        hotReload = config.getInt("data", "hotReload", 1);
+        if(hotReload)
+        {
+            resourceLoader.watch();
+            resourceLoader.watcher.watch(scenePath);
+        }
+#endif
+
+        buildFrameGraph();
+    }
+
+    /** A snapshot older than the scene file is not read, so that edits to the scene are never shadowed. */
+    bool snapshotCurrent() const
+    {
+        if(snapshotPath.empty()) return false;
+        std::error_code error;
+        auto snapshotTime = std::filesystem::last_write_time(snapshotPath, error);
+        if(error) return false;
+        auto sceneTime = std::filesystem::last_write_time(scenePath, error);
+        return error || snapshotTime >= sceneTime;
+    }
+
+    /**
+     * Snapshots the scene with the entities where they are now. Only their transforms are copied here,
+     * the snapshot is built and written by a job, one at a time.
+     */
+    void saveSnapshot()
+    {
+        if(snapshotPath.empty() || !sceneInfo) return;
+        if(snapshotJob && !core::jobs::done(*snapshotJob))
+        {
+            log::cwrn << "Still saving the last snapshot, not saving another one" << log::endl;
+            return;
+        }
+
+        auto entities = sceneInfo->entities;
+        for(size_t i = 0; i < entities.size() && i < scene.entities.size(); ++i)
+        {
+            if(!scene.entities[i]) continue;
+            const auto &transform = scene.entities[i]->transform;
+            entities[i].position = transform.position;
+            entities[i].rotation = transform.rotation;
+            entities[i].scale = transform.scale;
+        }
+        snapshotJob.reset(new core::jobs::job([info = sceneInfo, entities = std::move(entities), path = snapshotPath]()
+        {
+            auto begin = std::chrono::steady_clock::now();
+            if(writeSnapshot(path, *info, entities))
+                log::cout << "Saved snapshot '" << path << "' in "
+                          << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count()
+                          << "ms" << log::endl;
+        }));
+        core::jobs::run(*snapshotJob);
+    }
+
+    /** Merges the static meshes again, e.g. after their geometry or the scene changed. */
+    void rebuildStaticBatches(ResourceManager &resourceManager)
+    {
+        staticBatches.clear();
+        for(auto &e : scene.entities)
+        {
+            if(!e) continue;
+            if(auto mesh = (ECStaticMesh*)e->findComponentByType(EntityComponentType::StaticMesh))
+                if(auto meshData = mesh->getMesh()) mesh->batched.assign(meshData->submeshes.size(), false);
+        }
+        staticBatches = buildStaticBatches(scene, resourceManager, staticBatchCellSize);
+    }
+
+#if SRD_HOT_RELOAD
+    /**
+     * Applies the scene file again after it changed. Entities are matched by their order in the file,
+     * ones whose section only changed their transform are moved, other changed ones are created again.
+     * In a streamed scene only loaded entities are, the others are created with their cell.
+     */
+    void reloadScene(ResourceManager &resourceManager)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto info = std::make_shared<SceneInfo>(scenePath, resourceManager);
+        const auto &entities = info->entities;
+
+        size_t moved = 0, created = 0, removed = 0;
+        for(size_t i = 0; i < entities.size(); ++i)
+        {
+            const auto &einfo = entities[i];
+            if(i >= scene.entities.size())
+            {
+                scene.entities.emplace_back(streamer ? nullptr : createEntity(*info, einfo, resourceManager));
+                sceneHashes.push_back({ einfo.hash, einfo.layoutHash });
+                ++created;
+                continue;
+            }
+            if(sceneHashes[i].first == einfo.hash) continue;
+
+            // Entities which are not streamed in are created from the new info along with their cell.
+            bool loaded = scene.entities[i] != nullptr;
+            if(loaded && sceneHashes[i].second == einfo.layoutHash)
+            {
+                auto &transform = scene.entities[i]->transform;
+                transform.position = einfo.position;
+                transform.rotation = einfo.rotation;
+                transform.scale = einfo.scale;
+                transform.update();
+                if(auto rb = (ECRigidBody*)scene.entities[i]->findComponentByType(EntityComponentType::RigidBody))
+                    rb->place();
+                scene.refit(i);
+                ++moved;
+            }
+            else if(loaded)
+            {
+                // Deleted first, so that its body is unregistered before the new one registers.
+                scene.entities[i].reset();
+                scene.entities[i].reset(createEntity(*info, einfo, resourceManager));
+                ++created;
+            }
+            sceneHashes[i] = { einfo.hash, einfo.layoutHash };
+        }
+        if(scene.entities.size() > entities.size())
+        {
+            removed = scene.entities.size() - entities.size();
+            scene.entities.resize(entities.size());
+            sceneHashes.resize(entities.size());
+        }
+        sceneInfo = info;
+        // Entities which moved out of the loaded cells are deleted, ones which moved into them are created.
+        bool streamedOut = streamer && streamer.partition(scene, *info, resourceManager);
+
+        if(moved || created || removed || streamedOut)
+        {
+            scene.start();
+            rebuildStaticBatches(resourceManager);
+        }
+        sceneReloadTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count();
+        log::cout << "Reloaded '" << scenePath << "' in " << sceneReloadTime * 1000.f << "ms: " << moved << " moved, "
+                  << created << " created, " << removed << " removed" << log::endl;
+    }
+#endif
+
+    /**
+     * Nodes are added in the order the systems used to run in, conflicting ones keep that order.
+     * Input runs on the main thread while the physics systems run on the workers.
+     */
+    void buildFrameGraph()
+    {
+        frameGraph.add("Camera Input", { .reads = FrameData::Input, .writes = FrameData::Camera }, [this]()
+        {
+            if(!captureKeyboard) if(handleInput(frameDt)) camera->update();
+            if(!captureMouse)
+            {
+                if(glfwGetMouseButton((GLFWwindow*)win->win, 0) == GLFW_PRESS)
+                    win->lockCursor(true);
+            }
+        }, true);
+
+        Scene::addSystem(frameGraph, "RigidBody Update", ECRigidBody::updateAccess,
+            scene.rigidBodies, &ECRigidBody::update, frameDt);
+        Scene::addSystem(frameGraph, "PlayerController Update", ECPlayerController::updateAccess,
+            scene.playerControllers, &ECPlayerController::update, frameDt);
+
+        // Nothing is known about what other components touch, so their nodes conflict with every other one.
+        constexpr core::jobs::access everything { .reads = ~uint64_t(0), .writes = ~uint64_t(0) };
+        frameGraph.add("Component Update", everything, [this]()
+        {
+            for(auto c : scene.otherComponents) c->update(frameDt);
+        }, true);
+
+        frameGraph.add("Physics", { .reads = FrameData::Forces, .writes = FrameData::RigidBodies }, [this]()
+        {
+            env->Update(frameDt, 3);
+        });
+
+        Scene::addSystem(frameGraph, "RigidBody Sync", ECRigidBody::afterUpdateAccess,
+            scene.rigidBodies, &ECRigidBody::afterUpdate, frameDt);
+        frameGraph.add("Component Sync", everything, [this]()
+        {
+            for(auto c : scene.otherComponents) c->afterUpdate(frameDt);
+        }, true);
+
+        frameGraph.add("Spatial Index", {
+            .reads = FrameData::Transforms | FrameData::RenderData,
+            .writes = FrameData::SpatialIndex
+        }, [this]()
+        {
+            scene.updateIndex();
+        });
+
+        frameGraph.add("Render Prep", {
+            .reads = FrameData::Camera | FrameData::Transforms | FrameData::RenderData | FrameData::SpatialIndex,
+            .writes = FrameData::DrawCommands
+        }, [this]()
+        {
+            framePacket->view = *camera;
+            framePacket->lightSpaceMatrix = lightMVPMatrix;
+            framePacket->setup();
+            prepareDraws(*framePacket);
+        });
+
+        frameGraph.compile();
+        log::cout << "Frame graph: " << frameGraph.nodes.size() << " nodes" << log::endl;
     }
 
     void saveOwnConfig(inipp::Ini<char> &config) override
     {
+        saveSnapshot();
         config.sections["world"]["cameraPos"] = vectorToString(camera->transform.position);
         config.sections["world"]["cameraRotation"] = vectorToString(camera->transform.rotation);
         config.sections["world"]["cameraSpeed"] = std::to_string(cameraSpeed);
@@ -1247,7 +3266,7 @@ public:
         return false;
     }
 
-    void drawGui()
+    void drawGui(ResourceManager &resourceManager, const ResourceLoader &resourceLoader)
     {
         constexpr float maxSunPos = 20;
         ImGui::Begin("Debug Tools", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
@@ -1289,6 +3308,84 @@ public:
 
         ImGui::SliderFloat("Camera Speed", &cameraSpeed, 0, 5);
 
+        ImGui::Spacing();
+        ImGui::Separator();
+        ImGui::Spacing();
+
+        auto arenaStats = [](const char *name, const core::gfx::free_list &list)
+        {
+            auto stats = list.statistics();
+            ImGui::Text("%s: %u / %u used, %u free blocks (%.0f%% fragmented)", name,
+                stats.used, stats.capacity, stats.freeBlocks, stats.fragmentation() * 100.f);
+        };
+        arenaStats("Arena Vertices ", resourceManager.meshArena.geometry.vertices);
+        arenaStats("Arena Indices  ", resourceManager.meshArena.geometry.indices);
+        arenaStats("Arena Positions", resourceManager.meshArena.positions.vertices);
+
+        auto budget = [](const char *name, size_t used, size_t budget)
+        {
+            char overlay[64];
+            std::snprintf(overlay, sizeof(overlay), "%s %.1f / %.0f MiB", name, used / 1048576.f, budget / 1048576.f);
+            if(budget) ImGui::ProgressBar(float(used) / float(budget), ImVec2(-1, 0), overlay);
+            else ImGui::Text("%s %.1f MiB, no budget", name, used / 1048576.f);
+        };
+        budget("Resources CPU", resourceManager.cpuBytes(), resourceManager.cpuBudget);
+        budget("Resources GPU", resourceManager.gpuBytes(), resourceManager.gpuBudget);
+        ImGui::Text("Resident: %zu meshes, %zu textures, %zu cubemaps, %zu evictions",
+            resourceManager.meshes.resident, resourceManager.textures.resident,
+            resourceManager.cubemaps.resident, resourceManager.evictions);
+        if(ResourceGlobals::renderLatency && (resourceManager.cpuBudget || resourceManager.gpuBudget))
+            ImGui::Text("Budgets are not enforced with the render thread");
+
+        size_t batchedSubmeshes = 0;
+        for(const auto &batch : staticBatches) batchedSubmeshes += batch.submeshCount;
+        ImGui::Text("Static Batches: %zu (%zu submeshes)", staticBatches.size(), batchedSubmeshes);
+        ImGui::Text("Spatial Index: %zu static (height %d), %zu dynamic (height %d), %zu in the frustums",
+            scene.staticTree.size(), scene.staticTree.height(), scene.dynamicTree.size(), scene.dynamicTree.height(),
+            visibleEntities.size());
+        core::math::ray view { camera->transform.position, glm::vec3(0, 0, 1) * camera->transform.rotation, 100.f };
+        float distance;
+        if(int picked = scene.pick(view, distance); picked >= 0)
+            ImGui::Text("Looking at: entity %d, %.2f m away", picked, distance);
+        else ImGui::Text("Looking at: nothing");
+
+        if(streamer)
+        {
+            ImGui::Text("Streaming: %zu / %zu cells loaded, %zu loading, %zu / %zu entities",
+                streamer.count(SceneStreamer::Cell::Active), streamer.cells.size(),
+                streamer.count(SceneStreamer::Cell::Loading), streamer.loadedEntities, scene.entities.size());
+            auto size = streamer.stalls.size();
+            char overlay[64];
+            std::snprintf(overlay, sizeof(overlay), "stall %.2f ms, max %.2f ms",
+                streamer.stalls[(streamer.frame + size - 1) % size] * 1000.f, streamer.maxStall * 1000.f);
+            ImGui::PlotLines("##Streaming", streamer.stalls.data(), size, streamer.frame % size, overlay,
+                0.f, FLT_MAX, ImVec2(400, 40));
+        }
+
+        ImGui::Text("Render Prep: %.3f ms, %zu chunks on %u threads", renderPrepTime * 1000.f,
+            commandBuffers.size(), core::jobs::threadCount());
+
+        if(ResourceGlobals::renderLatency)
+            ImGui::Text("Render Thread: %.2f ms latency, %d frames in flight",
+                ResourceGlobals::renderLatency->load() * 1000.f, ResourceGlobals::framesInFlight);
+        else
+            ImGui::Text("Render Thread: off");
+
+#if SRD_HOT_RELOAD
+        if(!hotReload)
+            ImGui::Text("Hot Reload: off");
+        else if(ResourceGlobals::renderLatency)
+            ImGui::Text("Hot Reload: paused with the render thread");
+        else
+        {
+            ImGui::Text("Hot Reload: watching %zu files", resourceLoader.watcher.files.size());
+            if(!resourceLoader.lastReloaded.empty())
+                ImGui::Text("  Last: '%s' in %.1f ms", resourceLoader.lastReloaded.c_str(), resourceLoader.reloadLatency * 1000.f);
+            if(sceneReloadTime > 0)
+                ImGui::Text("  Scene: applied in %.1f ms", sceneReloadTime * 1000.f);
+        }
+#endif
+
         ImGui::End();
 
         if(ImGui::BeginMainMenuBar())
@@ -1307,27 +3404,164 @@ public:
 
     void loop(
         float dt,
-        core::gfx::deferred_renderer &renderer,
+        FramePacket &packet,
         ImGuiIO &io,
         ResourceManager &resourceManager,
         ResourceLoader &resourceLoader) override
     {
-        if(!io.WantCaptureKeyboard) if(handleInput(dt)) camera->update();
-        if(!io.WantCaptureMouse)
+        frameDt = dt;
+        framePacket = &packet;
+        captureKeyboard = io.WantCaptureKeyboard;
+        captureMouse = io.WantCaptureMouse;
+
+        // Evicting and reloading create and delete GL objects, the render thread owns the context.
+        if(!ResourceGlobals::renderLatency)
+        {
+            resourceManager.collect();
+#if SRD_HOT_RELOAD
+            if(hotReload)
+                for(const auto &path : resourceLoader.hotReload())
+                    if(path == packPath(scenePath)) reloadScene(resourceManager);
+#endif
+            resourceLoader.reload(resourceManager);
+            resourceLoader.upload(resourceManager, uploadBudget);
+#if SRD_HOT_RELOAD
+            if(std::exchange(resourceLoader.meshesReloaded, false))
+            {
+                scene.refit();
+                rebuildStaticBatches(resourceManager);
+            }
+#endif
+        }
+        if(streamer)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            auto changes = streamer.update(camera->transform.position, scene, *sceneInfo, resourceManager);
+            if(changes.entities) scene.start();
+            if(changes.cells && !ResourceGlobals::renderLatency) rebuildStaticBatches(resourceManager);
+            streamer.record(std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count());
+        }
+        frameGraph.execute();
+
+        drawGui(resourceManager, resourceLoader);
+        drawFrameGraph();
+        packet.screen = screenShader->uniforms;
+        packet.sky = skyboxShader->uniforms;
+    }
+
+    /** Timeline of the last execution of the frame graph, one row per thread. */
+    void drawFrameGraph()
+    {
+        ImGui::Begin("Frame Graph", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        ImGui::Text("Frame Graph: %.3f ms", frameGraph.duration * 1000.f);
+        ImGui::SameLine();
+        if(ImGui::Button("Export DOT"))
+        {
+            std::ofstream("frame_graph.dot") << frameGraph.dot();
+            log::cout << "Exported the frame graph to frame_graph.dot" << log::endl;
+        }
+
+        constexpr float width = 400.f, rowHeight = 18.f;
+        unsigned int threads = core::jobs::threadCount();
+        float scale = width / std::max(frameGraph.duration, 1e-6f);
+        auto origin = ImGui::GetCursorScreenPos();
+        auto drawList = ImGui::GetWindowDrawList();
+
+        for(unsigned int t = 0; t < threads; ++t)
+            drawList->AddRectFilled(
+                ImVec2(origin.x, origin.y + t * rowHeight),
+                ImVec2(origin.x + width, origin.y + (t + 1) * rowHeight - 2),
+                IM_COL32(40, 40, 40, 255));
+
+        for(size_t i = 0; i < frameGraph.nodes.size(); ++i)
+        {
+            const auto &node = frameGraph.nodes[i];
+            if(node.thread < 0) continue;
+            ImVec2 min { origin.x + node.start * scale, origin.y + node.thread * rowHeight };
+            ImVec2 max { min.x + std::max(node.duration * scale, 2.f), min.y + rowHeight - 2 };
+            drawList->AddRectFilled(min, max, ImColor::HSV(i * 0.13f, 0.6f, 0.7f));
+            drawList->PushClipRect(min, max, true);
+            drawList->AddText(ImVec2(min.x + 2, min.y + 1), IM_COL32_WHITE, node.name.c_str());
+            drawList->PopClipRect();
+        }
+        ImGui::Dummy(ImVec2(width, threads * rowHeight));
+
+        for(const auto &node : frameGraph.nodes)
         {
-            if(glfwGetMouseButton((GLFWwindow*)win->win, 0) == GLFW_PRESS)
-                win->lockCursor(true);
+            std::string after;
+            for(auto p : node.predecessors) after += (after.empty() ? "" : ", ") + frameGraph.nodes[p].name;
+            ImGui::Text("%-24s %7.3f ms  thread %2d  after: %s", node.name.c_str(),
+                node.duration * 1000.f, node.thread, after.empty() ? "-" : after.c_str());
         }
+        ImGui::End();
+    }
+
+    /**
+     * Finds the entities in the view or light frustum in the spatial index, then splits them into
+     * chunks run as jobs, each one culls its entities' draws and writes them into its own buffer,
+     * which is then sorted. The buffers are merged by key.
+     */
+    void prepareDraws(FramePacket &packet)
+    {
+        auto start = std::chrono::steady_clock::now();
+        const core::math::frustum frustums[] = { packet.viewFrustum, packet.lightFrustum };
+        visibleEntities.clear();
+        scene.query(std::span<const core::math::frustum>(frustums), [this](size_t, uint32_t e) { visibleEntities.push_back(e); });
+        std::sort(visibleEntities.begin(), visibleEntities.end());
+        visibleEntities.erase(std::unique(visibleEntities.begin(), visibleEntities.end()), visibleEntities.end());
+
+        constexpr size_t minEntitiesPerThread = 1024;
+        size_t count = visibleEntities.size();
+        size_t threads = std::clamp<size_t>(count / minEntitiesPerThread, 1, core::jobs::threadCount());
+        commandBuffers.resize(threads);
+
+        auto prepare = [&](size_t index)
+        {
+            auto &commands = commandBuffers[index];
+            commands.clear();
+            scene.render(packet, commands, std::span<const uint32_t>(visibleEntities).subspan(
+                count * index / threads, count * (index + 1) / threads - count * index / threads));
+
+            if(index == 0)
+            {
+                for(const auto &batch : staticBatches)
+                {
+                    core::gfx::draw_command draw {
+                        .mesh_     = batch.mesh.get(),
+                        .texture_  = batch.texture,
+                        .shader    = &batch.shader->type,
+                        .textureId = batch.texture->id,
+                        .shaderId  = batch.shader->type.id,
+                        .tiling    = batch.shader->uniforms.materialData.tiling,
+                        .model     = glm::mat4(1.f) // Batches are already in world space.
+                    };
+                    if(packet.prepare(draw)) commands.push_back(draw);
+                }
+            }
+
+            std::sort(commands.begin(), commands.end(),
+                [](const auto &a, const auto &b) { return a.key < b.key; });
+        };
+
+        core::jobs::parallel_for(0, threads, [&](size_t first, size_t last)
+        {
+            for(size_t i = first; i < last; ++i) prepare(i);
+        });
+
+        packet.merge(commandBuffers);
+        renderPrepTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /** Only reads the packet and resources which do not change after loading. */
+    void render(FramePacket &packet, core::gfx::deferred_renderer &renderer) override
+    {
+        core::gfx::shaders::skybox_shader_instance sky { .type = skyboxShader->type, .uniforms = packet.sky };
+        core::gfx::shaders::screen_shader_instance screen { .type = screenShader->type, .uniforms = packet.screen };
 
-        // glClear(GL_COLOR_BUFFER_BIT);
-        scene.update(dt);
-        env->Update(dt, 3);
-        scene.afterUpdate(dt);
         renderer.begin();
-        scene.render(*camera, renderer);
-        renderer.sky(*camera, *skybox, *skyboxShader);
-        renderer.light(*screenShader, *quadMesh);
-        drawGui();
+        renderer.render(packet, *shadowShader);
+        renderer.sky(packet.view, *skybox, sky);
+        renderer.light(screen, *quadMesh);
     }
 
     void mousemove(double xpos, double ypos) override
@@ -1378,6 +3612,14 @@ int main(int argc, char *argv[])
     iniConfig.generate(std::cout);
     Configuration config { .config = iniConfig };
 
+    core::jobs::init(config.getInt("jobs", "workers", 0));
+    log::cout << "Job system: " << core::jobs::threadCount() << " threads" << log::endl;
+
+    // Everything after this point is read through the packs, 'config.ini' itself stays loose.
+    fileSystem.looseFiles = config.getInt("data", "looseFiles", 1);
+    auto pack = config.getString("data", "pack", "");
+    if(!pack.empty()) mountPack(pack);
+
     log::csec << "Program:" << log::endl;
 
     auto windowSize = config.getVec2("window", "size");
@@ -1392,7 +3634,16 @@ int main(int argc, char *argv[])
     ImGui_ImplOpenGL3_Init("#version 410");
     ImGui::GetStyle().Alpha = config.getFloat("window", "alpha", 1.0f);
     ImGui::GetStyle().WindowTitleAlign = ImVec2(0.5, 0.5);
-    io.Fonts->AddFontFromFileTTF("data/fonts/UbuntuMono-Regular.ttf", config.getInt("window", "fontSize", 13));
+    {
+        // ImGui frees the font data itself, so it gets its own copy.
+        VirtualFile font;
+        if(readVirtualFile("data/fonts/UbuntuMono-Regular.ttf", font) && font.size > 0)
+        {
+            void *fontData = IM_ALLOC(font.size);
+            std::memcpy(fontData, font.data, font.size);
+            io.Fonts->AddFontFromMemoryTTF(fontData, int(font.size), config.getInt("window", "fontSize", 13));
+        }
+    }
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
 
     core::gfx::deferred_renderer renderer {
@@ -1404,6 +3655,8 @@ int main(int argc, char *argv[])
     };
 
     ResourceManager resourceManager;
+    resourceManager.cpuBudget = size_t(config.getInt("resources", "cpuBudget", 0)) << 20;
+    resourceManager.gpuBudget = size_t(config.getInt("resources", "gpuBudget", 0)) << 20;
     ResourceLoader resourceLoader;
     
     // -----------============ Mesh Loading ============----------- //
@@ -1420,58 +3673,38 @@ int main(int argc, char *argv[])
     resourceLoader.textures["cobblestone"] = "data/textures/floor-cobblestone.jpeg";
     resourceLoader.textures["portal"] = "data/textures/StonePortal2.jpg";
     
-    {
-        auto SKYBOX_PATH = config.getString("data", "skyboxPrefix", "data/textures/skybox/skybox_");
-        auto SKYBOX_EXT  = config.getString("data", "skyboxSuffix", ".jpg");
-        auto xPos = readTexture(SKYBOX_PATH + "px" + SKYBOX_EXT, true);
-        auto xNeg = readTexture(SKYBOX_PATH + "nx" + SKYBOX_EXT, true);
-        auto yPos = readTexture(SKYBOX_PATH + "py" + SKYBOX_EXT, true);
-        auto yNeg = readTexture(SKYBOX_PATH + "ny" + SKYBOX_EXT, true);
-        auto zPos = readTexture(SKYBOX_PATH + "pz" + SKYBOX_EXT, true);
-        auto zNeg = readTexture(SKYBOX_PATH + "nz" + SKYBOX_EXT, true);
-        resourceManager.cubemaps["skybox"].reset(new core::gfx::cubemap
-        {
-            xPos,
-            xNeg,
-            yPos,
-            yNeg,
-            zPos,
-            zNeg
-        });
-        deleteTexture(xPos);
-        deleteTexture(xNeg);
-        deleteTexture(yPos);
-        deleteTexture(yNeg);
-        deleteTexture(zPos);
-        deleteTexture(zNeg);
-    }
-
-    // -----------============ Shader Loading ============----------- //
+    // -----------============ Cubemap Loading ============----------- //
 
-    resourceManager.shaders["lit"].reset(
-        new core::gfx::shaders::geometry_shader{readFile("data/shaders/lit.vertex"), readFile("data/shaders/dlit.fragment")
-    });
-    {
-        auto shader = (core::gfx::shaders::geometry_shader*)(resourceManager.shaders["lit"].get());
-        shader->setUniform(shader->uniforms.materialData.tiling, glm::vec2(1, 1));
-    }
+    resourceLoader.cubemaps["skybox"] = {
+        config.getString("data", "skyboxPrefix", "data/textures/skybox/skybox_"),
+        config.getString("data", "skyboxSuffix", ".jpg")
+    };
 
-    resourceManager.shaders["shadow"].reset(
-        new core::gfx::shaders::shadow_shader{readFile("data/shaders/shadow.vertex"), readFile("data/shaders/shadow.fragment")
-    });
+    // -----------============ Shader Loading ============----------- //
 
-    resourceManager.shaders["skybox"].reset(
-        new core::gfx::shaders::skybox_shader{readFile("data/shaders/skybox.vertex"), readFile("data/shaders/skybox.fragment")
-    });
+    resourceLoader.shaders["lit"] = {
+        "data/shaders/lit.vertex", "data/shaders/dlit.fragment",
+        [](const std::string &vertex, const std::string &fragment)
+        { return (core::gfx::shader*)new core::gfx::shaders::geometry_shader{vertex, fragment}; }
+    };
 
-    resourceManager.shaders["screen"].reset(
-        new core::gfx::shaders::screen_shader{
-            readFile("data/shaders/deferred/screen.vertex"),
-            readFile("data/shaders/deferred/screen.fragment")
-        }
-    );
+    resourceLoader.shaders["shadow"] = {
+        "data/shaders/shadow.vertex", "data/shaders/shadow.fragment",
+        [](const std::string &vertex, const std::string &fragment)
+        { return (core::gfx::shader*)new core::gfx::shaders::shadow_shader{vertex, fragment}; }
+    };
 
+    resourceLoader.shaders["skybox"] = {
+        "data/shaders/skybox.vertex", "data/shaders/skybox.fragment",
+        [](const std::string &vertex, const std::string &fragment)
+        { return (core::gfx::shader*)new core::gfx::shaders::skybox_shader{vertex, fragment}; }
+    };
 
+    resourceLoader.shaders["screen"] = {
+        "data/shaders/deferred/screen.vertex", "data/shaders/deferred/screen.fragment",
+        [](const std::string &vertex, const std::string &fragment)
+        { return (core::gfx::shader*)new core::gfx::shaders::screen_shader{vertex, fragment}; }
+    };
 
     // -----------============   Game Loop   ============----------- //
 
@@ -1518,34 +3751,26 @@ int main(int argc, char *argv[])
     composition->load(&win, config, resourceManager, resourceLoader);
     log::cout << "composition->load() done." << log::endl;
 
-    // struct ThreadCorrectOverload_ {};
+    core::gfx::shader::binaryCache = config.getString("data", "shaderCache", "");
+    resourceLoader.meshCache = config.getString("data", "meshCache", "");
+    resourceLoader.meshBVH = config.getInt("data", "meshBVH", 0);
 
+    // Decoding runs on the job system while the loading composition uploads.
+    std::unique_ptr<core::gfx::upload_context> uploadContext;
+    if(config.getInt("render", "uploadContext", 0))
+    {
+        uploadContext.reset(new core::gfx::upload_context(win));
+        resourceLoader.uploadContext = uploadContext.get();
+    }
     resourceLoader.beforeLoader();
 
-    // std::thread resourceLoadingThread(
-    //     [&]()
-    //         // ResourceLoader &resourceLoader,
-    //         // ResourceManager &resourceManager,
-    //         // Composition **&compositions,
-    //         // Composition *&composition,
-    //         // core::window::window &win,
-    //         // Configuration &config)
-    //     {
-    //         resourceLoader.loadMeshes(resourceManager);
-    //         resourceLoader.loadTextures(resourceManager);
-    //         composition = compositions[1];
-    //         log::cwrn << "MainComposition::load()" << log::endl;
-    //         composition->load(&win, config, resourceManager, resourceLoader);
-    //         log::cwrn << "MainComposition::load() done." << log::endl;
-    //     }
-    //     // ,
-    //     // std::ref(resourceLoader),
-    //     // std::ref(resourceManager),
-    //     // std::ref(compositions),
-    //     // std::ref(compositions),
-    //     // std::ref(win),
-    //     // std::ref(config)
-    // );
+    // -----------============ Render Thread ============----------- //
+
+    bool threadedRendering = config.getInt("render", "threaded", 0);
+    int framesInFlight = config.getInt("render", "framesInFlight", 2);
+    std::unique_ptr<core::gfx::render_thread<FramePacket>> renderThread;
+    FramePacket localPacket;
+    FramePacket *packet = &localPacket;
 
     log::csec << "Show Window:" << log::endl;
     core::window::show(win,
@@ -1553,7 +3778,10 @@ int main(int argc, char *argv[])
     /* On Update */
     [&](float dt)
     {
-        composition->loop(dt, renderer, io, resourceManager, resourceLoader);
+        // The composition can change during its loop.
+        auto current = composition;
+        current->loop(dt, *packet, io, resourceManager, resourceLoader);
+        if(!renderThread) current->render(*packet, renderer);
         // ImGui::ShowDemoWindow();
     },
 
@@ -1572,6 +3800,21 @@ int main(int argc, char *argv[])
     /* On Before Render */
     [&]()
     {
+        // The loading screen uploads resources, so the GL context is only handed over afterwards.
+        if(threadedRendering && !renderThread && composition == compositions[1])
+        {
+            log::cout << "Starting the render thread (" << framesInFlight << " frames in flight)" << log::endl;
+            renderThread.reset(new core::gfx::render_thread<FramePacket>(win, framesInFlight,
+                [&](FramePacket &frame)
+                {
+                    compositions[1]->render(frame, renderer);
+                    ImGui_ImplOpenGL3_RenderDrawData(&frame.guiData);
+                }));
+            ResourceGlobals::renderLatency = &renderThread->latency;
+            ResourceGlobals::framesInFlight = framesInFlight;
+        }
+        packet = renderThread ? &renderThread->begin() : &localPacket;
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -1581,9 +3824,20 @@ int main(int argc, char *argv[])
     [&]()
     {   
         ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        if(renderThread)
+        {
+            packet->copyGui(*ImGui::GetDrawData());
+            renderThread->submit();
+        }
+        else
+        {
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
     });
 
+    ResourceGlobals::renderLatency = nullptr;
+    renderThread.reset();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext(nullptr);
@@ -1593,6 +3847,8 @@ int main(int argc, char *argv[])
     for(int i = 0; i < 2; ++i) delete compositions[i];
     log::cout << "delete [compositions]" << log::endl;
     delete compositions;
+    core::jobs::shutdown();
     log::cout << "main() end." << log::endl;
     // resourceLoadingThread.join();
+    return 0;
 }
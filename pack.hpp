@@ -0,0 +1,167 @@
+#ifndef PACK
+#define PACK
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+
+/**
+ * Header of an asset pack: the entry data, then the entries sorted by path hash, then their names.
+ * Entry data starts on ALIGNMENT so that stored entries can be used straight from a mapped pack.
+ * All values are in the packing machine's byte order.
+ */
+struct PackHeader
+{
+    static constexpr uint32_t MAGIC = 0x50445253; // "SRDP"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t ALIGNMENT = 64;
+
+    uint32_t magic, version;
+    uint32_t entryCount, reserved;
+    uint64_t entryOffset;
+    uint64_t nameOffset, nameSize;
+};
+
+/** A file in a pack, 'packedSize' bytes at 'offset' that decompress to 'size' bytes. */
+struct PackEntry
+{
+    enum Compression : uint32_t { Stored = 0, LZ4 = 1 };
+
+    uint64_t hash;
+    uint64_t offset, size, packedSize;
+    uint32_t nameOffset, nameSize;
+    uint32_t compression, reserved;
+};
+
+/** Paths in a pack are relative, generic and lexically normal, "./data\\a.png" is "data/a.png". */
+inline std::string packPath(std::string_view path)
+{
+    std::string generic(path);
+    for(auto &c : generic) if(c == '\\') c = '/';
+    auto normal = std::filesystem::path(generic).lexically_normal().generic_string();
+    if(normal.size() > 1 && normal.back() == '/') normal.pop_back();
+    return normal;
+}
+
+/** 64 bit FNV-1a of a pack path. */
+inline uint64_t packHash(std::string_view path)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(unsigned char c : path) hash = (hash ^ c) * 0x100000001b3ull;
+    return hash;
+}
+
+/** The most an `lz4Compress` of 'size' bytes can write. */
+inline size_t lz4Bound(size_t size) { return size + size / 255 + 16; }
+
+/**
+ * Compresses into the LZ4 block format, greedily with a single hash table. 'dst' must
+ * have room for `lz4Bound(size)` bytes, returns the compressed size.
+ */
+inline size_t lz4Compress(const unsigned char *src, size_t size, unsigned char *dst)
+{
+    // The format wants the last 5 bytes as literals and no match starting in the last 12.
+    constexpr size_t MIN_MATCH = 4, LAST_LITERALS = 5, MATCH_LIMIT = 12, HASH_BITS = 16;
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+    auto read32 = [src](size_t at) { uint32_t v; std::memcpy(&v, src + at, 4); return v; };
+    auto slot = [](uint32_t v) { return (v * 2654435761u) >> (32 - HASH_BITS); };
+
+    unsigned char *out = dst;
+    auto length = [&out](size_t n)
+    {
+        for(; n >= 255; n -= 255) *out++ = 255;
+        *out++ = (unsigned char)n;
+    };
+    auto literals = [&](size_t from, size_t to)
+    {
+        size_t count = to - from;
+        unsigned char *token = out++;
+        *token = (unsigned char)(std::min<size_t>(count, 15) << 4);
+        if(count >= 15) length(count - 15);
+        if(count) std::memcpy(out, src + from, count);
+        out += count;
+        return token;
+    };
+
+    size_t anchor = 0;
+    if(size > MATCH_LIMIT)
+    {
+        for(size_t i = 0; i < size - MATCH_LIMIT;)
+        {
+            uint32_t sequence = read32(i);
+            size_t candidate = table[slot(sequence)];
+            table[slot(sequence)] = (uint32_t)i;
+            if(candidate >= i || i - candidate > 0xffff || read32(candidate) != sequence)
+            {
+                // Skips ahead faster the longer nothing matched, incompressible data stays cheap.
+                i += 1 + ((i - anchor) >> 6);
+                continue;
+            }
+
+            while(i > anchor && candidate > 0 && src[i - 1] == src[candidate - 1]) { i--; candidate--; }
+            size_t end = i + MIN_MATCH;
+            while(end < size - LAST_LITERALS && src[end] == src[end - i + candidate]) end++;
+
+            unsigned char *token = literals(anchor, i);
+            size_t offset = i - candidate;
+            *out++ = (unsigned char)offset;
+            *out++ = (unsigned char)(offset >> 8);
+            size_t matchLength = end - i - MIN_MATCH;
+            *token |= (unsigned char)std::min<size_t>(matchLength, 15);
+            if(matchLength >= 15) length(matchLength - 15);
+
+            anchor = i = end;
+            table[slot(read32(i - 2))] = uint32_t(i - 2);
+        }
+    }
+    literals(anchor, size);
+    return out - dst;
+}
+
+/** Decompresses an LZ4 block of exactly 'dstSize' bytes, returns false if it is malformed. */
+inline bool lz4Decompress(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t dstSize)
+{
+    const unsigned char *in = src, *inEnd = src + srcSize;
+    unsigned char *out = dst, *outEnd = dst + dstSize;
+    auto length = [&](size_t &n)
+    {
+        for(unsigned char b = 255; b == 255; n += b)
+        {
+            if(in == inEnd) return false;
+            b = *in++;
+        }
+        return true;
+    };
+
+    while(in < inEnd)
+    {
+        unsigned token = *in++;
+        size_t count = token >> 4;
+        if(count == 15 && !length(count)) return false;
+        if(count > size_t(inEnd - in) || count > size_t(outEnd - out)) return false;
+        if(count) std::memcpy(out, in, count);
+        in += count;
+        out += count;
+        if(in == inEnd) break;
+
+        if(inEnd - in < 2) return false;
+        size_t offset = in[0] | (size_t(in[1]) << 8);
+        in += 2;
+        if(offset == 0 || offset > size_t(out - dst)) return false;
+        size_t matchLength = token & 15;
+        if(matchLength == 15 && !length(matchLength)) return false;
+        matchLength += 4;
+        if(matchLength > size_t(outEnd - out)) return false;
+
+        const unsigned char *match = out - offset;
+        if(offset >= matchLength) std::memcpy(out, match, matchLength);
+        else for(size_t i = 0; i < matchLength; i++) out[i] = match[i];
+        out += matchLength;
+    }
+    return out == outEnd;
+}
+
+#endif // PACK
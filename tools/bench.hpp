@@ -0,0 +1,19 @@
+// Helpers shared by the benchmarks in tools/.
+#pragma once
+#include <chrono>
+#include <iostream>
+
+/** Set by a failed 'check', the benchmarks return 1 if it is. */
+inline bool failed = false;
+
+inline void check(bool condition, const char *what)
+{
+    if(condition) return;
+    std::cerr << "Failed: " << what << std::endl;
+    failed = true;
+}
+
+inline double seconds(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
@@ -0,0 +1,185 @@
+// Stress test and scaling benchmark of srd::core::jobs.
+//   g++ tools/jobs_bench.cpp 3rd-party/glad.c -o jobs_bench -std=c++20 -O2 -I. -I3rd-party/include -I3rd-party/include/glm -lglfw -pthread
+//   ./jobs_bench [stress rounds] [max workers]
+// The stress test is meant to run under ThreadSanitizer (and AddressSanitizer, for jobs waited on from the stack):
+//   g++ tools/jobs_bench.cpp 3rd-party/glad.c -o jobs_tsan -std=c++20 -O1 -g -fsanitize=thread -I. -I3rd-party/include -I3rd-party/include/glm -lglfw -pthread
+#define SRD_CORE_IMPLEMENTATION
+#include "core.hpp"
+#include "bench.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+
+using namespace srd::core;
+
+/** Every way of scheduling and waiting the system offers, over and over. */
+static void stress(int rounds)
+{
+    for(int round = 0; round < rounds; ++round)
+    {
+        std::vector<int> data(100000, 0);
+        jobs::parallel_for(0, data.size(), [&](size_t first, size_t last)
+        {
+            for(size_t i = first; i < last; ++i) data[i] += i % 7;
+        });
+        bool filled = true;
+        for(size_t i = 0; i < data.size(); ++i) filled &= data[i] == int(i % 7);
+        check(filled, "parallel_for visits every index once");
+
+        // A chain run in reverse, each job waits for its predecessor.
+        int a = 0, b = 0, c = 0;
+        jobs::job ja([&]() { a = 1; }), jb([&]() { b = a + 1; }), jc([&]() { c = a + b; });
+        jobs::depend(jb, ja);
+        jobs::depend(jc, jb);
+        jobs::run(jc);
+        jobs::run(jb);
+        jobs::run(ja);
+        jobs::wait(jc);
+        check(c == 3, "dependencies run in order");
+
+        ja.reset();
+        jb.reset();
+        jc.reset();
+        a = b = c = 0;
+        jobs::run(ja);
+        jobs::run(jb);
+        jobs::run(jc);
+        jobs::wait(jc);
+        check(c == 3, "reset jobs run again");
+
+        // Short lived jobs on the stack of a thread outside of the system, destroyed right after waiting.
+        std::atomic<int> count = 0;
+        std::thread foreign([&count]()
+        {
+            for(int i = 0; i < 64; ++i)
+            {
+                jobs::job j([&count]() { count.fetch_add(1, std::memory_order_relaxed); });
+                jobs::run(j);
+                jobs::wait(j);
+            }
+            std::vector<jobs::job> batch(64);
+            for(auto &j : batch)
+            {
+                j.work = [&count]() { count.fetch_add(1, std::memory_order_relaxed); };
+                jobs::run(j);
+            }
+            for(auto &j : batch) jobs::wait(j);
+        });
+        foreign.join();
+        check(count == 128, "jobs from other threads run");
+
+        // Nested parallel_for, waiting threads help with each other's ranges.
+        std::atomic<size_t> sum = 0;
+        jobs::parallel_for(0, 64, [&](size_t first, size_t last)
+        {
+            for(size_t i = first; i < last; ++i)
+                jobs::parallel_for(0, 1000, [&](size_t x, size_t y) { sum.fetch_add(y - x, std::memory_order_relaxed); });
+        });
+        check(sum == 64000, "nested parallel_for");
+
+        // Children spawned by a running job are waited on through it.
+        std::vector<jobs::job> children(32);
+        std::atomic<int> ran = 0;
+        jobs::job parent;
+        parent.work = [&]()
+        {
+            for(auto &child : children)
+            {
+                child.work = [&ran]() { ran.fetch_add(1, std::memory_order_relaxed); };
+                child.parent = &parent;
+                jobs::run(child);
+            }
+        };
+        jobs::run(parent);
+        jobs::wait(parent);
+        check(ran == 32, "parents wait for their children");
+
+        // Main thread jobs only run while the main thread waits.
+        std::thread::id mainId = std::this_thread::get_id(), ranOn;
+        jobs::job mainJob([&ranOn]() { ranOn = std::this_thread::get_id(); });
+        mainJob.mainThread = true;
+        jobs::job spawner([&mainJob]() { jobs::run(mainJob); });
+        jobs::run(spawner);
+        jobs::wait(spawner);
+        jobs::wait(mainJob);
+        check(ranOn == mainId, "main thread jobs run on the main thread");
+    }
+}
+
+static uint64_t serialFibonacci(int n)
+{
+    return n < 2 ? n : serialFibonacci(n - 1) + serialFibonacci(n - 2);
+}
+
+/** Fork-join recursion with a job per split down to small subproblems. */
+static uint64_t fibonacci(int n)
+{
+    if(n < 20) return serialFibonacci(n);
+    uint64_t left;
+    jobs::job j([&left, n]() { left = fibonacci(n - 1); });
+    jobs::run(j);
+    uint64_t right = fibonacci(n - 2);
+    jobs::wait(j);
+    return left + right;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 100;
+    unsigned int maxWorkers = argc > 2 ? std::atoi(argv[2]) : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    auto begin = std::chrono::steady_clock::now();
+    jobs::init(3);
+    stress(rounds);
+    jobs::shutdown();
+    std::cout << "Stress test: " << rounds << " rounds in " << seconds(begin) << " s, " << (failed ? "FAILED" : "ok") << std::endl;
+    if(failed) return 1;
+
+    // Compute bound, tiny ranges and fork-join, relative to the same work without any jobs.
+    std::vector<float> values(1 << 22);
+    std::iota(values.begin(), values.end(), 0.f);
+    auto heavy = [&values](size_t first, size_t last)
+    {
+        for(size_t i = first; i < last; ++i)
+            for(int k = 0; k < 16; ++k) values[i] = std::sqrt(values[i] + 1.f);
+    };
+    std::vector<std::atomic<int>> counters(1 << 20);
+    auto tiny = [&counters](size_t first, size_t last)
+    {
+        for(size_t i = first; i < last; ++i) counters[i].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    begin = std::chrono::steady_clock::now();
+    heavy(0, values.size());
+    double serialHeavy = seconds(begin);
+    begin = std::chrono::steady_clock::now();
+    tiny(0, counters.size());
+    double serialTiny = seconds(begin);
+    begin = std::chrono::steady_clock::now();
+    check(serialFibonacci(32) == 2178309, "fibonacci(32)");
+    double serialFork = seconds(begin);
+    std::cout << "Serial: parallel_for " << serialHeavy * 1e3 << " ms, tiny ranges " << serialTiny * 1e3
+              << " ms, fork-join " << serialFork * 1e3 << " ms" << std::endl;
+
+    for(unsigned int workers = 1; workers <= maxWorkers; workers = workers < 4 ? workers + 1 : workers * 2)
+    {
+        jobs::init(workers);
+        begin = std::chrono::steady_clock::now();
+        jobs::parallel_for(0, values.size(), heavy, 1024);
+        double timeHeavy = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        jobs::parallel_for(0, counters.size(), tiny, 1);
+        double timeTiny = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        auto result = fibonacci(32);
+        double timeFork = seconds(begin);
+        auto threads = jobs::threadCount();
+        jobs::shutdown();
+
+        check(result == 2178309, "fibonacci(32)");
+        std::cout << threads << " threads (" << workers << " workers): parallel_for " << timeHeavy * 1e3 << " ms ("
+                  << serialHeavy / timeHeavy << "x), tiny ranges " << timeTiny * 1e3 << " ms (" << serialTiny / timeTiny
+                  << "x), fork-join " << timeFork * 1e3 << " ms (" << serialFork / timeFork << "x)" << std::endl;
+    }
+    return failed ? 1 : 0;
+}
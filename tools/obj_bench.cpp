@@ -0,0 +1,162 @@
+// Benchmark of the parallel OBJ importer (importObj) on a generated multi-million triangle mesh.
+//   g++ tools/obj_bench.cpp log.cpp 3rd-party/glad.c -o obj_bench -std=c++20 -O2 -I. -I3rd-party/include -I3rd-party/include/glm -lglfw -pthread
+//   ./obj_bench [grid size | file.obj] [max workers]
+// A grid of N x N quads has 2N² triangles, the default of 1200 is close to 3 million. Its faces mix
+// every corner format, negative indices, groups, CRLF line ends and concave polygons. The result is
+// checked against tinyobj followed by the unordered_map weld the importer replaced.
+#define SRD_CORE_IMPLEMENTATION
+#include "core.hpp"
+#undef SRD_CORE_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+#undef TINYOBJLOADER_IMPLEMENTATION
+#include "log.hpp"
+#include "util.hpp"
+#include "bench.hpp"
+#include <random>
+
+using namespace srd::core;
+
+static bool generate(const std::string &path, int n)
+{
+    std::ofstream out(path, std::ios::binary);
+    if(!out) return false;
+
+    std::mt19937 random(1);
+    auto uniform = [&random](float min, float max) { return std::uniform_real_distribution<float>(min, max)(random); };
+    out << "# generated by tools/obj_bench.cpp\no grid\n";
+    for(int y = 0; y <= n; ++y)
+        for(int x = 0; x <= n; ++x)
+            out << "v " << float(x) / n << " " << float(y) / n << " " << uniform(-.01f, .01f) << "\n";
+    // Every other row and column gets a texcoord, so corners share them.
+    for(int y = 0; y <= n; y += 2)
+        for(int x = 0; x <= n; x += 2)
+            out << "vt " << float(x) / n << " " << float(y) / n << "\n";
+    for(int i = 0; i < 64; ++i)
+        out << "vn " << uniform(-1, 1) << " " << uniform(-1, 1) << " " << uniform(-1, 1) << "\n";
+
+    long positions = long(n + 1) * (n + 1), texcoords = long(n / 2 + 1) * (n / 2 + 1);
+    auto position = [n](int x, int y) { return long(y) * (n + 1) + x + 1; };
+    auto texcoord = [n](int x, int y) { return long(y / 2) * (n / 2 + 1) + x / 2 + 1; };
+    for(int y = 0; y < n; ++y)
+    {
+        if(y % 97 == 0) out << "g part" << y << "\r\n";
+        for(int x = 0; x < n; ++x)
+        {
+            int cx[] = { x, x + 1, x + 1, x }, cy[] = { y, y, y + 1, y + 1 };
+            float kind = uniform(0, 1);
+            out << "f";
+            if(kind < .5f)
+                for(int c = 0; c < 4; ++c)
+                    out << " " << position(cx[c], cy[c]) << "/" << texcoord(cx[c], cy[c]) << "/" << random() % 64 + 1;
+            else if(kind < .8f)
+            {
+                for(int c : { 0, 1, 2 }) out << " " << position(cx[c], cy[c]) << "/" << texcoord(cx[c], cy[c]);
+                out << "\nf ";
+                for(int c : { 0, 2, 3 }) out << " " << position(cx[c], cy[c]) << "//3\t";
+                out << "\r";
+            }
+            else if(kind < .9f)
+                for(int c = 0; c < 4; ++c)
+                    out << " " << position(cx[c], cy[c]) - 1 - positions << "/" << texcoord(cx[c], cy[c]) - 1 - texcoords;
+            else
+                for(int c = 0; c < 4; ++c) out << " " << position(cx[c], cy[c]);
+            out << "\n";
+        }
+    }
+
+    // Concave stars of new positions, referenced relatively.
+    for(int k = 0; k < 2000; ++k)
+    {
+        int corners = 5 + random() % 4;
+        for(int i = 0; i < corners; ++i)
+        {
+            float radius = i % 2 ? .4f : 1.f, angle = 2.f * glm::pi<float>() * i / corners;
+            out << "v " << radius * std::cos(angle) << " " << radius * std::sin(angle) << " " << (k % 5 ? 0.f : .3f * std::cos(angle)) << "\n";
+        }
+        out << "f";
+        for(int i = 0; i < corners; ++i) out << " " << i - corners;
+        out << "\n";
+    }
+    return bool(out);
+}
+
+/** What readMesh did before importObj: tinyobj, then a weld through an unordered_map. */
+static bool reference(const std::string &path, std::vector<gfx::vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    std::ifstream in(path);
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warning, error;
+    if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, &in)) return false;
+
+    std::unordered_map<gfx::vertex, unsigned int> welded;
+    for(const auto &shape : shapes)
+        for(const auto &index : shape.mesh.indices)
+        {
+            gfx::vertex v {};
+            v.position = { attrib.vertices[3 * index.vertex_index], attrib.vertices[3 * index.vertex_index + 1], attrib.vertices[3 * index.vertex_index + 2] };
+            if(index.normal_index >= 0)
+                v.normal = { attrib.normals[3 * index.normal_index], attrib.normals[3 * index.normal_index + 1], attrib.normals[3 * index.normal_index + 2] };
+            if(index.texcoord_index >= 0)
+                v.texcoord = { attrib.texcoords[2 * index.texcoord_index], attrib.texcoords[2 * index.texcoord_index + 1] };
+            auto [it, inserted] = welded.try_emplace(v, (unsigned int)vertices.size());
+            if(inserted) vertices.push_back(v);
+            indices.push_back(it->second);
+        }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string path = "obj_bench.obj";
+    if(argc > 1 && std::string_view(argv[1]).ends_with(".obj")) path = argv[1];
+    else
+    {
+        int n = argc > 1 ? std::atoi(argv[1]) : 1200;
+        std::cout << "Generating a " << n << "x" << n << " grid..." << std::endl;
+        if(n < 2 || !generate(path, n))
+        {
+            std::cerr << "Could not write '" << path << "'" << std::endl;
+            return 1;
+        }
+    }
+    unsigned int maxWorkers = argc > 2 ? std::atoi(argv[2]) : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    std::vector<gfx::vertex> expectedVertices;
+    std::vector<unsigned int> expectedIndices;
+    auto begin = std::chrono::steady_clock::now();
+    if(!reference(path, expectedVertices, expectedIndices))
+    {
+        std::cerr << "tinyobj could not read '" << path << "'" << std::endl;
+        return 1;
+    }
+    double timeReference = seconds(begin);
+    std::cout << expectedIndices.size() / 3 << " triangles, " << expectedVertices.size() << " vertices, tinyobj and weld "
+              << timeReference * 1e3 << " ms" << std::endl;
+
+    for(unsigned int workers = 1; workers <= maxWorkers; workers = workers < 4 ? workers + 1 : workers * 2)
+    {
+        jobs::init(workers);
+        std::vector<gfx::vertex> vertices;
+        std::vector<unsigned int> indices;
+        begin = std::chrono::steady_clock::now();
+        bool read = importObj(path, vertices, indices);
+        double time = seconds(begin);
+        auto threads = jobs::threadCount();
+        jobs::shutdown();
+
+        check(read, "importObj reads the file");
+        check(indices == expectedIndices, "indices match the reference");
+        check(vertices.size() == expectedVertices.size()
+            && std::memcmp(vertices.data(), expectedVertices.data(), vertices.size() * sizeof(gfx::vertex)) == 0,
+            "vertices match the reference");
+        std::cout << threads << " threads: importObj " << time * 1e3 << " ms (" << timeReference / time << "x)" << std::endl;
+        if(failed) return 1;
+    }
+    return 0;
+}
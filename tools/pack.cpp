@@ -0,0 +1,111 @@
+// Packs files and directories into one asset pack (see pack.hpp).
+//   g++ tools/pack.cpp -o pack -std=c++20 -I.
+//   ./pack data.pack data
+#include "pack.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <output.pack> <file or directory>..." << std::endl;
+        return 1;
+    }
+
+    // Entries are stored in path order, so that a directory is read from one stretch of the disk.
+    std::vector<std::string> paths;
+    for(int i = 2; i < argc; i++)
+    {
+        if(!fs::is_directory(argv[i]))
+        {
+            paths.push_back(packPath(argv[i]));
+            continue;
+        }
+        for(const auto &file : fs::recursive_directory_iterator(argv[i]))
+            if(file.is_regular_file()) paths.push_back(packPath(file.path().string()));
+    }
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    std::ofstream ofs(argv[1], std::ios::binary);
+    if(!ofs.is_open())
+    {
+        std::cerr << "Could not write '" << argv[1] << "'!" << std::endl;
+        return 1;
+    }
+
+    auto pad = [&ofs]()
+    {
+        static const char zeros[PackHeader::ALIGNMENT] = {};
+        ofs.write(zeros, -(uint64_t)ofs.tellp() & (PackHeader::ALIGNMENT - 1));
+    };
+
+    PackHeader header {};
+    header.magic = PackHeader::MAGIC;
+    header.version = PackHeader::VERSION;
+    header.entryCount = paths.size();
+    ofs.write((const char*)&header, sizeof(header));
+
+    std::vector<PackEntry> entries;
+    std::string names;
+    std::vector<unsigned char> packed;
+    uint64_t rawTotal = 0, packedTotal = 0;
+    for(const auto &path : paths)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        if(!ifs.good() && !ifs.eof())
+        {
+            std::cerr << "Could not read '" << path << "'!" << std::endl;
+            return 1;
+        }
+
+        // Only kept compressed if it saves an eighth, stored entries are read without a copy.
+        packed.resize(lz4Bound(data.size()));
+        size_t packedSize = lz4Compress(data.data(), data.size(), packed.data());
+        bool compress = packedSize < data.size() - data.size() / 8;
+
+        pad();
+        PackEntry &entry = entries.emplace_back();
+        entry.hash = packHash(path);
+        entry.offset = ofs.tellp();
+        entry.size = data.size();
+        entry.packedSize = compress ? packedSize : data.size();
+        entry.compression = compress ? PackEntry::LZ4 : PackEntry::Stored;
+        entry.nameOffset = names.size();
+        entry.nameSize = path.size();
+        names += path;
+        ofs.write((const char*)(compress ? packed.data() : data.data()), entry.packedSize);
+
+        rawTotal += entry.size;
+        packedTotal += entry.packedSize;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.hash < b.hash; });
+    for(size_t i = 1; i < entries.size(); i++)
+        if(entries[i].hash == entries[i - 1].hash)
+            std::cerr << "Warning: '" << names.substr(entries[i].nameOffset, entries[i].nameSize)
+                      << "' shares its hash, lookups compare names." << std::endl;
+
+    pad();
+    header.entryOffset = ofs.tellp();
+    ofs.write((const char*)entries.data(), entries.size() * sizeof(PackEntry));
+    header.nameOffset = ofs.tellp();
+    header.nameSize = names.size();
+    ofs.write(names.data(), names.size());
+    ofs.seekp(0);
+    ofs.write((const char*)&header, sizeof(header));
+    ofs.close();
+    if(!ofs)
+    {
+        std::cerr << "Could not write '" << argv[1] << "'!" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Packed " << entries.size() << " files, " << rawTotal << " -> " << packedTotal << " bytes" << std::endl;
+    return 0;
+}
@@ -0,0 +1,143 @@
+// Headless benchmark of the render preparation: prepare, per-thread sort and merge of the draws.
+//   g++ tools/prepare_bench.cpp 3rd-party/glad.c -o prepare_bench -std=c++20 -O2 -I. -I3rd-party/include -I3rd-party/include/glm -lglfw -pthread
+//   ./prepare_bench [entities] [max workers]
+// Entities are split into chunks the way Game::prepareDraws splits them, every entity draws each
+// submesh of its mesh. The draws only carry GL names, no GL objects are created. The merged order
+// is checked against all of the draws prepared on one thread and sorted at once.
+#define SRD_CORE_IMPLEMENTATION
+#include "core.hpp"
+#include "bench.hpp"
+#include <cstdlib>
+#include <random>
+
+using namespace srd::core;
+
+struct entity
+{
+    math::transform transform;
+    unsigned int mesh;
+};
+
+/** Stands in for the meshes and materials of a level, a few submeshes each. */
+struct mesh_table
+{
+    std::vector<std::vector<gfx::submesh>> submeshes;
+    std::vector<std::vector<unsigned int>> textureIds;
+    std::vector<unsigned int> shaderIds;
+};
+
+/** What ECStaticMesh::render does per entity. */
+static void render(const gfx::frame_packet &packet, const mesh_table &table, std::span<const entity> entities, std::vector<gfx::draw_command> &commands)
+{
+    for(const auto &e : entities)
+        for(size_t i = 0; i < table.submeshes[e.mesh].size(); ++i)
+        {
+            gfx::draw_command draw {
+                .mesh_     = nullptr,
+                .submesh_  = &table.submeshes[e.mesh][i],
+                .texture_  = nullptr,
+                .shader    = nullptr,
+                .textureId = table.textureIds[e.mesh][i],
+                .shaderId  = table.shaderIds[e.mesh],
+                .tiling    = glm::vec2(1.f),
+                .model     = e.transform.matrix
+            };
+            if(packet.prepare(draw)) commands.push_back(draw);
+        }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? std::atoll(argv[1]) : 100000;
+    unsigned int maxWorkers = argc > 2 ? std::atoi(argv[2]) : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0, 1);
+
+    mesh_table table;
+    for(int m = 0; m < 32; ++m)
+    {
+        auto &submeshes = table.submeshes.emplace_back(1 + random() % 4);
+        auto &textureIds = table.textureIds.emplace_back();
+        for(auto &s : submeshes)
+        {
+            glm::vec3 center(unit(random) - .5f, unit(random), unit(random) - .5f), extent(.2f + unit(random));
+            s.bounds = { center - extent * .5f, center + extent * .5f };
+            textureIds.push_back(1 + random() % 48);
+        }
+        table.shaderIds.push_back(1 + random() % 3);
+    }
+
+    // The camera sees the part of the world in front of it, the shadow map most of the rest.
+    float world = 150.f;
+    std::vector<entity> entities(count);
+    for(auto &e : entities)
+    {
+        e.transform = {
+            .position = { world * (unit(random) - .5f), 0, world * (unit(random) - .5f) },
+            .rotation = glm::angleAxis(unit(random) * 2.f * glm::pi<float>(), glm::vec3(0, 1, 0)),
+            .scale    = glm::vec3(.5f + unit(random) * 2.f),
+        };
+        e.transform.update();
+        e.mesh = random() % table.submeshes.size();
+    }
+
+    gfx::frame_packet packet;
+    packet.view = gfx::camera(1920, 1080, .1f, 100.f);
+    packet.view.transform = { .position = { 0, 2, 0 }, .rotation = { 1, 0, 0, 0 }, .scale = { 1, 1, 1 } };
+    packet.view.update();
+    packet.lightSpaceMatrix = glm::ortho(-60.f, 60.f, -60.f, 60.f, -50.f, 100.f)
+                            * glm::lookAt(glm::vec3(1, 1.4f, -.6f), glm::vec3(0), glm::vec3(0, 1, 0));
+    packet.setup();
+
+    // What every thread count has to match.
+    const int frames = 20;
+    std::vector<gfx::draw_command> expected;
+    auto begin = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < frames; ++frame)
+    {
+        expected.clear();
+        render(packet, table, entities, expected);
+        std::sort(expected.begin(), expected.end(), [](const auto &a, const auto &b) { return a.key < b.key; });
+    }
+    double timeSerial = seconds(begin) / frames;
+    std::cout << count << " entities, " << expected.size() << " visible draws, serial prepare and sort "
+              << timeSerial * 1e3 << " ms" << std::endl;
+
+    std::vector<std::vector<gfx::draw_command>> commandBuffers;
+    for(unsigned int workers = 1; workers <= maxWorkers; workers = workers < 4 ? workers + 1 : workers * 2)
+    {
+        jobs::init(workers);
+        begin = std::chrono::steady_clock::now();
+        for(int frame = 0; frame < frames; ++frame)
+        {
+            constexpr size_t minEntitiesPerThread = 1024;
+            size_t threads = std::clamp<size_t>(count / minEntitiesPerThread, 1, jobs::threadCount());
+            commandBuffers.resize(threads);
+            jobs::parallel_for(0, threads, [&](size_t first, size_t last)
+            {
+                for(size_t index = first; index < last; ++index)
+                {
+                    auto &commands = commandBuffers[index];
+                    commands.clear();
+                    render(packet, table, std::span<const entity>(entities).subspan(
+                        count * index / threads, count * (index + 1) / threads - count * index / threads), commands);
+                    std::sort(commands.begin(), commands.end(), [](const auto &a, const auto &b) { return a.key < b.key; });
+                }
+            });
+            packet.merge(commandBuffers);
+        }
+        double time = seconds(begin) / frames;
+        auto threads = jobs::threadCount();
+        jobs::shutdown();
+
+        // Draws with equal keys may come out in any order, the keys may not.
+        bool same = packet.draws.size() == expected.size();
+        for(size_t i = 0; same && i < expected.size(); ++i) same = packet.draws[i].key == expected[i].key;
+        check(same, "merged keys match the serial sort");
+        std::cout << threads << " threads: " << commandBuffers.size() << " buffers, " << time * 1e3 << " ms per frame ("
+                  << timeSerial / time << "x)" << std::endl;
+        if(failed) return 1;
+    }
+    return 0;
+}
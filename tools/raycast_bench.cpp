@@ -0,0 +1,137 @@
+// Benchmark of srd::core::math::triangle_bvh on the level and sphere meshes.
+//   g++ tools/raycast_bench.cpp log.cpp 3rd-party/glad.c -o raycast_bench -std=c++20 -O2 -I. -I3rd-party/include -I3rd-party/include/glm -lglfw -pthread
+//   ./raycast_bench [workers] [rays checked by brute force]
+// Meshes are read like the game reads them: imported from data/models and welded. Coherent rays come
+// from a 512x512 camera in 2x2 pixel packets, incoherent ones from random points around the mesh.
+#define SRD_CORE_IMPLEMENTATION
+#include "core.hpp"
+#undef SRD_CORE_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
+#include "log.hpp"
+#include "util.hpp"
+#include "bench.hpp"
+#include <random>
+
+using namespace srd::core;
+using namespace srd::core::math;
+
+/** Every triangle against the ray, the closest one or the first one found. */
+static float bruteForce(const std::vector<glm::vec3> &positions, const std::vector<unsigned int> &indices, const ray &r, bool any)
+{
+    float closest = INFINITY;
+    for(size_t i = 0; i < indices.size(); i += 3)
+    {
+        auto corner = positions[indices[i]], edge1 = positions[indices[i + 1]] - corner, edge2 = positions[indices[i + 2]] - corner;
+        auto p = glm::cross(r.direction, edge2), s = r.origin - corner;
+        float inverse = 1.f / glm::dot(edge1, p), u = glm::dot(s, p) * inverse;
+        if(!(u >= 0 && u <= 1)) continue;
+        auto q = glm::cross(s, edge1);
+        float v = glm::dot(r.direction, q) * inverse, t = glm::dot(edge2, q) * inverse;
+        if(!(v >= 0 && u + v <= 1) || !(t >= 0 && t < std::min(closest, r.length))) continue;
+        closest = t;
+        if(any) break;
+    }
+    return closest;
+}
+
+static void run(const char *path, size_t checked)
+{
+    std::vector<gfx::vertex> vertices;
+    std::vector<unsigned int> vertexIndices, indices;
+    std::vector<glm::vec3> positions;
+    if(!importObj(path, vertices, vertexIndices))
+    {
+        std::cerr << "Could not load '" << path << "'" << std::endl;
+        failed = true;
+        return;
+    }
+    gfx::mesh::weld(vertices, vertexIndices, positions, indices);
+
+    auto begin = std::chrono::steady_clock::now();
+    triangle_bvh bvh(positions.data(), indices.data(), indices.size());
+    double timeBuild = seconds(begin);
+    std::cout << path << ": " << indices.size() / 3 << " triangles, built in " << timeBuild * 1e3 << " ms, "
+              << bvh.nodes.size() << " nodes (" << bvh.bytes() << " bytes)" << std::endl;
+
+    auto box = bvh.bounds();
+    auto center = box.center();
+    float radius = glm::length(box.max - box.min) * .5f;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> uniform(-1, 1), unit(0, 1);
+
+    const size_t count = 512 * 512;
+    std::vector<ray> coherent(count), incoherent(count);
+    glm::vec3 eye = center + glm::vec3(.3f, .4f, 1.f) * radius * 2.f, forward = glm::normalize(center - eye);
+    glm::vec3 right = glm::normalize(glm::cross(forward, { 0, 1, 0 })), up = glm::cross(right, forward);
+    for(size_t y = 0; y < 512; ++y)
+        for(size_t x = 0; x < 512; ++x)
+        {
+            float sx = (x + .5f) / 256.f - 1.f, sy = (y + .5f) / 256.f - 1.f;
+            coherent[((y / 2) * 256 + x / 2) * 4 + (y % 2) * 2 + x % 2] = { eye, glm::normalize(forward + (right * sx + up * sy) * .5f), radius * 4.f };
+        }
+    for(size_t i = 0; i < count; ++i)
+    {
+        glm::vec3 direction;
+        do direction = { uniform(random), uniform(random), uniform(random) };
+        while(glm::length(direction) > 1 || glm::length(direction) < .1f);
+        auto &r = incoherent[i];
+        r.origin = center + glm::normalize(direction) * radius * 2.f;
+        r.direction = glm::normalize(box.min + (box.max - box.min) * glm::vec3(unit(random), unit(random), unit(random)) - r.origin);
+        // Every other one is a segment that may stop short of the mesh.
+        r.length = i % 2 ? radius * 4.f : radius * (1.f + 2.f * unit(random));
+    }
+
+    for(const auto *rays : { &coherent, &incoherent })
+    {
+        std::vector<triangle_bvh::hit> single(count), packet(count), anyPacket(count);
+        std::vector<char> anySingle(count);
+
+        begin = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; ++i) bvh.intersect((*rays)[i], single[i]);
+        double timeSingle = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        bvh.intersect(std::span<const ray>(*rays), std::span<triangle_bvh::hit>(packet));
+        double timePacket = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; ++i) anySingle[i] = bvh.occluded((*rays)[i]);
+        double timeAnySingle = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        bvh.occluded(std::span<const ray>(*rays), std::span<triangle_bvh::hit>(anyPacket));
+        double timeAnyPacket = seconds(begin);
+
+        size_t hits = 0, mismatched = 0;
+        for(size_t i = 0; i < count; ++i)
+        {
+            hits += bool(single[i]);
+            mismatched += single[i].distance != packet[i].distance || bool(anySingle[i]) != bool(single[i])
+                       || bool(anyPacket[i]) != bool(single[i]);
+        }
+        check(!mismatched, "packets and single rays agree");
+
+        size_t wrong = 0;
+        for(size_t i = 0; i < count; i += count / std::max<size_t>(checked, 1))
+        {
+            float closest = bruteForce(positions, indices, (*rays)[i], false);
+            wrong += std::abs(closest - single[i].distance) > 1e-5f * radius && !(std::isinf(closest) && !single[i]);
+            wrong += std::isinf(bruteForce(positions, indices, (*rays)[i], true)) == bool(anySingle[i]);
+        }
+        check(!wrong, "hits match brute force");
+
+        auto rate = [](double time) { return count / time * 1e-6; };
+        std::cout << "  " << (rays == &coherent ? "coherent:   " : "incoherent: ") << 100. * hits / count << "% hit, closest "
+                  << rate(timeSingle) << " Mrays/s single, " << rate(timePacket) << " Mrays/s packets, any "
+                  << rate(timeAnySingle) << " Mrays/s single, " << rate(timeAnyPacket) << " Mrays/s packets" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    jobs::init(argc > 1 ? std::atoi(argv[1]) : 0);
+    size_t checked = argc > 2 ? std::atoll(argv[2]) : 4096;
+    for(auto path : { "data/models/Portal2UV_Fixed.obj", "data/models/sphere.obj" })
+        run(path, checked);
+    jobs::shutdown();
+    return failed ? 1 : 0;
+}
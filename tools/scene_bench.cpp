@@ -0,0 +1,92 @@
+// Benchmark of the scene file parser (SceneInfo) on a generated scene.
+//   g++ tools/scene_bench.cpp log.cpp 3rd-party/glad.c 3rd-party/imgui/*.cpp 3rd-party/rigidbox/source/*.cpp -o scene_bench -std=c++20 -O2 -I. -I3rd-party/include -I3rd-party/imgui -I3rd-party/rigidbox/include -lglfw -pthread
+//   ./scene_bench [entities] [runs] [scene path]
+// SceneInfo lives in main.cpp, which is compiled in with its main() renamed. The resource manager
+// needs a GL context, so a window is opened, [glb] sections are not generated.
+#define main srdMain
+#include "main.cpp"
+#undef main
+#include <random>
+
+static double milliseconds(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/** Entities like those of the level scenes, a comment every tenth. */
+static bool generate(const std::string &path, size_t count)
+{
+    std::ofstream out(path);
+    if(!out) return false;
+
+    std::mt19937 random(1);
+    auto uniform = [&random](float min, float max) { return std::uniform_real_distribution<float>(min, max)(random); };
+    const char *textures[] = { "wall", "sandstone", "cobblestone" }, *meshes[] = { "cube", "sphere", "portal" };
+
+    out << "[_info]\nname = Bench\n\n";
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(i % 10 == 0) out << "; a comment line\n";
+        out << "[entity]\n"
+            << "components = StaticMesh RigidBody\n"
+            << "position = " << uniform(-500, 500) << " " << uniform(0, 50) << " " << uniform(-500, 500) << "\n"
+            << "rotation = 1 0 0 0\n"
+            << "scale    = " << uniform(.5f, 3) << " 1 1\n"
+            << "rigidbody.size   = 1 1 1\n"
+            << "rigidbody.static = 1\n"
+            << "rigidbody.offset = 0 0 0\n"
+            << "staticmesh.texture = " << textures[random() % 3] << "\n"
+            << "staticmesh.mesh = " << meshes[random() % 3] << "\n"
+            << "staticmesh.texture.tiling = 1 1\n"
+            << "staticmesh.batch = 1\n\n";
+    }
+    return bool(out);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? std::atoll(argv[1]) : 100000;
+    int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+    std::string path = argc > 3 ? argv[3] : "scene_bench.ini";
+
+    if(!generate(path, count))
+    {
+        std::cerr << "Could not write '" << path << "'" << std::endl;
+        return 1;
+    }
+
+    core::window::window win { 64, 64, "Scene benchmark" };
+    ResourceManager resourceManager;
+
+    double best = 0, bestLookups = 0;
+    for(int run = 0; run < runs; ++run)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        SceneInfo info(path, resourceManager);
+        double parse = milliseconds(begin);
+
+        // Every property read once, like the components do when they are created.
+        begin = std::chrono::steady_clock::now();
+        double sum = 0;
+        for(const auto &e : info.entities)
+        {
+            auto properties = info.properties(e);
+            sum += properties["rigidbody.size"].valVec3.x + properties["staticmesh.mesh"].valString.size()
+                 + properties["staticmesh.texture.tiling"].valVec2.x + e.position.y + e.componentCount;
+        }
+        double lookups = milliseconds(begin);
+
+        if(info.entities.size() != count)
+        {
+            std::cerr << "Parsed " << info.entities.size() << " of " << count << " entities" << std::endl;
+            return 1;
+        }
+        if(run == 0 || parse < best) best = parse;
+        if(run == 0 || lookups < bestLookups) bestLookups = lookups;
+        std::cout << "Run " << run << ": parsed in " << parse << " ms, properties read in " << lookups << " ms (" << sum << ")" << std::endl;
+    }
+
+    std::cout << count << " entities, best of " << runs << ": parsed in " << best << " ms ("
+              << count / best * 1e3 << " entities/s), properties read in " << bestLookups << " ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Benchmark of srd::core::math::aabb_tree with randomly moving boxes.
+//   g++ tools/tree_bench.cpp 3rd-party/glad.c -o tree_bench -std=c++20 -O2 -I. -I3rd-party/include -I3rd-party/include/glm -lglfw -pthread
+//   ./tree_bench [object counts...]
+// Runs 10k, 100k and 1M objects by default. The queries are checked against linear scans as well.
+#define SRD_CORE_IMPLEMENTATION
+#include "core.hpp"
+#include "bench.hpp"
+#include <cstdlib>
+#include <random>
+
+using namespace srd::core;
+using namespace srd::core::math;
+
+/** Checks the links, heights and boxes below 'n', returns its height and counts the leaves. */
+static int validate(const aabb_tree &tree, uint32_t n, uint32_t parent, size_t &leaves)
+{
+    if(n == aabb_tree::null_node) return -1;
+    const auto &node = tree.nodes[n];
+    check(node.parent == parent, "nodes link to their parent");
+    if(node.leaf())
+    {
+        check(node.height == 0, "leaves have height 0");
+        leaves++;
+        return 0;
+    }
+    int left = validate(tree, node.left, n, leaves), right = validate(tree, node.right, n, leaves);
+    check(node.height == 1 + std::max(left, right), "heights are up to date");
+    check(node.box.contains(tree.nodes[node.left].box) && node.box.contains(tree.nodes[node.right].box), "boxes contain their children");
+    return node.height;
+}
+
+static void run(size_t count)
+{
+    std::mt19937 random(1);
+    // About one object per 1000 cubic units, in a flat world like the levels.
+    float world = 10.f * std::cbrt(float(count));
+    std::uniform_real_distribution<float> position(-world / 2, world / 2), size(.5f, 3.f), step(-.05f, .05f), direction(-1, 1);
+
+    std::vector<aabb> boxes(count);
+    for(auto &box : boxes)
+    {
+        glm::vec3 center(position(random), position(random) * .1f, position(random)), extent(size(random), size(random), size(random));
+        box = { center - extent * .5f, center + extent * .5f };
+    }
+
+    aabb_tree tree;
+    std::vector<uint32_t> leaves(count);
+    auto begin = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < count; ++i) leaves[i] = tree.insert(boxes[i], i);
+    double timeInsert = seconds(begin);
+
+    // Everything moves a little every frame, as in a physics step.
+    std::vector<glm::vec3> velocities(count);
+    for(auto &v : velocities) v = { step(random), step(random) * .2f, step(random) };
+    const int frames = 10;
+    size_t reinserted = 0;
+    begin = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < frames; ++frame)
+        for(size_t i = 0; i < count; ++i)
+        {
+            boxes[i].min += velocities[i];
+            boxes[i].max += velocities[i];
+            reinserted += tree.move(leaves[i], boxes[i], velocities[i]);
+        }
+    double timeMove = seconds(begin) / frames;
+
+    size_t leafCount = 0;
+    validate(tree, tree.root, aabb_tree::null_node, leafCount);
+    check(leafCount == count && tree.size() == count, "every object has a leaf");
+
+    const int queryCount = 1000;
+    std::vector<aabb> boxQueries(queryCount);
+    std::vector<sphere> sphereQueries(queryCount);
+    std::vector<ray> rays(queryCount);
+    for(int i = 0; i < queryCount; ++i)
+    {
+        glm::vec3 center(position(random), position(random) * .1f, position(random));
+        boxQueries[i] = { center - 5.f, center + 5.f };
+        sphereQueries[i] = { center, 5.f };
+        rays[i] = { center, glm::normalize(glm::vec3(direction(random), direction(random) * .1f, direction(random))), 50.f };
+    }
+    frustum frustums[] = {
+        frustum(glm::perspective(glm::radians(60.f), 16.f / 9.f, .1f, 100.f) * glm::lookAt(glm::vec3(0, 5, 0), glm::vec3(1, 5, 1), glm::vec3(0, 1, 0))),
+        frustum(glm::ortho(-25.f, 25.f, -25.f, 25.f, -10.f, 40.f) * glm::lookAt(glm::vec3(1, 1.4f, -.6f), glm::vec3(0), glm::vec3(0, 1, 0))),
+    };
+
+    std::vector<std::vector<uint32_t>> found(queryCount);
+    begin = std::chrono::steady_clock::now();
+    tree.query(std::span<const aabb>(boxQueries), [&](size_t q, uint32_t data) { found[q].push_back(data); });
+    double timeBoxes = seconds(begin);
+
+    size_t single = 0;
+    begin = std::chrono::steady_clock::now();
+    for(const auto &query : boxQueries) tree.query(query, [&single](uint32_t) { single++; });
+    double timeSingle = seconds(begin);
+
+    size_t sphereHits = 0, frustumHits = 0;
+    begin = std::chrono::steady_clock::now();
+    tree.query(std::span<const sphere>(sphereQueries), [&sphereHits](size_t, uint32_t) { sphereHits++; });
+    double timeSpheres = seconds(begin);
+    begin = std::chrono::steady_clock::now();
+    tree.query(std::span<const frustum>(frustums), [&frustumHits](size_t, uint32_t) { frustumHits++; });
+    double timeFrustums = seconds(begin);
+
+    // Closest hits against the tight boxes.
+    std::vector<float> closest(queryCount, INFINITY);
+    begin = std::chrono::steady_clock::now();
+    tree.raycast(std::span<const ray>(rays), [&](size_t r, uint32_t data, float length)
+    {
+        float t = rays[r].intersects(boxes[data]);
+        if(t >= length) return length;
+        closest[r] = t;
+        return t;
+    });
+    double timeRays = seconds(begin);
+
+    // The tree's boxes are fattened, so it may report more than the linear scan, never less.
+    // Large counts only check a tenth of the queries, the scans take long enough as is.
+    int checked = count > 100000 ? queryCount / 10 : queryCount;
+    size_t linearHits = 0, missed = 0, mismatched = 0;
+    begin = std::chrono::steady_clock::now();
+    for(int q = 0; q < checked; ++q)
+    {
+        std::sort(found[q].begin(), found[q].end());
+        float best = INFINITY;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(boxQueries[q].intersects(boxes[i]))
+            {
+                linearHits++;
+                missed += !std::binary_search(found[q].begin(), found[q].end(), uint32_t(i));
+            }
+            best = std::min(best, rays[q].intersects(boxes[i]));
+        }
+        mismatched += best != closest[q];
+    }
+    double timeLinear = seconds(begin);
+    check(!missed, "box queries find every overlap");
+    check(!mismatched, "raycasts find the closest box");
+
+    for(size_t i = 0; i < count; i += 2) tree.remove(leaves[i]);
+    leafCount = 0;
+    validate(tree, tree.root, aabb_tree::null_node, leafCount);
+    check(leafCount == count / 2, "removed leaves are gone");
+
+    std::cout << count << " objects, height " << tree.height() << ": insert " << timeInsert * 1e3 << " ms ("
+              << timeInsert * 1e9 / count << " ns each), move " << timeMove * 1e3 << " ms per frame ("
+              << timeMove * 1e9 / count << " ns each, " << 100. * reinserted / count / frames << "% reinserted)" << std::endl;
+    std::cout << "  " << queryCount << " boxes " << timeBoxes * 1e3 << " ms batched, " << timeSingle * 1e3 << " ms singly ("
+              << single << " hits, " << linearHits << " overlapping the first " << checked << "); " << queryCount << " spheres " << timeSpheres * 1e3
+              << " ms (" << sphereHits << " hits); 2 frustums " << timeFrustums * 1e3 << " ms (" << frustumHits << " hits); " << queryCount << " rays "
+              << timeRays * 1e3 << " ms; linear scans " << timeLinear * 1e3 / checked << " ms per query" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> counts;
+    for(int i = 1; i < argc; ++i) counts.push_back(std::atoll(argv[i]));
+    if(counts.empty()) counts = { 10000, 100000, 1000000 };
+
+    for(auto count : counts)
+        if(count) run(count);
+    return failed ? 1 : 0;
+}
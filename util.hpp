@@ -2,43 +2,206 @@
 #define UTIL
 #include "log.hpp"
 #include <stb_image.h>
-#include <tiny_obj_loader.h>
 #include <string>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <unordered_map>
+#include <filesystem>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <string_view>
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <chrono>
 #include "core.hpp"
+#include "pack.hpp"
+
+// Hot reloading (see `FileWatcher`) is left out of release builds unless asked for with -DSRD_HOT_RELOAD=1.
+#ifndef SRD_HOT_RELOAD
+#ifdef NDEBUG
+#define SRD_HOT_RELOAD 0
+#else
+#define SRD_HOT_RELOAD 1
+#endif
+#endif
+
+#if SRD_HOT_RELOAD && defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/** A mounted asset pack (see pack.hpp), entries are found by binary search on the path hash. */
+struct Pack
+{
+    std::string path;
+    srd::core::file::mapped_file file;
+    const PackHeader *header = nullptr;
+    const PackEntry *entries = nullptr;
+    const char *names = nullptr;
+
+    /** 'name' has to be a `packPath`, returns nullptr if the pack does not have it. */
+    const PackEntry *find(std::string_view name) const
+    {
+        uint64_t hash = packHash(name);
+        auto end = entries + header->entryCount;
+        auto it = std::lower_bound(entries, end, hash, [](const PackEntry &entry, uint64_t hash) { return entry.hash < hash; });
+        for(; it != end && it->hash == hash; ++it)
+            if(std::string_view(names + it->nameOffset, it->nameSize) == name) return it;
+        return nullptr;
+    }
+};
+
+/** Maps and checks a pack, returns false if it is missing, from another version or truncated. */
+bool openPack(const std::string &path, Pack &pack)
+{
+    pack.path = path;
+    // Only the index is read as a whole, entries are advised as they are read.
+    pack.file = srd::core::file::mapped_file(path, srd::core::file::access::random);
+    if(!pack.file || pack.file.size < sizeof(PackHeader)) return false;
+
+    auto header = (const PackHeader*)pack.file.data;
+    if(header->magic != PackHeader::MAGIC || header->version != PackHeader::VERSION
+        || header->entryOffset > pack.file.size || header->nameOffset > pack.file.size
+        || header->entryOffset % alignof(PackEntry) != 0
+        // Subtracted from the size instead of added to the offsets, so that huge values cannot wrap around.
+        || uint64_t(header->entryCount) * sizeof(PackEntry) > pack.file.size - header->entryOffset
+        || header->nameSize > pack.file.size - header->nameOffset)
+        return false;
+
+    auto entries = (const PackEntry*)(pack.file.data + header->entryOffset);
+    for(uint32_t i = 0; i < header->entryCount; i++)
+    {
+        const auto &entry = entries[i];
+        if(entry.offset + entry.packedSize > pack.file.size || entry.offset + entry.packedSize < entry.offset
+            || uint64_t(entry.nameOffset) + entry.nameSize > header->nameSize
+            || entry.compression > PackEntry::LZ4
+            || (entry.compression == PackEntry::Stored && entry.packedSize != entry.size)
+            || (i > 0 && entries[i - 1].hash > entry.hash))
+            return false;
+    }
+
+    pack.header = header;
+    pack.entries = entries;
+    pack.names = (const char*)pack.file.data + header->nameOffset;
+    return true;
+}
+
+/**
+ * The mounted packs, searched last mounted first. With 'looseFiles' a file on disk overrides
+ * the packs, which is what development wants; without it the disk is only tried after them.
+ * Packs are mounted before anything is loaded and stay mounted, so reads need no lock.
+ */
+struct VirtualFileSystem
+{
+    std::vector<std::unique_ptr<Pack>> packs;
+    bool looseFiles = true;
+};
+
+inline VirtualFileSystem fileSystem;
+
+/** Contents of a file read through `readVirtualFile`, either a view into a mapping or a decompressed copy. */
+struct VirtualFile
+{
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    bool found = false;
+    srd::core::file::mapped_file mapping;
+    std::vector<unsigned char> buffer;
+
+    std::span<const std::byte> bytes() const { return { (const std::byte*)data, size }; }
+    std::string_view text() const { return { (const char*)data, size }; }
+    explicit operator bool() const { return found; }
+};
+
+/** Mounts a pack on top of the others, returns false if it could not be opened. */
+bool mountPack(const std::string &path)
+{
+    auto pack = std::make_unique<Pack>();
+    if(!openPack(path, *pack))
+    {
+        srd::log::cerr << "Could not mount pack '" << path << "'!" << srd::log::endl;
+        return false;
+    }
+    srd::log::cout << "Mounted pack '" << path << "' with " << pack->header->entryCount << " files" << srd::log::endl;
+    fileSystem.packs.push_back(std::move(pack));
+    return true;
+}
+
+/** Reads 'path' from the disk or the mounted packs, stored entries are not copied. 'hint' is passed on to the mapping. */
+bool readVirtualFile(const std::string &path, VirtualFile &file,
+                     srd::core::file::access hint = srd::core::file::access::sequential)
+{
+    auto loose = [&]()
+    {
+        file.mapping = srd::core::file::mapped_file(path, hint);
+        std::error_code error;
+        file.found = file.mapping || std::filesystem::is_regular_file(path, error);
+        file.data = file.mapping.data;
+        file.size = file.mapping.size;
+        return file.found;
+    };
+
+    if(fileSystem.looseFiles && loose()) return true;
+    if(!fileSystem.packs.empty())
+    {
+        auto name = packPath(path);
+        for(auto pack = fileSystem.packs.rbegin(); pack != fileSystem.packs.rend(); ++pack)
+        {
+            const PackEntry *entry = (*pack)->find(name);
+            if(!entry) continue;
+
+            const unsigned char *packed = (*pack)->file.data + entry->offset;
+            (*pack)->file.advise(entry->offset, entry->packedSize, hint);
+            if(entry->compression == PackEntry::Stored)
+                file.data = packed;
+            else
+            {
+                file.buffer.resize(entry->size);
+                if(!lz4Decompress(packed, entry->packedSize, file.buffer.data(), entry->size))
+                {
+                    srd::log::cerr << "Corrupt entry '" << name << "' in pack '" << (*pack)->path << "'!" << srd::log::endl;
+                    return false;
+                }
+                file.data = file.buffer.data();
+            }
+            file.size = entry->size;
+            return file.found = true;
+        }
+    }
+    return !fileSystem.looseFiles && loose();
+}
 
 std::string readFile(const char *path)
 {
     srd::log::cout << "Reading file '" << path << "'..." << srd::log::endl;
-    using namespace srd;
-    std::string s;
-    std::ifstream ifs(path);
-    if(!ifs.is_open()) {
+    VirtualFile file;
+    if(!readVirtualFile(path, file)) {
         srd::log::cerr << "Could not read file at '" << path << "'!" << srd::log::endl;
         return "";
     }
-    std::stringstream ss;
-    ss << ifs.rdbuf();
-    std::string str = ss.str();
-    ifs.close();
-    return str;
+    return std::string(file.text());
 }
 
 srd::core::gfx::texture::data readTexture(const std::string &path, bool flip = false)
 {
     srd::log::cout << "Reading texture '" << path << "'..." << srd::log::endl;
     using namespace srd;
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(flip ? 0 : 1);
-    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
+    int width = 0, height = 0, nrChannels = 0;
+    // Textures are decoded on several threads at once.
+    stbi_set_flip_vertically_on_load_thread(flip ? 0 : 1);
+    VirtualFile file;
+    unsigned char *data = nullptr;
+    if(readVirtualFile(path, file) && file.size <= INT_MAX)
+        data = stbi_load_from_memory(file.data, int(file.size), &width, &height, &nrChannels, 4);
     if(!data)
     {
         srd::log::cerr << "Failed to read image at '" << path << "'!"<< srd::log::endl;
-        std::cout << "Reason:\n  " << stbi_failure_reason() << std::endl;
+        std::cout << "Reason:\n  " << (file ? stbi_failure_reason() : "file not found") << std::endl;
     }
     return { .width = width, .height = height, .channels = nrChannels, .data = data };
 }
@@ -48,76 +211,594 @@ void deleteTexture(const srd::core::gfx::texture::data &data)
     stbi_image_free(data.data);
 }
 
-void readMesh(const char *path, std::vector<srd::core::gfx::vertex> &vertices, std::vector<unsigned int> &indices)
+#if SRD_HOT_RELOAD
+/**
+ * Reports watched files which were written since the last `poll`. On Linux inotify watches the
+ * files' directories, elsewhere (or if a directory cannot be watched) the modification times are
+ * compared every 'interval' seconds. Only loose files are watched, not pack entries.
+ */
+struct FileWatcher
 {
-    srd::log::cout << "Reading mesh '" << path << "'..." << srd::log::endl;
-    using namespace srd;
-    std::ifstream ifs { path };
-    if(!ifs.is_open())
+    struct File
     {
-        srd::log::cerr << "Could not load mesh at '" << path << "'!" << srd::log::endl;
-        return;
+        std::filesystem::file_time_type time;
+        bool polled = true;
+    };
+
+    /** Watched files by `packPath`. */
+    std::unordered_map<std::string, File> files;
+    float interval = 0.5f;
+    std::chrono::steady_clock::time_point lastPoll;
+#ifdef __linux__
+    int fd = -1;
+    /** Watched directories by watch descriptor. */
+    std::unordered_map<int, std::string> directories;
+#endif
+
+    FileWatcher()
+    {
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd < 0) srd::log::cwrn << "inotify is not available, polling for file changes" << srd::log::endl;
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher &operator=(const FileWatcher&) = delete;
+
+    ~FileWatcher()
+    {
+#ifdef __linux__
+        if(fd >= 0) close(fd);
+#endif
+    }
+
+    void watch(const std::string &path)
+    {
+        auto name = packPath(path);
+        std::error_code error;
+        auto [file, inserted] = files.try_emplace(name, File { std::filesystem::last_write_time(name, error) });
+        if(!inserted) return;
+#ifdef __linux__
+        if(fd < 0) return;
+        auto directory = std::filesystem::path(name).parent_path().string();
+        if(directory.empty()) directory = ".";
+        // Editors often save by renaming a new file over the old one, a watch on the file itself would lose it.
+        int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if(wd < 0) return;
+        directories[wd] = directory;
+        file->second.polled = false;
+#endif
+    }
+
+    /** Returns every changed file once, as a `packPath`. Does not block. */
+    std::vector<std::string> poll()
+    {
+        std::vector<std::string> changed;
+        auto add = [&](const std::string &path)
+        {
+            if(std::find(changed.begin(), changed.end(), path) == changed.end()) changed.push_back(path);
+        };
+
+#ifdef __linux__
+        if(fd >= 0)
+        {
+            alignas(inotify_event) char buffer[4096];
+            for(ssize_t length; (length = read(fd, buffer, sizeof(buffer))) > 0;)
+            {
+                for(char *p = buffer; p < buffer + length;)
+                {
+                    auto event = (const inotify_event*)p;
+                    p += sizeof(inotify_event) + event->len;
+
+                    // Events were dropped, anything may have changed.
+                    if(event->mask & IN_Q_OVERFLOW)
+                        for(const auto &file : files) add(file.first);
+
+                    auto directory = directories.find(event->wd);
+                    if(directory == directories.end() || !event->len) continue;
+                    auto path = packPath(directory->second + "/" + event->name);
+                    if(files.count(path)) add(path);
+                }
+            }
+        }
+#endif
+
+        auto now = std::chrono::steady_clock::now();
+        if(std::chrono::duration<float>(now - lastPoll).count() < interval) return changed;
+        lastPoll = now;
+        for(auto &[path, file] : files)
+        {
+            if(!file.polled) continue;
+            std::error_code error;
+            auto time = std::filesystem::last_write_time(path, error);
+            if(error || time == file.time) continue;
+            file.time = time;
+            add(path);
+        }
+        return changed;
     }
+};
+#endif
+
+/** A face corner of an OBJ file, missing attributes are -1. */
+struct ObjCorner
+{
+    int position, texcoord, normal;
+};
+
+/** What one line-aligned chunk of an OBJ file contributes, chunks are parsed independently. */
+struct ObjChunk
+{
+    enum Relative : uint8_t { RelativePosition = 1, RelativeTexcoord = 2, RelativeNormal = 4 };
 
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::unordered_map<core::gfx::vertex, unsigned int> vertexMap;
+    const char *begin, *end;
+    std::vector<float> positions, texcoords, normals;
+    std::vector<ObjCorner> corners;
+    /** Corner count of every face. */
+    std::vector<unsigned int> faces;
+    /** Negative indices are stored relative to the chunk until the earlier chunks are counted. */
+    std::vector<uint8_t> relative;
+    size_t positionBase = 0, texcoordBase = 0, normalBase = 0;
+    bool failed = false;
 
-    std::string warn;
-    std::string err;
+    /** Triangulated corners and their hashes, ready for welding. */
+    std::vector<srd::core::gfx::vertex> vertices;
+    std::vector<size_t> hashes;
 
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &ifs);
+    /** 'usemtl' lines, as the face and later the triangulated corner they apply from. */
+    std::vector<std::pair<size_t, std::string>> materials;
+};
 
-    if(!warn.empty()) {
-        srd::log::cwrn << "Warning: " << warn << srd::log::endl;
+inline bool objSpace_(char c) { return c == ' ' || c == '\t'; }
+
+/** Same delimiters and '+' handling as tinyobj, values go through double like tinyobj does. */
+inline float objReal_(const char *&p, const char *end)
+{
+    while(p < end && objSpace_(*p)) ++p;
+    const char *tokenEnd = p;
+    while(tokenEnd < end && !objSpace_(*tokenEnd) && *tokenEnd != '\r') ++tokenEnd;
+    double value = 0.0;
+    std::from_chars(p < tokenEnd && *p == '+' ? p + 1 : p, tokenEnd, value);
+    p = tokenEnd;
+    return float(value);
+}
+
+/** Parses one index like 'atoi' and resolves it like tinyobj, zero is an error. */
+inline bool objIndex_(const char *&p, const char *end, size_t count, int &index, uint8_t &relative, uint8_t bit)
+{
+    bool negative = p < end && *p == '-';
+    if(p < end && (*p == '-' || *p == '+')) ++p;
+    long long value = 0;
+    while(p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+    while(p < end && *p != '/' && !objSpace_(*p) && *p != '\r') ++p;
+    if(value == 0) return false;
+    if(negative)
+    {
+        index = int((long long)count - value);
+        relative |= bit;
     }
+    else index = int(value - 1);
+    return true;
+}
+
+void parseObjChunk_(ObjChunk &chunk)
+{
+    const char *p = chunk.begin;
+    while(p < chunk.end)
+    {
+        const char *lineEnd = p;
+        while(lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r') ++lineEnd;
+        while(p < lineEnd && objSpace_(*p)) ++p;
 
-    if(!err.empty()) {
-        srd::log::cerr << "Error: " << err << srd::log::endl;
-        // std::printf("\033[0;31mError: '%s'!\033[0;0m\n", path.c_str());
-        ifs.close();
+        if(lineEnd - p >= 2 && p[0] == 'v' && objSpace_(p[1]))
+        {
+            p += 2;
+            for(int i = 0; i < 3; i++) chunk.positions.push_back(objReal_(p, lineEnd));
+        }
+        else if(lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && objSpace_(p[2]))
+        {
+            p += 3;
+            for(int i = 0; i < 3; i++) chunk.normals.push_back(objReal_(p, lineEnd));
+        }
+        else if(lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && objSpace_(p[2]))
+        {
+            p += 3;
+            for(int i = 0; i < 2; i++) chunk.texcoords.push_back(objReal_(p, lineEnd));
+        }
+        else if(lineEnd - p >= 7 && std::string_view(p, 6) == "usemtl" && objSpace_(p[6]))
+        {
+            // Only the first word is the name, like tinyobj reads it.
+            p += 7;
+            while(p < lineEnd && objSpace_(*p)) ++p;
+            const char *nameEnd = p;
+            while(nameEnd < lineEnd && !objSpace_(*nameEnd)) ++nameEnd;
+            chunk.materials.push_back({ chunk.faces.size(), std::string(p, nameEnd) });
+        }
+        else if(lineEnd - p >= 2 && p[0] == 'f' && objSpace_(p[1]))
+        {
+            p += 2;
+            while(p < lineEnd && objSpace_(*p)) ++p;
+            unsigned int count = 0;
+            while(p < lineEnd && !chunk.failed)
+            {
+                ObjCorner corner { -1, -1, -1 };
+                uint8_t relative = 0;
+                chunk.failed = !objIndex_(p, lineEnd, chunk.positions.size() / 3, corner.position, relative, ObjChunk::RelativePosition);
+                if(p < lineEnd && *p == '/' && !chunk.failed)
+                {
+                    if(++p < lineEnd && *p == '/')
+                    {
+                        ++p;
+                        chunk.failed = !objIndex_(p, lineEnd, chunk.normals.size() / 3, corner.normal, relative, ObjChunk::RelativeNormal);
+                    }
+                    else
+                    {
+                        chunk.failed = !objIndex_(p, lineEnd, chunk.texcoords.size() / 2, corner.texcoord, relative, ObjChunk::RelativeTexcoord);
+                        if(p < lineEnd && *p == '/' && !chunk.failed)
+                        {
+                            ++p;
+                            chunk.failed = !objIndex_(p, lineEnd, chunk.normals.size() / 3, corner.normal, relative, ObjChunk::RelativeNormal);
+                        }
+                    }
+                }
+                chunk.corners.push_back(corner);
+                chunk.relative.push_back(relative);
+                count++;
+                while(p < lineEnd && (objSpace_(*p) || *p == '\r')) ++p;
+            }
+            if(chunk.failed) return;
+            chunk.faces.push_back(count);
+        }
+
+        p = lineEnd + 1;
+    }
+}
+
+/** Crossing test of tinyobj's ear clipping. */
+inline bool objPointInTriangle_(const float *x, const float *y, float testX, float testY)
+{
+    bool inside = false;
+    for(int i = 0, j = 2; i < 3; j = i++)
+        if(((y[i] > testY) != (y[j] > testY)) && (testX < (x[j] - x[i]) * (testY - y[i]) / (y[j] - y[i]) + x[i]))
+            inside = !inside;
+    return inside;
+}
+
+/**
+ * Splits a face into triangles exactly like tinyobj does: quads along the shorter diagonal,
+ * larger polygons by ear clipping in the plane of the first non-degenerate corner.
+ * Changing this changes the index buffers of every mesh.
+ */
+void triangulateObjFace_(std::vector<ObjCorner> &face, const std::vector<float> &v, std::vector<ObjCorner> &triangles)
+{
+    size_t count = face.size();
+    if(count < 3) return;
+    if(count == 3)
+    {
+        triangles.insert(triangles.end(), face.begin(), face.end());
         return;
     }
+    auto valid = [&](const ObjCorner &c, size_t axis = 2) { return c.position >= 0 && size_t(c.position) * 3 + axis < v.size(); };
 
-    if(!ret) {
-        ifs.close();
+    if(count == 4)
+    {
+        if(!valid(face[0]) || !valid(face[1]) || !valid(face[2]) || !valid(face[3])) return;
+        const float *p0 = &v[face[0].position * 3], *p1 = &v[face[1].position * 3];
+        const float *p2 = &v[face[2].position * 3], *p3 = &v[face[3].position * 3];
+        float e02x = p2[0] - p0[0], e02y = p2[1] - p0[1], e02z = p2[2] - p0[2];
+        float e13x = p3[0] - p1[0], e13y = p3[1] - p1[1], e13z = p3[2] - p1[2];
+        float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+        float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+        if(sqr02 < sqr13) triangles.insert(triangles.end(), { face[0], face[1], face[2], face[0], face[2], face[3] });
+        else              triangles.insert(triangles.end(), { face[0], face[1], face[3], face[1], face[2], face[3] });
         return;
     }
 
-    for(const auto& shape : shapes) {
-        for(const auto& index : shape.mesh.indices) {
-            core::gfx::vertex vertex{};
+    size_t axes[2] = { 1, 2 };
+    for(size_t k = 0; k < count; k++)
+    {
+        const auto &i0 = face[k], &i1 = face[(k + 1) % count], &i2 = face[(k + 2) % count];
+        if(!valid(i0) || !valid(i1) || !valid(i2)) continue;
+        const float *p0 = &v[i0.position * 3], *p1 = &v[i1.position * 3], *p2 = &v[i2.position * 3];
+        float e0x = p1[0] - p0[0], e0y = p1[1] - p0[1], e0z = p1[2] - p0[2];
+        float e1x = p2[0] - p1[0], e1y = p2[1] - p1[1], e1z = p2[2] - p1[2];
+        float cx = std::fabs(e0y * e1z - e0z * e1y);
+        float cy = std::fabs(e0z * e1x - e0x * e1z);
+        float cz = std::fabs(e0x * e1y - e0y * e1x);
+        const float epsilon = std::numeric_limits<float>::epsilon();
+        if(cx > epsilon || cy > epsilon || cz > epsilon)
+        {
+            if(!(cx > cy && cx > cz))
+            {
+                axes[0] = 0;
+                if(cz > cx && cz > cy) axes[1] = 1;
+            }
+            break;
+        }
+    }
+
+    auto inPlane = [&](const ObjCorner &c) { return valid(c, axes[0]) && valid(c, axes[1]); };
+    float area = 0;
+    for(size_t k = 0; k < count; k++)
+    {
+        const auto &i0 = face[k], &i1 = face[(k + 1) % count];
+        if(!inPlane(i0) || !inPlane(i1)) continue;
+        area += (v[i0.position * 3 + axes[0]] * v[i1.position * 3 + axes[1]]
+               - v[i0.position * 3 + axes[1]] * v[i1.position * 3 + axes[0]]) * 0.5f;
+    }
+
+    size_t guess = 0;
+    size_t remainingIterations = count, previousRemaining = count;
+    while(face.size() > 3 && remainingIterations > 0)
+    {
+        count = face.size();
+        if(guess >= count) guess -= count;
+        if(previousRemaining != count)
+        {
+            previousRemaining = count;
+            remainingIterations = count;
+        }
+        else remainingIterations--;
+
+        ObjCorner ear[3];
+        float x[3], y[3];
+        for(size_t k = 0; k < 3; k++)
+        {
+            ear[k] = face[(guess + k) % count];
+            x[k] = inPlane(ear[k]) ? v[ear[k].position * 3 + axes[0]] : 0.0f;
+            y[k] = inPlane(ear[k]) ? v[ear[k].position * 3 + axes[1]] : 0.0f;
+        }
+        float cross = (x[1] - x[0]) * (y[2] - y[1]) - (y[1] - y[0]) * (x[2] - x[1]);
+        if(cross * area < 0.0f)
+        {
+            guess++;
+            continue;
+        }
+
+        bool overlap = false;
+        for(size_t other = 3; other < count && !overlap; other++)
+        {
+            const auto &corner = face[(guess + other) % count];
+            if(inPlane(corner))
+                overlap = objPointInTriangle_(x, y, v[corner.position * 3 + axes[0]], v[corner.position * 3 + axes[1]]);
+        }
+        if(overlap)
+        {
+            guess++;
+            continue;
+        }
+
+        triangles.insert(triangles.end(), { ear[0], ear[1], ear[2] });
+        face.erase(face.begin() + (guess + 1) % count);
+    }
+
+    if(face.size() == 3) triangles.insert(triangles.end(), { face[0], face[1], face[2] });
+}
 
-            vertex.position = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
+/**
+ * Reads the triangles of an OBJ file, with the same triangulation and welded indices as tinyobj
+ * followed by an 'unordered_map' weld. Chunks of the mapped file are parsed and triangulated on the
+ * job system, only the weld itself is sequential since first appearance decides the indices.
+ * Consecutive faces of the same 'usemtl' become a submesh if 'submeshes' is set, material IDs count
+ * the names in order of first use and index 'materials'. Faces before any 'usemtl' use the name "".
+ * Returns false if the file could not be read or has an invalid face.
+ */
+bool importObj(const std::string &path, std::vector<srd::core::gfx::vertex> &vertices, std::vector<unsigned int> &indices,
+               std::vector<srd::core::gfx::submesh> *submeshes = nullptr, std::vector<std::string> *materials = nullptr)
+{
+    using namespace srd;
+    VirtualFile file;
+    if(!readVirtualFile(path, file) || !file.data) return false;
+
+    const char *text = (const char*)file.data;
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(core::jobs::threadCount() * 4, file.size >> 16));
+    std::vector<ObjChunk> chunks(chunkCount);
+    for(size_t i = 0; i < chunkCount; i++)
+    {
+        const char *begin = i == 0 ? text : chunks[i - 1].end;
+        const char *end = text + file.size * (i + 1) / chunkCount;
+        if(end < begin) end = begin;
+        while(end < text + file.size && end[-1] != '\n') ++end;
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+    }
 
-            vertex.normal = {
-                attrib.normals[3 * index.normal_index + 0],
-                attrib.normals[3 * index.normal_index + 1],
-                attrib.normals[3 * index.normal_index + 2],
-            };
+    core::jobs::parallel_for(0, chunkCount, [&](size_t first, size_t last)
+    {
+        for(size_t i = first; i < last; i++) parseObjChunk_(chunks[i]);
+    });
 
-            vertex.texcoord = {
-                attrib.texcoords[2 * index.texcoord_index + 0],
-                attrib.texcoords[2 * index.texcoord_index + 1]
-            };
+    size_t positionCount = 0, texcoordCount = 0, normalCount = 0;
+    for(auto &chunk : chunks)
+    {
+        if(chunk.failed)
+        {
+            log::cerr << "Error: invalid face index in '" << path << "'!" << log::endl;
+            return false;
+        }
+        chunk.positionBase = positionCount;
+        chunk.texcoordBase = texcoordCount;
+        chunk.normalBase = normalCount;
+        positionCount += chunk.positions.size() / 3;
+        texcoordCount += chunk.texcoords.size() / 2;
+        normalCount += chunk.normals.size() / 3;
+    }
 
-            if (vertexMap.count(vertex) == 0) {
-                vertexMap[vertex] = static_cast<unsigned int>(vertices.size());
+    std::vector<float> positions(positionCount * 3), texcoords(texcoordCount * 2), normals(normalCount * 3);
+    core::jobs::parallel_for(0, chunkCount, [&](size_t first, size_t last)
+    {
+        for(size_t i = first; i < last; i++)
+        {
+            const auto &chunk = chunks[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase * 3);
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.texcoordBase * 2);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase * 3);
+        }
+    });
+
+    core::jobs::parallel_for(0, chunkCount, [&](size_t first, size_t last)
+    {
+        std::vector<ObjCorner> face, triangles;
+        for(size_t i = first; i < last; i++)
+        {
+            auto &chunk = chunks[i];
+            size_t corner = 0, material = 0;
+            triangles.clear();
+            for(size_t f = 0; f < chunk.faces.size(); f++)
+            {
+                for(; material < chunk.materials.size() && chunk.materials[material].first == f; material++)
+                    chunk.materials[material].first = triangles.size();
+                unsigned int count = chunk.faces[f];
+                face.assign(chunk.corners.begin() + corner, chunk.corners.begin() + corner + count);
+                for(unsigned int k = 0; k < count; k++)
+                {
+                    uint8_t relative = chunk.relative[corner + k];
+                    if(relative & ObjChunk::RelativePosition) face[k].position += int(chunk.positionBase);
+                    if(relative & ObjChunk::RelativeTexcoord) face[k].texcoord += int(chunk.texcoordBase);
+                    if(relative & ObjChunk::RelativeNormal) face[k].normal += int(chunk.normalBase);
+                }
+                corner += count;
+                triangulateObjFace_(face, positions, triangles);
+            }
+            for(; material < chunk.materials.size(); material++) chunk.materials[material].first = triangles.size();
+
+            chunk.vertices.resize(triangles.size());
+            chunk.hashes.resize(triangles.size());
+            for(size_t k = 0; k < triangles.size(); k++)
+            {
+                const auto &c = triangles[k];
+                auto &vertex = chunk.vertices[k];
+                vertex = {};
+                // tinyobj leaves these unchecked, a corner outside the file keeps the attribute zero.
+                if(c.position >= 0 && size_t(c.position) < positionCount)
+                    vertex.position = { positions[c.position * 3], positions[c.position * 3 + 1], positions[c.position * 3 + 2] };
+                if(c.normal >= 0 && size_t(c.normal) < normalCount)
+                    vertex.normal = { normals[c.normal * 3], normals[c.normal * 3 + 1], normals[c.normal * 3 + 2] };
+                if(c.texcoord >= 0 && size_t(c.texcoord) < texcoordCount)
+                    vertex.texcoord = { texcoords[c.texcoord * 2], texcoords[c.texcoord * 2 + 1] };
+                chunk.hashes[k] = std::hash<core::gfx::vertex>()(vertex);
+            }
+        }
+    });
+
+    std::vector<size_t> cornerBase(chunkCount + 1, 0);
+    for(size_t i = 0; i < chunkCount; i++) cornerBase[i + 1] = cornerBase[i] + chunks[i].vertices.size();
+    size_t cornerCount = cornerBase[chunkCount];
+    auto corner = [&](uint32_t c) -> std::pair<const core::gfx::vertex&, size_t>
+    {
+        size_t i = std::upper_bound(cornerBase.begin(), cornerBase.end(), c) - cornerBase.begin() - 1;
+        return { chunks[i].vertices[c - cornerBase[i]], chunks[i].hashes[c - cornerBase[i]] };
+    };
+
+    // Every shard owns the corners whose top hash bits select it and finds the first corner equal
+    // to each of them, in an open addressing table that keeps part of the hash to skip comparisons.
+    std::vector<uint32_t> first(cornerCount);
+    size_t shardBits = 0;
+    while((size_t(1) << shardBits) < core::jobs::threadCount() * 2 && shardBits < 6) shardBits++;
+    auto shardOf = [&](size_t hash) { return shardBits ? size_t(uint64_t(hash) >> (64 - shardBits)) : 0; };
+    core::jobs::parallel_for(0, size_t(1) << shardBits, [&](size_t firstShard, size_t lastShard)
+    {
+        struct Slot { uint32_t corner, hash; };
+        std::vector<Slot> table;
+        for(size_t shard = firstShard; shard < lastShard; shard++)
+        {
+            size_t members = 0;
+            for(const auto &chunk : chunks)
+                for(size_t hash : chunk.hashes) members += shardOf(hash) == shard;
+
+            size_t capacity = 16;
+            while(capacity < members * 2) capacity <<= 1;
+            table.assign(capacity, Slot { UINT32_MAX, 0 });
+            size_t mask = capacity - 1;
+
+            for(size_t i = 0; i < chunkCount; i++)
+            {
+                const auto &chunk = chunks[i];
+                for(size_t k = 0; k < chunk.hashes.size(); k++)
+                {
+                    size_t hash = chunk.hashes[k];
+                    if(shardOf(hash) != shard) continue;
+                    size_t slot = hash & mask;
+                    while(table[slot].corner != UINT32_MAX
+                       && (table[slot].hash != uint32_t(uint64_t(hash) >> 32) || !(corner(table[slot].corner).first == chunk.vertices[k])))
+                        slot = (slot + 1) & mask;
+
+                    uint32_t c = uint32_t(cornerBase[i] + k);
+                    if(table[slot].corner == UINT32_MAX) table[slot] = { c, uint32_t(uint64_t(hash) >> 32) };
+                    first[c] = table[slot].corner;
+                }
+            }
+        }
+    });
+
+    // A corner's first equal corner never comes after it, so one pass numbers the vertices in order.
+    vertices.clear();
+    indices.resize(cornerCount);
+    for(size_t i = 0, c = 0; i < chunkCount; i++)
+    {
+        for(const auto &vertex : chunks[i].vertices)
+        {
+            if(first[c] == c)
+            {
+                indices[c] = unsigned(vertices.size());
                 vertices.push_back(vertex);
             }
+            else indices[c] = indices[first[c]];
+            c++;
+        }
+    }
 
-            indices.push_back(vertexMap[vertex]);
+    if(!submeshes) return true;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, unsigned int> ids;
+    std::string current;
+    submeshes->clear();
+    auto add = [&](size_t first, size_t last)
+    {
+        if(first == last) return;
+        auto [id, inserted] = ids.try_emplace(current, (unsigned int)names.size());
+        if(inserted) names.push_back(current);
+        if(!submeshes->empty() && submeshes->back().material == id->second)
+            submeshes->back().indexCount += unsigned(last - first);
+        else submeshes->push_back({ unsigned(first), unsigned(last - first), id->second, {} });
+    };
+    for(size_t i = 0; i < chunkCount; i++)
+    {
+        size_t start = cornerBase[i];
+        for(const auto &[corner, name] : chunks[i].materials)
+        {
+            add(start, cornerBase[i] + corner);
+            start = cornerBase[i] + corner;
+            current = name;
         }
+        add(start, cornerBase[i + 1]);
+    }
+    for(auto &submesh : *submeshes)
+        for(size_t i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; i++)
+            submesh.bounds.extend(vertices[indices[i]].position);
+    if(materials) *materials = std::move(names);
+    return true;
+}
+
+/** Reads an OBJ file (see `importObj`), the submeshes' material IDs are logged with their names. */
+void readMesh(const char *path, std::vector<srd::core::gfx::vertex> &vertices, std::vector<unsigned int> &indices,
+              std::vector<srd::core::gfx::submesh> *submeshes = nullptr)
+{
+    srd::log::cout << "Reading mesh '" << path << "'..." << srd::log::endl;
+    std::vector<std::string> materials;
+    if(!importObj(path, vertices, indices, submeshes, &materials))
+    {
+        srd::log::cerr << "Could not load mesh at '" << path << "'!" << srd::log::endl;
+        return;
     }
 
     // bool shouldLog = indices.size() < 100;
     srd::log::cout << "Mesh info: index count: " <<
         indices.size() << ", vertex count: " << vertices.size() << srd::log::endl;
+    if(materials.size() > 1)
+        for(size_t i = 0; i < materials.size(); i++)
+            srd::log::cout << "  material " << i << ": '" << materials[i] << "'" << srd::log::endl;
     
     // if(shouldLog) log::sec(log::call);
 
@@ -161,4 +842,719 @@ void readMesh(const char *path, std::vector<srd::core::gfx::vertex> &vertices, s
     //       - vertices[i].normal * glm::dot(vertices[i].normal, vertices[i].tangent));//glm::normalize(vertices[i].tangent);
 }
 
+/**
+ * Header of a cooked mesh, the blobs it points to are aligned so that they can be
+ * uploaded straight from a mapped file. All values are in the cooking machine's byte order.
+ */
+struct CookedMeshHeader
+{
+    static constexpr uint32_t MAGIC = 0x4d445253; // "SRDM"
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t MAX_LODS = 4;
+
+    /** Vertex layouts, only the one of `srd::core::gfx::vertex` exists so far. */
+    enum Layout : uint32_t { PositionNormalTexcoordTangent = 1 };
+
+    /** A range of the index blob, LOD 0 is the full mesh. */
+    struct Lod
+    {
+        uint32_t indexOffset, indexCount;
+    };
+
+    /** An entry of the submesh blob, see `srd::core::gfx::submesh`. */
+    struct Submesh
+    {
+        uint32_t indexOffset, indexCount, material;
+        float boundsMin[3], boundsMax[3];
+    };
+
+    uint32_t magic, version;
+    uint32_t layout, vertexStride;
+    /** Bytes per index. */
+    uint32_t indexWidth;
+    uint32_t lodCount;
+    Lod lods[MAX_LODS];
+    float boundsMin[3], boundsMax[3];
+
+    uint32_t vertexCount, indexCount, positionCount;
+    uint64_t vertexOffset, indexOffset, positionOffset, positionIndexOffset;
+    uint32_t submeshCount;
+    uint64_t submeshOffset;
+};
+
+/** A mapped cooked mesh, the pointers point into the mapping. */
+struct CookedMesh
+{
+    srd::core::file::mapped_file file;
+    const CookedMeshHeader *header = nullptr;
+    const srd::core::gfx::vertex *vertices = nullptr;
+    const unsigned int *indices = nullptr;
+    const glm::vec3 *positions = nullptr;
+    const unsigned int *positionIndices = nullptr;
+    const CookedMeshHeader::Submesh *submeshTable = nullptr;
+
+    std::vector<srd::core::gfx::submesh> submeshes() const
+    {
+        std::vector<srd::core::gfx::submesh> result;
+        for(uint32_t i = 0; i < header->submeshCount; ++i)
+        {
+            const auto &s = submeshTable[i];
+            auto &submesh = result.emplace_back(srd::core::gfx::submesh { s.indexOffset, s.indexCount, s.material, {} });
+            submesh.bounds.extend({ s.boundsMin[0], s.boundsMin[1], s.boundsMin[2] });
+            submesh.bounds.extend({ s.boundsMax[0], s.boundsMax[1], s.boundsMax[2] });
+        }
+        return result;
+    }
+
+    srd::core::math::aabb bounds() const
+    {
+        srd::core::math::aabb box;
+        box.extend({ header->boundsMin[0], header->boundsMin[1], header->boundsMin[2] });
+        box.extend({ header->boundsMax[0], header->boundsMax[1], header->boundsMax[2] });
+        return box;
+    }
+};
+
+/** Reads 'objPath' and writes its cooked form to 'cookedPath', returns false if either fails. */
+bool cookMesh(const std::string &objPath, const std::string &cookedPath)
+{
+    using namespace srd;
+    std::vector<core::gfx::vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<core::gfx::submesh> submeshes;
+    readMesh(objPath.c_str(), vertices, indices, &submeshes);
+    if(vertices.empty()) return false;
+
+    std::vector<CookedMeshHeader::Submesh> submeshTable;
+    for(const auto &submesh : submeshes)
+    {
+        auto &entry = submeshTable.emplace_back(CookedMeshHeader::Submesh { submesh.indexOffset, submesh.indexCount, submesh.material, {}, {} });
+        for(int i = 0; i < 3; ++i)
+        {
+            entry.boundsMin[i] = submesh.bounds.min[i];
+            entry.boundsMax[i] = submesh.bounds.max[i];
+        }
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> positionIndices;
+    core::gfx::mesh::weld(vertices, indices, positions, positionIndices);
+
+    core::math::aabb bounds;
+    for(const auto &v : vertices) bounds.extend(v.position);
+
+    auto align = [](uint64_t offset) { return (offset + CookedMeshHeader::ALIGNMENT - 1) & ~uint64_t(CookedMeshHeader::ALIGNMENT - 1); };
+
+    CookedMeshHeader header {};
+    header.magic = CookedMeshHeader::MAGIC;
+    header.version = CookedMeshHeader::VERSION;
+    header.layout = CookedMeshHeader::PositionNormalTexcoordTangent;
+    header.vertexStride = sizeof(core::gfx::vertex);
+    header.indexWidth = sizeof(unsigned int);
+    header.lodCount = 1;
+    header.lods[0] = { 0, (uint32_t)indices.size() };
+    for(int i = 0; i < 3; ++i)
+    {
+        header.boundsMin[i] = bounds.min[i];
+        header.boundsMax[i] = bounds.max[i];
+    }
+    header.vertexCount = vertices.size();
+    header.indexCount = indices.size();
+    header.positionCount = positions.size();
+    header.vertexOffset = align(sizeof(header));
+    header.indexOffset = align(header.vertexOffset + vertices.size() * sizeof(core::gfx::vertex));
+    header.positionOffset = align(header.indexOffset + indices.size() * sizeof(unsigned int));
+    header.positionIndexOffset = align(header.positionOffset + positions.size() * sizeof(glm::vec3));
+    header.submeshCount = submeshTable.size();
+    header.submeshOffset = align(header.positionIndexOffset + positionIndices.size() * sizeof(unsigned int));
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(cookedPath).parent_path(), error);
+    // Written under another name first, so that a mesh is never mapped half-written.
+    auto temporary = cookedPath + ".tmp";
+    {
+        std::ofstream ofs(temporary, std::ios::binary);
+        if(!ofs.is_open())
+        {
+            srd::log::cerr << "Could not write cooked mesh '" << cookedPath << "'!" << srd::log::endl;
+            return false;
+        }
+        auto blob = [&](uint64_t offset, const void *data, size_t size)
+        {
+            static const char zeros[CookedMeshHeader::ALIGNMENT] = {};
+            ofs.write(zeros, offset - (uint64_t)ofs.tellp());
+            ofs.write((const char*)data, size);
+        };
+        ofs.write((const char*)&header, sizeof(header));
+        blob(header.vertexOffset, vertices.data(), vertices.size() * sizeof(core::gfx::vertex));
+        blob(header.indexOffset, indices.data(), indices.size() * sizeof(unsigned int));
+        blob(header.positionOffset, positions.data(), positions.size() * sizeof(glm::vec3));
+        blob(header.positionIndexOffset, positionIndices.data(), positionIndices.size() * sizeof(unsigned int));
+        blob(header.submeshOffset, submeshTable.data(), submeshTable.size() * sizeof(CookedMeshHeader::Submesh));
+    }
+    std::filesystem::rename(temporary, cookedPath, error);
+    return !error;
+}
+
+/**
+ * Maps a cooked mesh, returns false if it is missing, from another version, truncated or
+ * otherwise corrupt. Every blob and index is checked, the arena and BVH builds trust them.
+ */
+bool readCookedMesh(const std::string &path, CookedMesh &mesh)
+{
+    using namespace srd;
+    mesh.file = srd::core::file::mapped_file(path, srd::core::file::access::sequential);
+    if(!mesh.file || mesh.file.size < sizeof(CookedMeshHeader)) return false;
+
+    auto header = (const CookedMeshHeader*)mesh.file.data;
+    if(header->magic != CookedMeshHeader::MAGIC || header->version != CookedMeshHeader::VERSION
+        || header->layout != CookedMeshHeader::PositionNormalTexcoordTangent
+        || header->vertexStride != sizeof(core::gfx::vertex) || header->indexWidth != sizeof(unsigned int))
+        return false;
+
+    auto fits = [&mesh](uint64_t offset, uint64_t count, size_t size)
+    {
+        return offset % alignof(float) == 0 && offset <= mesh.file.size && count <= (mesh.file.size - offset) / size;
+    };
+    if(!fits(header->vertexOffset, header->vertexCount, sizeof(core::gfx::vertex))
+        || !fits(header->indexOffset, header->indexCount, sizeof(unsigned int))
+        || !fits(header->positionOffset, header->positionCount, sizeof(glm::vec3))
+        || !fits(header->positionIndexOffset, header->indexCount, sizeof(unsigned int))
+        || !fits(header->submeshOffset, header->submeshCount, sizeof(CookedMeshHeader::Submesh)))
+        return false;
+
+    if(header->lodCount > CookedMeshHeader::MAX_LODS) return false;
+    for(uint32_t i = 0; i < header->lodCount; ++i)
+        if(header->lods[i].indexOffset > header->indexCount
+            || header->lods[i].indexCount > header->indexCount - header->lods[i].indexOffset)
+            return false;
+
+    // Submeshes are drawn and batched by their ranges.
+    auto submeshTable = (const CookedMeshHeader::Submesh*)(mesh.file.data + header->submeshOffset);
+    for(uint32_t i = 0; i < header->submeshCount; ++i)
+        if(submeshTable[i].indexOffset > header->indexCount
+            || submeshTable[i].indexCount > header->indexCount - submeshTable[i].indexOffset)
+            return false;
+
+    auto indices = (const unsigned int*)(mesh.file.data + header->indexOffset);
+    auto positionIndices = (const unsigned int*)(mesh.file.data + header->positionIndexOffset);
+    for(uint32_t i = 0; i < header->indexCount; ++i)
+        if(indices[i] >= header->vertexCount || positionIndices[i] >= header->positionCount) return false;
+
+    mesh.header = header;
+    mesh.vertices = (const core::gfx::vertex*)(mesh.file.data + header->vertexOffset);
+    mesh.indices = indices;
+    mesh.positions = (const glm::vec3*)(mesh.file.data + header->positionOffset);
+    mesh.positionIndices = positionIndices;
+    mesh.submeshTable = submeshTable;
+    return true;
+}
+
+/**
+ * Maps the cooked form of 'objPath' from 'cacheDirectory', cooking it first if it is
+ * missing, outdated or older than the OBJ file. Cooked files are named after the OBJ
+ * file and the hash of its normalized path, so equally named files do not collide.
+ */
+bool loadCookedMesh(const std::string &objPath, const std::string &cacheDirectory, CookedMesh &mesh)
+{
+    namespace fs = std::filesystem;
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)packHash(packPath(objPath)));
+    auto cookedPath = (fs::path(cacheDirectory) / fs::path(objPath).filename()).string() + "." + hash + ".mesh";
+
+    std::error_code objError, cookedError;
+    auto objTime = fs::last_write_time(objPath, objError);
+    auto cookedTime = fs::last_write_time(cookedPath, cookedError);
+    bool fresh = !cookedError && (objError || cookedTime >= objTime);
+
+    if(fresh && readCookedMesh(cookedPath, mesh)) return true;
+
+    srd::log::cout << "Cooking mesh '" << objPath << "'..." << srd::log::endl;
+    return cookMesh(objPath, cookedPath) && readCookedMesh(cookedPath, mesh);
+}
+
+/** A parsed JSON document, only as much of JSON as reading glTF needs. */
+struct JsonValue
+{
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    /** Missing members and elements are null. */
+    const JsonValue &operator[](std::string_view key) const
+    {
+        for(const auto &[name, value] : object)
+            if(name == key) return value;
+        return null_();
+    }
+
+    const JsonValue &operator[](size_t index) const
+    {
+        return index < array.size() ? array[index] : null_();
+    }
+
+    bool has(std::string_view key) const { return operator[](key).type != Null; }
+    /** Booleans read as 0 and 1. */
+    double num(double def = 0) const { return type == Number || type == Bool ? number : def; }
+    /** Numbers outside of the range of int (or NaN) read as 'def'. */
+    int integer(int def = -1) const { return (type == Number || type == Bool) && number >= INT_MIN && number <= INT_MAX ? int(number) : def; }
+    size_t size() const { return type == Array ? array.size() : object.size(); }
+
+private:
+    static const JsonValue &null_()
+    {
+        static const JsonValue value;
+        return value;
+    }
+};
+
+/** Parses the value at 'p' and moves 'p' past it, returns false on malformed input. */
+bool parseJson(const char *&p, const char *end, JsonValue &value, int depth = 0)
+{
+    auto skip = [&]() { while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p; };
+    auto literal = [&](std::string_view word) {
+        if(size_t(end - p) < word.size() || std::string_view(p, word.size()) != word) return false;
+        p += word.size();
+        return true;
+    };
+    auto string = [&](std::string &out) {
+        if(p >= end || *p != '"') return false;
+        for(++p; p < end && *p != '"'; ++p)
+        {
+            if(*p != '\\') { out += *p; continue; }
+            if(++p >= end) return false;
+            switch(*p)
+            {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u':
+            {
+                // Surrogate pairs are not joined, glTF only needs them in names.
+                unsigned int c = 0;
+                if(end - p < 5 || std::from_chars(p + 1, p + 5, c, 16).ptr != p + 5) return false;
+                p += 4;
+                if(c < 0x80) out += char(c);
+                else if(c < 0x800) { out += char(0xc0 | c >> 6); out += char(0x80 | (c & 0x3f)); }
+                else { out += char(0xe0 | c >> 12); out += char(0x80 | (c >> 6 & 0x3f)); out += char(0x80 | (c & 0x3f)); }
+                break;
+            }
+            default: out += *p; break;
+            }
+        }
+        if(p >= end) return false;
+        ++p;
+        return true;
+    };
+
+    if(depth > 64) return false;
+    skip();
+    if(p >= end) return false;
+    switch(*p)
+    {
+    case '{':
+        value.type = JsonValue::Object;
+        ++p; skip();
+        if(p < end && *p == '}') { ++p; return true; }
+        while(true)
+        {
+            auto &member = value.object.emplace_back();
+            skip();
+            if(!string(member.first)) return false;
+            skip();
+            if(p >= end || *p++ != ':') return false;
+            if(!parseJson(p, end, member.second, depth + 1)) return false;
+            skip();
+            if(p < end && *p == ',') { ++p; continue; }
+            if(p < end && *p == '}') { ++p; return true; }
+            return false;
+        }
+    case '[':
+        value.type = JsonValue::Array;
+        ++p; skip();
+        if(p < end && *p == ']') { ++p; return true; }
+        while(true)
+        {
+            if(!parseJson(p, end, value.array.emplace_back(), depth + 1)) return false;
+            skip();
+            if(p < end && *p == ',') { ++p; continue; }
+            if(p < end && *p == ']') { ++p; return true; }
+            return false;
+        }
+    case '"':
+        value.type = JsonValue::String;
+        return string(value.string);
+    case 't': value.type = JsonValue::Bool; value.number = 1; return literal("true");
+    case 'f': value.type = JsonValue::Bool; value.number = 0; return literal("false");
+    case 'n': value.type = JsonValue::Null; return literal("null");
+    default:
+    {
+        value.type = JsonValue::Number;
+        auto result = std::from_chars(p, end, value.number);
+        p = result.ptr;
+        return result.ec == std::errc();
+    }
+    }
+}
+
+/** Splits a matrix without shear into a transform. */
+void decomposeTransform(const glm::mat4 &matrix, glm::vec3 &position, glm::quat &rotation, glm::vec3 &scale)
+{
+    position = glm::vec3(matrix[3]);
+    scale = { glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])) };
+    if(glm::determinant(glm::mat3(matrix)) < 0) scale.x = -scale.x;
+    glm::mat3 basis { glm::vec3(matrix[0]) / scale.x, glm::vec3(matrix[1]) / scale.y, glm::vec3(matrix[2]) / scale.z };
+    rotation = glm::normalize(glm::quat_cast(basis));
+}
+
+/** A binary glTF file (.glb) read with `readVirtualFile`, buffer views point into its data. */
+struct GlbFile
+{
+    static constexpr uint32_t MAGIC = 0x46546c67; // "glTF"
+    static constexpr uint32_t CHUNK_JSON = 0x4e4f534a;
+    static constexpr uint32_t CHUNK_BIN = 0x004e4942;
+
+    VirtualFile file;
+    JsonValue json;
+    const unsigned char *bin = nullptr;
+    size_t binSize = 0;
+};
+
+/** Reads a .glb file and parses its JSON chunk, returns false if it is not a glTF 2.0 binary. */
+bool readGlb(const std::string &path, GlbFile &glb)
+{
+    if(!readVirtualFile(path, glb.file) || glb.file.size < 20)
+    {
+        srd::log::cerr << "Could not read glTF binary '" << path << "'!" << srd::log::endl;
+        return false;
+    }
+
+    uint32_t header[3];
+    std::memcpy(header, glb.file.data, sizeof(header));
+    if(header[0] != GlbFile::MAGIC || header[1] != 2 || header[2] > glb.file.size)
+    {
+        srd::log::cerr << "'" << path << "' is not a glTF 2.0 binary!" << srd::log::endl;
+        return false;
+    }
+
+    bool hasJson = false;
+    for(size_t offset = 12; offset + 8 <= header[2];)
+    {
+        uint32_t chunk[2];
+        std::memcpy(chunk, glb.file.data + offset, sizeof(chunk));
+        const unsigned char *data = glb.file.data + offset + 8;
+        if(offset + 8 + chunk[0] > header[2]) break;
+
+        if(chunk[1] == GlbFile::CHUNK_JSON && !hasJson)
+        {
+            const char *p = (const char*)data;
+            hasJson = parseJson(p, p + chunk[0], glb.json);
+        }
+        else if(chunk[1] == GlbFile::CHUNK_BIN && !glb.bin)
+        {
+            glb.bin = data;
+            glb.binSize = chunk[0];
+        }
+        offset += 8 + ((chunk[0] + 3) & ~size_t(3));
+    }
+
+    if(!hasJson) srd::log::cerr << "Malformed glTF JSON in '" << path << "'!" << srd::log::endl;
+    return hasJson;
+}
+
+/** Where the elements of a glTF accessor are, they are 'stride' bytes apart. */
+struct GlbAccessor
+{
+    enum ComponentType { Byte = 5120, UnsignedByte, Short, UnsignedShort, UnsignedInt = 5125, Float };
+
+    const unsigned char *data = nullptr;
+    size_t count = 0, stride = 0;
+    int componentType = 0, components = 0;
+    bool normalized = false;
+    /** Byte offset within the buffer view, interleaved attributes share a view. */
+    size_t offset = 0;
+    int view = -1;
+    const JsonValue *json = nullptr;
+
+    size_t componentSize() const { return componentType == Float || componentType == UnsignedInt ? 4 : componentType >= Short ? 2 : 1; }
+
+    /** Reads component 'c' of element 'i', normalized integers are mapped to [0, 1] or [-1, 1]. */
+    float get(size_t i, int c) const
+    {
+        const unsigned char *p = data + i * stride + c * componentSize();
+        switch(componentType)
+        {
+        case Float:         { float v; std::memcpy(&v, p, 4); return v; }
+        case UnsignedInt:   { uint32_t v; std::memcpy(&v, p, 4); return float(v); }
+        case Short:         { int16_t v; std::memcpy(&v, p, 2); return normalized ? std::max(v / 32767.f, -1.f) : v; }
+        case UnsignedShort: { uint16_t v; std::memcpy(&v, p, 2); return normalized ? v / 65535.f : v; }
+        case Byte:          { int8_t v = int8_t(*p); return normalized ? std::max(v / 127.f, -1.f) : v; }
+        default:            return normalized ? *p / 255.f : *p;
+        }
+    }
+
+    uint32_t index(size_t i) const
+    {
+        const unsigned char *p = data + i * stride;
+        if(componentType == UnsignedInt) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+        if(componentType == UnsignedShort) { uint16_t v; std::memcpy(&v, p, 2); return v; }
+        return *p;
+    }
+};
+
+/** Resolves accessor 'index' into the binary chunk, sparse accessors and external buffers are not supported. */
+bool readGlbAccessor(const GlbFile &glb, int index, GlbAccessor &accessor)
+{
+    const auto &json = glb.json["accessors"][size_t(index)];
+    const auto &view = glb.json["bufferViews"][size_t(json["bufferView"].integer())];
+    if(index < 0 || json.type != JsonValue::Object || view.type != JsonValue::Object
+    || json.has("sparse") || view["buffer"].integer(0) != 0 || !glb.bin)
+        return false;
+
+    static const std::pair<std::string_view, int> types[] = {
+        { "SCALAR", 1 }, { "VEC2", 2 }, { "VEC3", 3 }, { "VEC4", 4 }
+    };
+    accessor.components = 0;
+    for(const auto &[name, components] : types)
+        if(json["type"].string == name) accessor.components = components;
+
+    // Sizes must be whole numbers a double holds exactly, missing ones are 0.
+    auto size = [](const JsonValue &value, size_t &out)
+    {
+        double number = value.num();
+        if(!(number >= 0 && number <= 9007199254740992.0) || number != std::floor(number)) return false;
+        out = size_t(number);
+        return true;
+    };
+
+    accessor.json = &json;
+    accessor.view = json["bufferView"].integer();
+    accessor.componentType = json["componentType"].integer();
+    accessor.normalized = json["normalized"].integer(0);
+    size_t elementSize = accessor.components * accessor.componentSize();
+    size_t viewOffset, viewLength;
+    if(!size(json["count"], accessor.count) || !size(json["byteOffset"], accessor.offset)
+    || !size(view["byteOffset"], viewOffset) || !size(view["byteLength"], viewLength))
+        return false;
+    accessor.stride = elementSize;
+    if(view.has("byteStride") && !size(view["byteStride"], accessor.stride)) return false;
+
+    if(!accessor.components || accessor.componentType < GlbAccessor::Byte || accessor.componentType > GlbAccessor::Float
+    || accessor.componentType == GlbAccessor::UnsignedShort + 1 || accessor.stride < elementSize)
+        return false;
+
+    // Divided instead of multiplied, so that huge values cannot wrap around.
+    if(viewOffset > glb.binSize || viewLength > glb.binSize - viewOffset || accessor.offset > viewLength) return false;
+    if(accessor.count && (elementSize > viewLength - accessor.offset
+        || accessor.count - 1 > (viewLength - accessor.offset - elementSize) / accessor.stride))
+        return false;
+
+    accessor.data = glb.bin + viewOffset + accessor.offset;
+    return true;
+}
+
+/**
+ * The triangles of a glTF mesh, all primitives merged. The pointers point into the mapping where
+ * its layout already matches: indices stored as unsigned ints, tightly packed positions, and
+ * vertices interleaved exactly like `srd::core::gfx::vertex` (POSITION, NORMAL, TEXCOORD_0 and a
+ * VEC3 _TANGENT at offsets 0, 12, 24 and 32 of a 44 byte stride). Anything else is converted into
+ * the storage vectors. Every primitive is a submesh, its material ID is the glTF material index.
+ */
+struct GlbMesh
+{
+    std::string name;
+    const srd::core::gfx::vertex *vertices = nullptr;
+    const unsigned int *indices = nullptr;
+    const glm::vec3 *positions = nullptr;
+    size_t vertexCount = 0, indexCount = 0;
+    srd::core::math::aabb bounds;
+    std::vector<srd::core::gfx::submesh> submeshes;
+
+    std::vector<srd::core::gfx::vertex> vertexStorage;
+    std::vector<unsigned int> indexStorage;
+    std::vector<glm::vec3> positionStorage;
+};
+
+/** Returns false and leaves 'mesh' empty if it is malformed, e.g. an index is out of range. */
+bool readGlbMesh(const GlbFile &glb, size_t index, GlbMesh &mesh)
+{
+    auto fail = [&mesh]() { mesh = {}; return false; };
+    using namespace srd;
+    const auto &json = glb.json["meshes"][index];
+    mesh.name = json["name"].string;
+
+    struct Primitive { GlbAccessor position, normal, texcoord, tangent, indices; bool hasIndices; unsigned int material; };
+    std::vector<Primitive> primitives;
+    for(const auto &p : json["primitives"].array)
+    {
+        const auto &attributes = p["attributes"];
+        Primitive primitive {};
+        if(p["mode"].integer(4) != 4 || !readGlbAccessor(glb, attributes["POSITION"].integer(), primitive.position)
+        || primitive.position.components != 3)
+        {
+            log::cwrn << "Skipping a primitive of glTF mesh " << index << " that is not made of triangles" << log::endl;
+            continue;
+        }
+
+        if(!readGlbAccessor(glb, attributes["NORMAL"].integer(), primitive.normal)) primitive.normal.count = 0;
+        if(!readGlbAccessor(glb, attributes["TEXCOORD_0"].integer(), primitive.texcoord)) primitive.texcoord.count = 0;
+        if(!readGlbAccessor(glb, attributes["_TANGENT"].integer(), primitive.tangent)
+        && !readGlbAccessor(glb, attributes["TANGENT"].integer(), primitive.tangent)) primitive.tangent.count = 0;
+        primitive.hasIndices = p.has("indices");
+        primitive.material = unsigned(std::max(p["material"].integer(0), 0));
+        if(primitive.hasIndices && !readGlbAccessor(glb, p["indices"].integer(), primitive.indices)) return fail();
+        primitives.push_back(primitive);
+    }
+    if(primitives.empty()) return fail();
+
+    for(const auto &p : primitives)
+    {
+        size_t count = p.hasIndices ? p.indices.count : p.position.count;
+        auto &submesh = mesh.submeshes.emplace_back(core::gfx::submesh { unsigned(mesh.indexCount), unsigned(count), p.material, {} });
+        const auto &min = (*p.position.json)["min"], &max = (*p.position.json)["max"];
+        if(min.size() == 3 && max.size() == 3)
+        {
+            submesh.bounds.extend({ min[0].num(), min[1].num(), min[2].num() });
+            submesh.bounds.extend({ max[0].num(), max[1].num(), max[2].num() });
+        }
+        else for(size_t i = 0; i < p.position.count; i++)
+            submesh.bounds.extend({ p.position.get(i, 0), p.position.get(i, 1), p.position.get(i, 2) });
+        if(p.position.count)
+        {
+            mesh.bounds.extend(submesh.bounds.min);
+            mesh.bounds.extend(submesh.bounds.max);
+        }
+        mesh.vertexCount += p.position.count;
+        mesh.indexCount += count;
+    }
+
+    auto aligned = [](const unsigned char *data) { return (uintptr_t)data % alignof(float) == 0; };
+    const auto &p = primitives[0];
+    bool single = primitives.size() == 1;
+
+    if(single && p.hasIndices && p.indices.componentType == GlbAccessor::UnsignedInt
+    && p.indices.stride == sizeof(unsigned int) && aligned(p.indices.data))
+        mesh.indices = (const unsigned int*)p.indices.data;
+
+    if(single && p.position.componentType == GlbAccessor::Float
+    && p.position.stride == sizeof(glm::vec3) && aligned(p.position.data))
+        mesh.positions = (const glm::vec3*)p.position.data;
+
+    auto at = [&](const GlbAccessor &a, size_t offset) {
+        return a.count == p.position.count && a.view == p.position.view && a.componentType == GlbAccessor::Float
+            && a.stride == sizeof(core::gfx::vertex) && a.offset == p.position.offset + offset;
+    };
+    if(single && p.position.stride == sizeof(core::gfx::vertex) && p.position.componentType == GlbAccessor::Float
+    && aligned(p.position.data) && p.position.offset % alignof(float) == 0
+    && at(p.normal, offsetof(core::gfx::vertex, normal)) && at(p.texcoord, offsetof(core::gfx::vertex, texcoord))
+    && at(p.tangent, offsetof(core::gfx::vertex, tangent)) && p.tangent.components == 3)
+        mesh.vertices = (const core::gfx::vertex*)p.position.data;
+
+    // Converted in one pass per primitive, attributes missing from the file stay zero.
+    if(!mesh.vertices) mesh.vertexStorage.resize(mesh.vertexCount);
+    if(!mesh.indices) mesh.indexStorage.resize(mesh.indexCount);
+    if(!mesh.positions) mesh.positionStorage.resize(mesh.vertexCount);
+    size_t baseVertex = 0, baseIndex = 0;
+    for(const auto &p : primitives)
+    {
+        for(size_t i = 0; i < p.position.count && !mesh.vertices; i++)
+        {
+            auto &v = mesh.vertexStorage[baseVertex + i];
+            v.position = { p.position.get(i, 0), p.position.get(i, 1), p.position.get(i, 2) };
+            if(i < p.normal.count)   v.normal   = { p.normal.get(i, 0), p.normal.get(i, 1), p.normal.get(i, 2) };
+            if(i < p.texcoord.count) v.texcoord = { p.texcoord.get(i, 0), p.texcoord.get(i, 1) };
+            if(i < p.tangent.count)  v.tangent  = { p.tangent.get(i, 0), p.tangent.get(i, 1), p.tangent.get(i, 2) };
+        }
+
+        for(size_t i = 0; i < p.position.count && !mesh.positions; i++)
+            mesh.positionStorage[baseVertex + i] = { p.position.get(i, 0), p.position.get(i, 1), p.position.get(i, 2) };
+
+        size_t count = p.hasIndices ? p.indices.count : p.position.count;
+        for(size_t i = 0; i < count && !mesh.indices; i++)
+        {
+            uint32_t vertex = p.hasIndices ? p.indices.index(i) : uint32_t(i);
+            if(vertex >= p.position.count) return fail();
+            mesh.indexStorage[baseIndex + i] = unsigned(baseVertex + vertex);
+        }
+        baseVertex += p.position.count;
+        baseIndex += count;
+    }
+
+    // Indices used in place are checked too, the arena trusts them.
+    if(mesh.indices)
+        for(size_t i = 0; i < mesh.indexCount; i++)
+            if(mesh.indices[i] >= mesh.vertexCount) return fail();
+
+    if(!mesh.vertices) mesh.vertices = mesh.vertexStorage.data();
+    if(!mesh.indices) mesh.indices = mesh.indexStorage.data();
+    if(!mesh.positions) mesh.positions = mesh.positionStorage.data();
+    return true;
+}
+
+/** A node of a glTF scene with a mesh, its transform is relative to the scene. */
+struct GlbNode
+{
+    std::string name;
+    int mesh;
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+/** Flattens the node hierarchy of the default scene into the nodes which have a mesh. */
+void readGlbNodes(const GlbFile &glb, std::vector<GlbNode> &nodes)
+{
+    const auto &all = glb.json["nodes"];
+    std::function<void(int, const glm::mat4&, int)> visit = [&](int index, const glm::mat4 &parent, int depth)
+    {
+        const auto &node = all[size_t(index)];
+        if(index < 0 || node.type != JsonValue::Object || depth > 64) return;
+
+        glm::mat4 local(1.f);
+        if(node["matrix"].size() == 16)
+        {
+            for(int i = 0; i < 16; i++) local[i / 4][i % 4] = float(node["matrix"][i].num());
+        }
+        else
+        {
+            const auto &t = node["translation"], &r = node["rotation"], &s = node["scale"];
+            glm::vec3 translation { t[0].num(), t[1].num(), t[2].num() };
+            glm::quat rotation { float(r[3].num(1)), float(r[0].num()), float(r[1].num()), float(r[2].num()) };
+            glm::vec3 scale { s[0].num(1), s[1].num(1), s[2].num(1) };
+            local = glm::translate(glm::mat4(1.f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.f), scale);
+        }
+
+        glm::mat4 world = parent * local;
+        if(node.has("mesh"))
+        {
+            auto &out = nodes.emplace_back();
+            out.name = node["name"].string;
+            out.mesh = node["mesh"].integer();
+            decomposeTransform(world, out.position, out.rotation, out.scale);
+        }
+        for(const auto &child : node["children"].array) visit(child.integer(), world, depth + 1);
+    };
+
+    const auto &scenes = glb.json["scenes"];
+    if(scenes.size())
+    {
+        for(const auto &root : scenes[size_t(glb.json["scene"].integer(0))]["nodes"].array)
+            visit(root.integer(), glm::mat4(1.f), 0);
+        return;
+    }
+
+    // Without scenes every node that is nobody's child is a root.
+    std::vector<bool> child(all.size());
+    for(const auto &node : all.array)
+        for(const auto &c : node["children"].array)
+            if(size_t(c.integer()) < child.size()) child[c.integer()] = true;
+    for(size_t i = 0; i < all.size(); i++)
+        if(!child[i]) visit(int(i), glm::mat4(1.f), 0);
+}
+
 #endif // UTIL